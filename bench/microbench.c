@@ -0,0 +1,385 @@
+// Micro-benchmarks for the data structures under the interpreter: the hash
+// table, string interning, the garbage collector, chunk growth and starting a
+// vm. Each case prints the average time of one operation.
+//
+// usage: clox_microbench [filter]
+//   only runs the cases whose name contains filter, like "tombs 0.45" or
+//   "collect_garbage"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+// keys in the tables the table cases measure
+#define TABLE_CAPACITY (1 << 14)
+// how many times each case repeats its operation
+#define TABLE_OPERATIONS 2000000
+#define STRING_OPERATIONS 1000000
+#define CHUNK_BYTES (1 << 16)
+#define CHUNK_REPEATS 200
+#define GC_REPEATS 20
+#define STARTUP_REPEATS 200
+// classes, each with this many methods, in the script the startup cases run
+#define STARTUP_CLASSES 16
+#define STARTUP_METHODS 5
+
+static const char* filter = NULL;
+static VM* vm = NULL;
+
+static double now(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static bool selected(const char* name) {
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char* name, double seconds, long operations) {
+    printf("%-44s %10.1f ns/op\n", name, seconds * 1e9 / operations);
+}
+
+static void report_heap(const char* name, size_t bytes) {
+    printf("%-44s %10zu bytes\n", name, bytes);
+}
+
+// only collect when a case asks for it, so nothing is freed while a case
+// holds pointers the gc doesn't know about
+static void disable_gc(void) {
+    vm->next_gc = SIZE_MAX;
+}
+
+static ObjString* make_key(const char* prefix, int i) {
+    char chars[32];
+    int length = snprintf(chars, sizeof(chars), "%s%d", prefix, i);
+    return copy_string(vm, chars, length);
+}
+
+static void make_keys(ObjString** keys, int count, const char* prefix) {
+    for (int i = 0; i < count; i++) {
+        keys[i] = make_key(prefix, i);
+    }
+}
+
+// allocates the table's entries up front so the load factor of a case is
+// exactly what it asks for
+static void table_init_capacity(Table* table, int capacity) {
+    table_init(table);
+    table->entries = ALLOCATE(vm, Entry, capacity);
+    table->capacity = capacity;
+    for (int i = 0; i < capacity; i++) {
+        table->entries[i].key = NULL;
+        table->entries[i].value = NIL_VAL;
+    }
+}
+
+static void bench_table(double load, double tombstones) {
+    static ObjString* live[TABLE_CAPACITY];
+    static ObjString* dead[TABLE_CAPACITY];
+    static ObjString* missing[TABLE_CAPACITY];
+
+    int live_count = (int)(TABLE_CAPACITY * load);
+    int dead_count = (int)(TABLE_CAPACITY * tombstones);
+    make_keys(live, live_count, "live");
+    make_keys(dead, dead_count, "dead");
+    make_keys(missing, TABLE_CAPACITY, "missing");
+
+    Table table;
+    table_init_capacity(&table, TABLE_CAPACITY);
+    for (int i = 0; i < dead_count; i++) {
+        table_set(vm, &table, dead[i], NIL_VAL);
+    }
+    for (int i = 0; i < live_count; i++) {
+        table_set(vm, &table, live[i], NUMBER_VAL(i));
+    }
+    for (int i = 0; i < dead_count; i++) {
+        table_delete(&table, dead[i]);
+    }
+
+    char name[64];
+    double start;
+    Value value;
+    int found = 0;
+
+    snprintf(name, sizeof(name), "table_get hit    load %.2f tombs %.2f", load,
+             tombstones);
+    if (selected(name)) {
+        start = now();
+        for (int i = 0; i < TABLE_OPERATIONS; i++) {
+            found += table_get(&table, live[i % live_count], &value);
+        }
+        report(name, now() - start, TABLE_OPERATIONS);
+    }
+
+    snprintf(name, sizeof(name), "table_get miss   load %.2f tombs %.2f", load,
+             tombstones);
+    if (selected(name)) {
+        start = now();
+        for (int i = 0; i < TABLE_OPERATIONS; i++) {
+            found += table_get(&table, missing[i % TABLE_CAPACITY], &value);
+        }
+        report(name, now() - start, TABLE_OPERATIONS);
+    }
+
+    snprintf(name, sizeof(name), "table_set update load %.2f tombs %.2f", load,
+             tombstones);
+    if (selected(name)) {
+        start = now();
+        for (int i = 0; i < TABLE_OPERATIONS; i++) {
+            table_set(vm, &table, live[i % live_count], NUMBER_VAL(i));
+        }
+        report(name, now() - start, TABLE_OPERATIONS);
+    }
+
+    // every key is deleted right after it's set, so the load stays the same
+    snprintf(name, sizeof(name), "table_set+delete load %.2f tombs %.2f", load,
+             tombstones);
+    if (selected(name)) {
+        start = now();
+        for (int i = 0; i < TABLE_OPERATIONS; i++) {
+            ObjString* key = missing[i % TABLE_CAPACITY];
+            table_set(vm, &table, key, NIL_VAL);
+            table_delete(&table, key);
+        }
+        report(name, now() - start, TABLE_OPERATIONS);
+    }
+
+    // keeps the lookups from being optimized away
+    if (found < 0) {
+        printf("%d\n", found);
+    }
+
+    table_free(vm, &table);
+}
+
+static void bench_tables(void) {
+    static const double loads[] = {0.25, 0.5, 0.7};
+    static const double tombstones[] = {0.0, 0.2, 0.45};
+
+    for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        for (size_t j = 0; j < sizeof(tombstones) / sizeof(tombstones[0]);
+             j++) {
+            // the table would grow past the maximum load
+            if (loads[i] + tombstones[j] > 0.75) {
+                continue;
+            }
+            bench_table(loads[i], tombstones[j]);
+        }
+    }
+}
+
+static void bench_copy_string(void) {
+    static char chars[STRING_OPERATIONS][16];
+    static int lengths[STRING_OPERATIONS];
+
+    if (selected("copy_string hit")) {
+        for (int i = 0; i < TABLE_CAPACITY; i++) {
+            lengths[i] = snprintf(chars[i], sizeof(chars[i]), "interned%d", i);
+            copy_string(vm, chars[i], lengths[i]);
+        }
+
+        double start = now();
+        for (int i = 0; i < STRING_OPERATIONS; i++) {
+            int index = i % TABLE_CAPACITY;
+            copy_string(vm, chars[index], lengths[index]);
+        }
+        report("copy_string hit", now() - start, STRING_OPERATIONS);
+    }
+
+    if (selected("copy_string miss")) {
+        for (int i = 0; i < STRING_OPERATIONS; i++) {
+            lengths[i] = snprintf(chars[i], sizeof(chars[i]), "unique%d", i);
+        }
+
+        double start = now();
+        for (int i = 0; i < STRING_OPERATIONS; i++) {
+            copy_string(vm, chars[i], lengths[i]);
+        }
+        report("copy_string miss", now() - start, STRING_OPERATIONS);
+    }
+}
+
+static void bench_chunk_write(void) {
+    if (!selected("chunk_write")) {
+        return;
+    }
+
+    double start = now();
+    for (int i = 0; i < CHUNK_REPEATS; i++) {
+        Chunk chunk;
+        chunk_init(&chunk);
+        for (int byte = 0; byte < CHUNK_BYTES; byte++) {
+            chunk_write(vm, &chunk, (uint8_t)byte, byte);
+        }
+        chunk_free(vm, &chunk);
+    }
+    report("chunk_write", now() - start, (long)CHUNK_REPEATS * CHUNK_BYTES);
+}
+
+typedef enum HeapShape {
+    // every live instance is a field of the root
+    SHAPE_WIDE,
+    // the live instances form a linked list starting at the root
+    SHAPE_DEEP,
+} HeapShape;
+
+typedef struct GcCase {
+    const char* name;
+    HeapShape shape;
+    int live;
+    // unreachable instances allocated before each collection
+    int garbage;
+} GcCase;
+
+static const GcCase gc_cases[] = {
+    {"collect_garbage wide   10k live   0 garbage", SHAPE_WIDE, 10000, 0},
+    {"collect_garbage wide   10k live 100k garbage", SHAPE_WIDE, 10000,
+     100000},
+    {"collect_garbage deep   10k live   0 garbage", SHAPE_DEEP, 10000, 0},
+    {"collect_garbage deep  100k live   0 garbage", SHAPE_DEEP, 100000, 0},
+    {"collect_garbage deep  100k live 100k garbage", SHAPE_DEEP, 100000,
+     100000},
+};
+
+static void bench_gc_case(const GcCase* gc_case) {
+    ObjClass* klass = class_new(vm, copy_string(vm, "Node", 4));
+    push(vm, OBJ_VAL(klass));
+    ObjString* next = copy_string(vm, "next", 4);
+    push(vm, OBJ_VAL(next));
+    ObjInstance* root = instance_new(vm, klass);
+    push(vm, OBJ_VAL(root));
+
+    ObjInstance* tail = root;
+    for (int i = 0; i < gc_case->live; i++) {
+        ObjInstance* node = instance_new(vm, klass);
+        if (gc_case->shape == SHAPE_WIDE) {
+            table_set(vm, &root->fields, make_key("field", i), OBJ_VAL(node));
+        } else {
+            table_set(vm, &tail->fields, next, OBJ_VAL(node));
+            tail = node;
+        }
+    }
+
+    double elapsed = 0;
+    for (int i = 0; i < GC_REPEATS; i++) {
+        for (int j = 0; j < gc_case->garbage; j++) {
+            instance_new(vm, klass);
+        }
+
+        double start = now();
+        collect_garbage(vm);
+        elapsed += now() - start;
+        disable_gc();
+    }
+    report(gc_case->name, elapsed, GC_REPEATS);
+
+    pop(vm);
+    pop(vm);
+    pop(vm);
+    collect_garbage(vm);
+    disable_gc();
+}
+
+static void bench_gc(void) {
+    for (size_t i = 0; i < sizeof(gc_cases) / sizeof(gc_cases[0]); i++) {
+        if (selected(gc_cases[i].name)) {
+            bench_gc_case(&gc_cases[i]);
+        }
+    }
+}
+
+// a script that does nothing but define classes, so running it is mostly
+// compiling it
+static char* startup_source(void) {
+    size_t capacity = STARTUP_CLASSES * STARTUP_METHODS * 64;
+    char* source = malloc(capacity);
+    int length = 0;
+    for (int i = 0; i < STARTUP_CLASSES; i++) {
+        length += snprintf(source + length, capacity - length,
+                           "class Class%d {\n", i);
+        for (int j = 0; j < STARTUP_METHODS; j++) {
+            length += snprintf(source + length, capacity - length,
+                               "  method%d(a) { return a + \"%d\"; }\n", j,
+                               j);
+        }
+        length += snprintf(source + length, capacity - length, "}\n");
+    }
+    return source;
+}
+
+// starting a vm that compiles its script against one that runs a script
+// compiled once up front
+static void bench_startup(void) {
+    bool compiled = selected("startup vm_interpret");
+    bool shared = selected("startup vm_interpret_script");
+    if (!compiled && !shared) {
+        return;
+    }
+
+    char* source = startup_source();
+    Script* script = script_compile(source);
+    if (script == NULL) {
+        free(source);
+        return;
+    }
+    size_t heap = 0;
+
+    if (compiled) {
+        double start = now();
+        for (int i = 0; i < STARTUP_REPEATS; i++) {
+            VM* startup_vm = vm_new();
+            vm_interpret(startup_vm, source);
+            heap = startup_vm->bytes_allocated;
+            vm_free(startup_vm);
+        }
+        report("startup vm_interpret", now() - start, STARTUP_REPEATS);
+        report_heap("startup vm_interpret heap", heap);
+    }
+
+    if (shared) {
+        double start = now();
+        for (int i = 0; i < STARTUP_REPEATS; i++) {
+            VM* startup_vm = vm_new();
+            vm_interpret_script(startup_vm, script);
+            heap = startup_vm->bytes_allocated;
+            vm_free(startup_vm);
+        }
+        report("startup vm_interpret_script", now() - start,
+               STARTUP_REPEATS);
+        report_heap("startup vm_interpret_script heap", heap);
+    }
+
+    script_free(script);
+    free(source);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: clox_microbench [filter]\n");
+        return 64;
+    }
+    filter = argc == 2 ? argv[1] : NULL;
+
+    vm = vm_new();
+    disable_gc();
+
+    // first, because the other cases leave behind a big string table that
+    // every collection would have to sweep
+    bench_gc();
+    bench_tables();
+    bench_copy_string();
+    bench_chunk_write();
+    bench_startup();
+
+    vm_free(vm);
+    return 0;
+}
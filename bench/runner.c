@@ -0,0 +1,280 @@
+// Runs Lox benchmark scripts with clox and reports their median wall clock
+// time, its standard deviation and the peak resident set size of each one as
+// JSON. When a baseline report exists a comparison against it is printed to
+// stderr.
+//
+// usage: bench_runner [--runs N] [--baseline path] [--save-baseline]
+//                     [--output path] <clox> <script.lox>...
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RUNS 5
+#define NAME_MAX_LENGTH 64
+#define BASELINE_MAX 256
+
+typedef struct Result {
+    char name[NAME_MAX_LENGTH];
+    int runs;
+    double median;
+    double stddev;
+    double min;
+    long peak_rss_kib;
+} Result;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// runs the script once, returns false if clox failed
+static bool run_once(const char* clox,
+                     const char* script,
+                     double* elapsed,
+                     long* rss_kib) {
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return false;
+    }
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+        }
+        execl(clox, clox, script, (char*)NULL);
+        perror(clox);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return false;
+    }
+    *elapsed = now() - start;
+
+#ifdef __APPLE__
+    // bytes on macOS, KiB everywhere else
+    *rss_kib = usage.ru_maxrss / 1024;
+#else
+    *rss_kib = usage.ru_maxrss;
+#endif
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed with status %d\n", script, status);
+        return false;
+    }
+    return true;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// the script's file name without directories and extension
+static void benchmark_name(const char* script, char* name) {
+    const char* start = strrchr(script, '/');
+    start = start ? start + 1 : script;
+    const char* end = strrchr(start, '.');
+    int length = end ? (int)(end - start) : (int)strlen(start);
+    if (length >= NAME_MAX_LENGTH) {
+        length = NAME_MAX_LENGTH - 1;
+    }
+    memcpy(name, start, length);
+    name[length] = '\0';
+}
+
+static bool run_benchmark(const char* clox,
+                          const char* script,
+                          int runs,
+                          Result* result) {
+    double* times = malloc(sizeof(double) * runs);
+    benchmark_name(script, result->name);
+    result->runs = runs;
+    result->peak_rss_kib = 0;
+
+    double sum = 0;
+    for (int i = 0; i < runs; i++) {
+        long rss_kib;
+        if (!run_once(clox, script, &times[i], &rss_kib)) {
+            free(times);
+            return false;
+        }
+        sum += times[i];
+        if (rss_kib > result->peak_rss_kib) {
+            result->peak_rss_kib = rss_kib;
+        }
+    }
+
+    qsort(times, runs, sizeof(double), compare_doubles);
+    result->min = times[0];
+    result->median = runs % 2 == 1
+                         ? times[runs / 2]
+                         : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+
+    double mean = sum / runs;
+    double squares = 0;
+    for (int i = 0; i < runs; i++) {
+        squares += (times[i] - mean) * (times[i] - mean);
+    }
+    result->stddev = runs > 1 ? sqrt(squares / (runs - 1)) : 0;
+
+    free(times);
+    return true;
+}
+
+// one benchmark per line, which is what read_report() relies on
+static void write_report(FILE* file, Result* results, int count) {
+    fprintf(file, "{\n");
+    for (int i = 0; i < count; i++) {
+        Result* result = &results[i];
+        fprintf(file,
+                "  \"%s\": {\"runs\": %d, \"median_s\": %.6f, "
+                "\"stddev_s\": %.6f, \"min_s\": %.6f, \"peak_rss_kib\": %ld}%s\n",
+                result->name, result->runs, result->median, result->stddev,
+                result->min, result->peak_rss_kib, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "}\n");
+}
+
+static int read_report(const char* path, Result* results, int capacity) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    int count = 0;
+    char line[512];
+    while (count < capacity && fgets(line, sizeof(line), file)) {
+        Result* result = &results[count];
+        if (sscanf(line,
+                   " \"%63[^\"]\": {\"runs\": %d, \"median_s\": %lf, "
+                   "\"stddev_s\": %lf, \"min_s\": %lf, \"peak_rss_kib\": %ld}",
+                   result->name, &result->runs, &result->median,
+                   &result->stddev, &result->min,
+                   &result->peak_rss_kib) == 6) {
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void compare(Result* results,
+                    int count,
+                    Result* baseline,
+                    int baseline_count) {
+    fprintf(stderr, "%-16s %10s %10s %8s %12s\n", "benchmark", "baseline",
+            "current", "change", "rss change");
+    for (int i = 0; i < count; i++) {
+        Result* result = &results[i];
+        for (int j = 0; j < baseline_count; j++) {
+            Result* old = &baseline[j];
+            if (strcmp(result->name, old->name) != 0) {
+                continue;
+            }
+
+            double delta = result->median - old->median;
+            // differences within two standard deviations are likely noise
+            double noise = 2 * fmax(result->stddev, old->stddev);
+            fprintf(stderr, "%-16s %9.3fs %9.3fs %+7.1f%% %+11ldK%s\n",
+                    result->name, old->median, result->median,
+                    100 * delta / old->median,
+                    result->peak_rss_kib - old->peak_rss_kib,
+                    fabs(delta) > noise ? "" : "  ~ noise");
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: bench_runner [--runs N] [--baseline path] "
+            "[--save-baseline] [--output path] <clox> <script.lox>...\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+    int runs = DEFAULT_RUNS;
+    const char* baseline_path = NULL;
+    const char* output_path = NULL;
+    bool save_baseline = false;
+
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--save-baseline") == 0) {
+            save_baseline = true;
+        } else if (arg + 1 >= argc) {
+            usage();
+        } else if (strcmp(argv[arg], "--runs") == 0) {
+            runs = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--baseline") == 0) {
+            baseline_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--output") == 0) {
+            output_path = argv[++arg];
+        } else {
+            usage();
+        }
+    }
+    if (argc - arg < 2 || runs < 1 || (save_baseline && !baseline_path)) {
+        usage();
+    }
+
+    const char* clox = argv[arg++];
+    int count = argc - arg;
+    Result* results = malloc(sizeof(Result) * count);
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "running %s\n", argv[arg + i]);
+        if (!run_benchmark(clox, argv[arg + i], runs, &results[i])) {
+            return 70;
+        }
+    }
+
+    write_report(stdout, results, count);
+    if (output_path) {
+        FILE* file = fopen(output_path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "could not write '%s'\n", output_path);
+            return 74;
+        }
+        write_report(file, results, count);
+        fclose(file);
+    }
+
+    if (save_baseline) {
+        FILE* file = fopen(baseline_path, "w");
+        if (file == NULL) {
+            fprintf(stderr, "could not write '%s'\n", baseline_path);
+            return 74;
+        }
+        write_report(file, results, count);
+        fclose(file);
+    } else if (baseline_path) {
+        Result* baseline = malloc(sizeof(Result) * BASELINE_MAX);
+        int baseline_count =
+            read_report(baseline_path, baseline, BASELINE_MAX);
+        if (baseline_count > 0) {
+            compare(results, count, baseline, baseline_count);
+        }
+        free(baseline);
+    }
+
+    free(results);
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Measures how the throughput of a VmPool grows with its thread count. For
+// every script and thread count it runs `jobs` copies of the script per
+// thread, each in its own VM, and reports the scripts finished per second.
+// With no shared state between VMs the throughput should grow close to
+// linearly until the threads outnumber the processors.
+//
+// usage: clox_scaling [--threads N] [--jobs N] <script.lox>...
+//   --threads N  the largest thread count, one per processor by default.
+//                1, 2, 4... up to it are measured
+//   --jobs N     scripts each thread runs per measurement, 2 by default
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clox.h"
+
+#define DEFAULT_JOBS 2
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+static double now(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static char* read_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "could not open file '%s'\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = malloc(file_size + 1);
+    if (buffer == NULL || fread(buffer, 1, file_size, file) < file_size) {
+        fprintf(stderr, "could not read file '%s'\n", path);
+        exit(74);
+    }
+    buffer[file_size] = '\0';
+
+    fclose(file);
+    return buffer;
+}
+
+// seconds it takes `threads` threads to run `count` copies of source
+static double measure(const char* source, int threads, int count) {
+    VmPool* pool = vm_pool_new(threads);
+    if (pool == NULL) {
+        fprintf(stderr, "could not start %d threads\n", threads);
+        exit(70);
+    }
+
+    InterpretResult* results = malloc(sizeof(InterpretResult) * count);
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        if (results == NULL || !vm_pool_submit(pool, source, &results[i])) {
+            fprintf(stderr, "not enough memory to queue the scripts\n");
+            exit(70);
+        }
+    }
+    vm_pool_wait(pool);
+    double elapsed = now() - start;
+    vm_pool_free(pool);
+
+    for (int i = 0; i < count; i++) {
+        if (results[i] != INTERPRET_OK) {
+            fprintf(stderr, "a script failed\n");
+            exit(70);
+        }
+    }
+    free(results);
+    return elapsed;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: clox_scaling [--threads N] [--jobs N] <script.lox>...\n");
+    exit(64);
+}
+
+int main(int argc, const char* argv[]) {
+    int max_threads = 0;
+    int jobs = DEFAULT_JOBS;
+
+    int arg = 1;
+    for (; arg + 1 < argc && strncmp(argv[arg], "--", 2) == 0; arg += 2) {
+        if (strcmp(argv[arg], "--threads") == 0) {
+            max_threads = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "--jobs") == 0) {
+            jobs = atoi(argv[arg + 1]);
+        } else {
+            usage();
+        }
+    }
+    if (arg == argc || jobs < 1) {
+        usage();
+    }
+
+    if (max_threads <= 0) {
+        VmPool* pool = vm_pool_new(0);
+        if (pool == NULL) {
+            fprintf(stderr, "could not start the threads\n");
+            return 70;
+        }
+        max_threads = vm_pool_thread_count(pool);
+        vm_pool_free(pool);
+    }
+
+    // the scripts' output would drown out the report
+    if (freopen(NULL_DEVICE, "w", stdout) == NULL) {
+        fprintf(stderr, "could not discard the scripts' output\n");
+        return 74;
+    }
+
+    fprintf(stderr, "%-16s %7s %7s %10s %12s %8s %10s\n", "benchmark",
+            "threads", "scripts", "seconds", "scripts/s", "speedup",
+            "efficiency");
+    for (; arg < argc; arg++) {
+        char* source = read_file(argv[arg]);
+        const char* name = strrchr(argv[arg], '/');
+        name = name ? name + 1 : argv[arg];
+
+        double base = 0;
+        for (int threads = 1;; threads = threads * 2 < max_threads
+                                              ? threads * 2
+                                              : max_threads) {
+            int count = threads * jobs;
+            double elapsed = measure(source, threads, count);
+            double throughput = count / elapsed;
+            if (threads == 1) {
+                base = throughput;
+            }
+            fprintf(stderr, "%-16s %7d %7d %10.3f %12.2f %7.2fx %9.0f%%\n",
+                    name, threads, count, elapsed, throughput,
+                    throughput / base, 100 * throughput / base / threads);
+
+            if (threads == max_threads) {
+                break;
+            }
+        }
+        free(source);
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+// A C++ host embedding clox through include/clox.h. It's built with every
+// C++ standard the build checks, so the header keeps compiling and linking
+// as C++: the functions need C linkage and the inline helpers can't use C-only
+// syntax.
+//
+// usage: clox_cpp_host
+
+#include <cstdio>
+
+#include "clox.h"
+
+static bool twice(VM* vm, int arg_count, Value* args, Value* result) {
+    (void)arg_count;
+    double number;
+    if (!native_number(vm, args, 0, &number)) {
+        return false;
+    }
+
+    *result = number_value(number * 2);
+    return true;
+}
+
+static bool is_nil(VM* vm, int arg_count, Value* args, Value* result) {
+    (void)vm;
+    (void)arg_count;
+    *result = bool_value(args[0].type == nil_value().type);
+    return true;
+}
+
+int main() {
+    VM* vm = vm_new();
+    if (vm == nullptr) {
+        std::fprintf(stderr, "not enough memory for the VM\n");
+        return 1;
+    }
+
+    vm_define_native(vm, "twice", twice, 1);
+    vm_define_native(vm, "isNil", is_nil, 1);
+    InterpretResult result =
+        vm_interpret(vm, "print twice(21); print isNil(nil);");
+    vm_free(vm);
+    return result == INTERPRET_OK ? 0 : 1;
+}
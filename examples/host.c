@@ -0,0 +1,68 @@
+// A C host that adds a method to a class after scripts have called the
+// method it replaces, and checks that call sites which cached the old one
+// call the new one instead. Exits with 1 if they don't.
+//
+// usage: clox_host
+
+#include <stdio.h>
+
+#include "clox.h"
+
+static bool check(VM* vm, int arg_count, Value* args, Value* result) {
+    (void)arg_count;
+    (void)result;
+    bool passed;
+    if (!native_bool(vm, args, 0, &passed)) {
+        return false;
+    }
+    if (!passed) {
+        return native_error(vm, "check failed");
+    }
+    return true;
+}
+
+static bool host_speak(VM* vm, int arg_count, Value* args, Value* result) {
+    (void)arg_count;
+    (void)args;
+    *result = vm_string(vm, "host", 4);
+    return true;
+}
+
+// the site in speakOf() last called Dog's speak(), the one in speakAll()
+// alternates between Dog and Animal
+static const char* warm_up =
+    "class Animal { speak() { return \"...\"; } }\n"
+    "class Dog < Animal { speak() { return \"woof\"; } }\n"
+    "fun speakOf(animal) { return animal.speak(); }\n"
+    "fun speakAll(animals) {\n"
+    "  var said = \"\";\n"
+    "  for (animal in animals) said = said + animal.speak();\n"
+    "  return said;\n"
+    "}\n"
+    "var dog = Dog();\n"
+    "for (var i = 0; i < 100; i = i + 1) {\n"
+    "  speakAll([dog, Animal()]);\n"
+    "  speakOf(dog);\n"
+    "}\n"
+    "check(speakOf(dog) == \"woof\");\n";
+
+static const char* after_define =
+    "check(speakOf(dog) == \"host\");\n"
+    "check(speakAll([dog, Animal()]) == \"host...\");\n"
+    "check(Animal().speak() == \"...\");\n";
+
+int main(void) {
+    VM* vm = vm_new();
+    if (vm == NULL) {
+        fprintf(stderr, "not enough memory for the VM\n");
+        return 1;
+    }
+
+    vm_define_native(vm, "check", check, 1);
+    bool passed = vm_interpret(vm, warm_up) == INTERPRET_OK &&
+                  vm_define_method(vm, "Dog", "speak", host_speak, 0) &&
+                  vm_interpret(vm, after_define) == INTERPRET_OK;
+    vm_free(vm);
+    puts(passed ? "passed" : "failed");
+    return passed ? 0 : 1;
+}
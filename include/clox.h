@@ -0,0 +1,170 @@
+#ifndef clox_h
+#define clox_h
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the interface for embedding clox. every interpreter lives in its own VM,
+// objects and globals of one VM are never visible to another. VMs share no
+// mutable state, so different threads can each run their own VM at the same
+// time, but a single VM must only be used by one thread at a time
+
+typedef struct VM VM;
+typedef struct Obj Obj;
+
+typedef enum ValueType {
+    VAL_BOOL,
+    VAL_NIL,
+    VAL_NUMBER,
+    VAL_OBJ,
+} ValueType;
+
+// a Lox value. objects are only valid while they're reachable from the VM
+typedef struct Value {
+    ValueType type;
+    union as {
+        bool boolean;
+        double number;
+        Obj* obj;
+    } as;
+} Value;
+
+typedef enum InterpretResult {
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR,
+} InterpretResult;
+
+// returns NULL if there isn't enough memory for the VM
+VM* vm_new(void);
+void vm_free(VM* vm);
+// compiles and runs source as a script, globals defined by earlier calls on
+// the same VM stay defined
+InterpretResult vm_interpret(VM* vm, const char* source);
+// limits how deep calls can nest and how many values the VM's stack can hold,
+// calls past either are a "stack overflow" runtime error. the frames and the
+// stack start out small and grow up to them. the defaults are 65536 frames
+// and 4194304 values
+void vm_set_stack_limits(VM* vm, int max_frames, int max_stack);
+
+// a function implemented by the host. args points at the arguments on the
+// VM's stack, and args[-1] is the receiver when it's called as a method. it
+// returns true after storing its return value in result, which starts out as
+// nil, or false after reporting an error with native_error()
+typedef bool (*NativeFn)(VM* vm, int arg_count, Value* args, Value* result);
+
+// a kind of host data that instances of a foreign class carry
+typedef struct ForeignType {
+    // the name of the class
+    const char* name;
+    // called with the instance's data when the garbage collector frees it,
+    // can be NULL. it must not use the VM
+    void (*finalize)(void* data);
+} ForeignType;
+
+// defines a global function, an arity of -1 accepts any number of arguments
+void vm_define_native(VM* vm, const char* name, NativeFn function, int arity);
+// defines a global class named after the type whose instances, and those of
+// its subclasses, carry a pointer of that type. it starts out as NULL, an
+// `init` method usually sets it with native_set_foreign()
+void vm_define_foreign_class(VM* vm, const ForeignType* type);
+// adds a method to the global class class_name, returns false if there's no
+// such class
+bool vm_define_method(VM* vm,
+                      const char* class_name,
+                      const char* name,
+                      NativeFn function,
+                      int arity);
+
+// reports a runtime error from a native, which must then return false
+bool native_error(VM* vm, const char* format, ...);
+// these check the type of args[index], the receiver when index is -1. they
+// report an error and return false if it has a different type
+bool native_number(VM* vm, Value* args, int index, double* number);
+bool native_bool(VM* vm, Value* args, int index, bool* boolean);
+// chars is valid as long as the string is reachable from the VM
+bool native_string(VM* vm,
+                   Value* args,
+                   int index,
+                   const char** chars,
+                   int* length);
+// the data of a foreign instance, NULL until it's set
+bool native_foreign(VM* vm,
+                    Value* args,
+                    int index,
+                    const ForeignType* type,
+                    void** data);
+// finalizes the data it replaces
+bool native_set_foreign(VM* vm,
+                        Value* args,
+                        int index,
+                        const ForeignType* type,
+                        void* data);
+
+// these assign the members instead of using designated initializers, which
+// C++ only has since C++20
+static inline Value nil_value(void) {
+    Value value;
+    value.type = VAL_NIL;
+    value.as.number = 0;
+    return value;
+}
+
+static inline Value bool_value(bool boolean) {
+    Value value;
+    value.type = VAL_BOOL;
+    value.as.boolean = boolean;
+    return value;
+}
+
+static inline Value number_value(double number) {
+    Value value;
+    value.type = VAL_NUMBER;
+    value.as.number = number;
+    return value;
+}
+
+// the new string can be collected by any allocation, so a native should
+// create it last, right before storing it in its result
+Value vm_string(VM* vm, const char* chars, int length);
+
+// a compiled script that any number of VMs, on any threads, can run without
+// compiling it again. its functions and strings are frozen: they're shared
+// read-only and no VM's garbage collector marks or frees them. it must not be
+// freed while a VM that ran it is still alive
+typedef struct Script Script;
+
+// returns NULL if the source has compile errors, which are reported on stderr
+Script* script_compile(const char* source);
+void script_free(Script* script);
+// runs the script without compiling it, unless the VM has run other code
+// before that made its own copies of the script's strings
+InterpretResult vm_interpret_script(VM* vm, const Script* script);
+
+// a fixed set of threads that run scripts, each one in a fresh VM
+typedef struct VmPool VmPool;
+
+// starts `thread_count` threads, or one per processor when it's 0 or less.
+// returns NULL if the threads can't be started
+VmPool* vm_pool_new(int thread_count);
+// waits for the queued scripts to finish and stops the threads
+void vm_pool_free(VmPool* pool);
+int vm_pool_thread_count(VmPool* pool);
+// queues source to run on the first idle thread. it's compiled into a Script
+// the first time it's submitted, later submissions of the same source share
+// that Script while it's among the 64 most recently submitted sources. when
+// result isn't NULL the script's outcome is stored there before
+// vm_pool_wait() returns. returns false if there isn't enough memory to queue
+// it. can be called from any thread
+bool vm_pool_submit(VmPool* pool, const char* source, InterpretResult* result);
+// blocks until every script submitted so far has finished
+void vm_pool_wait(VmPool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
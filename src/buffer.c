@@ -0,0 +1,325 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "assert.h"
+#include "buffer.h"
+#include "memory.h"
+#include "native.h"
+#include "script.h"
+#include "simd.h"
+#include "vm.h"
+
+// keeps the size of any buffer's allocation in an int
+#define BUFFER_MAX ((INT_MAX - BUFFER_ALIGNMENT) / (int)sizeof(double))
+
+static ObjBuffer* receiver(Value* args, BufferType type) {
+    UNUSED(type);
+    ASSERT(IS_BUFFER(args[-1]) && AS_BUFFER(args[-1])->type == type,
+           "buffer methods are only called on buffers of their type");
+    return AS_BUFFER(args[-1]);
+}
+
+static double* float64s(Value* args) {
+    return receiver(args, BUFFER_FLOAT64)->data;
+}
+
+static uint8_t* bytes(Value* args) {
+    return receiver(args, BUFFER_BYTE)->data;
+}
+
+// whether value can be stored in a buffer of type, reporting it if not
+static bool check_element(VM* vm, BufferType type, Value value) {
+    if (!IS_NUMBER(value)) {
+        return native_error(vm, "buffer elements must be numbers");
+    }
+    double number = AS_NUMBER(value);
+    // NaN and out of range numbers can't be cast to int
+    if (type == BUFFER_BYTE &&
+        (!isfinite(number) || number < 0 || number > UINT8_MAX ||
+         number != (int)number)) {
+        return native_error(vm, "bytes must be whole numbers from 0 to 255");
+    }
+    return true;
+}
+
+static void store(ObjBuffer* buffer, int index, double number) {
+    if (buffer->type == BUFFER_FLOAT64) {
+        ((double*)buffer->data)[index] = number;
+    } else {
+        ((uint8_t*)buffer->data)[index] = (uint8_t)number;
+    }
+}
+
+// Float64Array(length) and ByteBuffer(length) are zeroed, Float64Array(list)
+// and ByteBuffer(list) copy a list of numbers
+static bool construct(VM* vm, BufferType type, Value* args, Value* result) {
+    if (IS_LIST(args[0])) {
+        ObjList* list = AS_LIST(args[0]);
+        for (int i = 0; i < list->items.count; i++) {
+            if (!check_element(vm, type, list->items.values[i])) {
+                return false;
+            }
+        }
+        // the list stays on the stack while the buffer is allocated
+        ObjBuffer* buffer = buffer_new(vm, type, list->items.count);
+        for (int i = 0; i < list->items.count; i++) {
+            store(buffer, i, AS_NUMBER(list->items.values[i]));
+        }
+        *result = OBJ_VAL(buffer);
+        return true;
+    }
+
+    if (!IS_NUMBER(args[0])) {
+        return native_error(vm, "argument 1 must be a length or a list");
+    }
+    double length = AS_NUMBER(args[0]);
+    if (!isfinite(length) || length < 0 || length > BUFFER_MAX ||
+        length != (int)length) {
+        return native_error(vm, "buffer length %g out of range", length);
+    }
+    *result = OBJ_VAL(buffer_new(vm, type, (int)length));
+    return true;
+}
+
+static bool float64_array_native(VM* vm,
+                                 int arg_count,
+                                 Value* args,
+                                 Value* result) {
+    UNUSED(arg_count);
+    return construct(vm, BUFFER_FLOAT64, args, result);
+}
+
+static bool byte_buffer_native(VM* vm,
+                               int arg_count,
+                               Value* args,
+                               Value* result) {
+    UNUSED(arg_count);
+    return construct(vm, BUFFER_BYTE, args, result);
+}
+
+// methods of both types
+
+static bool len_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    *result = NUMBER_VAL(AS_BUFFER(args[-1])->count);
+    return true;
+}
+
+// fill(x) sets every element to x
+static bool fill_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    ObjBuffer* buffer = AS_BUFFER(args[-1]);
+    if (!check_element(vm, buffer->type, args[0])) {
+        return false;
+    }
+    double number = AS_NUMBER(args[0]);
+    if (buffer->type == BUFFER_BYTE) {
+        memset(buffer->data, (int)number, buffer->count);
+    } else {
+        for (int i = 0; i < buffer->count; i++) {
+            ((double*)buffer->data)[i] = number;
+        }
+    }
+    *result = args[-1];
+    return true;
+}
+
+static bool check_not_empty(VM* vm, Value* args, const char* method) {
+    if (AS_BUFFER(args[-1])->count == 0) {
+        return native_error(vm, "can't take the %s of an empty buffer",
+                            method);
+    }
+    return true;
+}
+
+// Float64Array methods
+
+// the elements of argument index, which must be a Float64Array as long as
+// the receiver
+static bool same_length(VM* vm, Value* args, int index, double** values) {
+    ObjBuffer* buffer = receiver(args, BUFFER_FLOAT64);
+    Value other = args[index];
+    if (!IS_BUFFER(other) || AS_BUFFER(other)->type != BUFFER_FLOAT64) {
+        return native_error(vm, "argument %d must be a Float64Array",
+                            index + 1);
+    }
+    if (AS_BUFFER(other)->count != buffer->count) {
+        return native_error(vm, "expected a Float64Array of length %d, got %d",
+                            buffer->count, AS_BUFFER(other)->count);
+    }
+    *values = AS_BUFFER(other)->data;
+    return true;
+}
+
+static bool sum_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    ObjBuffer* buffer = receiver(args, BUFFER_FLOAT64);
+    *result = NUMBER_VAL(simd_sum(buffer->data, buffer->count));
+    return true;
+}
+
+static bool dot_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    double* other = NULL;
+    if (!same_length(vm, args, 0, &other)) {
+        return false;
+    }
+    *result = NUMBER_VAL(
+        simd_dot(float64s(args), other, AS_BUFFER(args[-1])->count));
+    return true;
+}
+
+// scale(k) multiplies every element by k in place
+static bool scale_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    double factor;
+    if (!native_number(vm, args, 0, &factor)) {
+        return false;
+    }
+    simd_scale(float64s(args), factor, AS_BUFFER(args[-1])->count);
+    *result = args[-1];
+    return true;
+}
+
+// add(other) adds other's elements to the receiver's in place
+static bool add_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    double* other = NULL;
+    if (!same_length(vm, args, 0, &other)) {
+        return false;
+    }
+    simd_add(float64s(args), other, AS_BUFFER(args[-1])->count);
+    *result = args[-1];
+    return true;
+}
+
+static bool min_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    if (!check_not_empty(vm, args, "min")) {
+        return false;
+    }
+    *result =
+        NUMBER_VAL(simd_min(float64s(args), AS_BUFFER(args[-1])->count));
+    return true;
+}
+
+static bool max_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    if (!check_not_empty(vm, args, "max")) {
+        return false;
+    }
+    *result =
+        NUMBER_VAL(simd_max(float64s(args), AS_BUFFER(args[-1])->count));
+    return true;
+}
+
+static const struct {
+    const char* name;
+    SimdOp op;
+} map_ops[] = {
+    {"abs", SIMD_ABS},
+    {"neg", SIMD_NEG},
+    {"sqrt", SIMD_SQRT},
+    {"square", SIMD_SQUARE},
+};
+
+// map(name) is a new array of op(x) for each element x, where name is one
+// of the ops above
+static bool map_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    const char* name;
+    int length;
+    if (!native_string(vm, args, 0, &name, &length)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(map_ops) / sizeof(map_ops[0]); i++) {
+        if (strcmp(map_ops[i].name, name) == 0) {
+            int count = AS_BUFFER(args[-1])->count;
+            ObjBuffer* mapped = buffer_new(vm, BUFFER_FLOAT64, count);
+            // the receiver is still on the stack, out of the gc's reach
+            simd_map(map_ops[i].op, mapped->data, float64s(args), count);
+            *result = OBJ_VAL(mapped);
+            return true;
+        }
+    }
+    return native_error(
+        vm, "unknown op '%s', expected abs, neg, sqrt or square", name);
+}
+
+// ByteBuffer methods
+
+static bool byte_sum_native(VM* vm,
+                            int arg_count,
+                            Value* args,
+                            Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    ObjBuffer* buffer = receiver(args, BUFFER_BYTE);
+    *result = NUMBER_VAL((double)simd_sum_bytes(buffer->data, buffer->count));
+    return true;
+}
+
+static bool byte_min_native(VM* vm,
+                            int arg_count,
+                            Value* args,
+                            Value* result) {
+    UNUSED(arg_count);
+    if (!check_not_empty(vm, args, "min")) {
+        return false;
+    }
+    *result =
+        NUMBER_VAL(simd_min_bytes(bytes(args), AS_BUFFER(args[-1])->count));
+    return true;
+}
+
+static bool byte_max_native(VM* vm,
+                            int arg_count,
+                            Value* args,
+                            Value* result) {
+    UNUSED(arg_count);
+    if (!check_not_empty(vm, args, "max")) {
+        return false;
+    }
+    *result =
+        NUMBER_VAL(simd_max_bytes(bytes(args), AS_BUFFER(args[-1])->count));
+    return true;
+}
+
+static ObjClass* float64_array_class_new(VM* vm) {
+    ObjClass* klass = class_new(vm, shared_string(vm, "Float64Array", 12));
+    push(vm, OBJ_VAL(klass));
+    class_define_native(vm, klass, "len", len_native, 0);
+    class_define_native(vm, klass, "fill", fill_native, 1);
+    class_define_native(vm, klass, "sum", sum_native, 0);
+    class_define_native(vm, klass, "dot", dot_native, 1);
+    class_define_native(vm, klass, "scale", scale_native, 1);
+    class_define_native(vm, klass, "add", add_native, 1);
+    class_define_native(vm, klass, "min", min_native, 0);
+    class_define_native(vm, klass, "max", max_native, 0);
+    class_define_native(vm, klass, "map", map_native, 1);
+    pop(vm);
+    return klass;
+}
+
+static ObjClass* byte_buffer_class_new(VM* vm) {
+    ObjClass* klass = class_new(vm, shared_string(vm, "ByteBuffer", 10));
+    push(vm, OBJ_VAL(klass));
+    class_define_native(vm, klass, "len", len_native, 0);
+    class_define_native(vm, klass, "fill", fill_native, 1);
+    class_define_native(vm, klass, "sum", byte_sum_native, 0);
+    class_define_native(vm, klass, "min", byte_min_native, 0);
+    class_define_native(vm, klass, "max", byte_max_native, 0);
+    pop(vm);
+    return klass;
+}
+
+void buffer_init(VM* vm) {
+    vm->float64_array_class = float64_array_class_new(vm);
+    vm->byte_buffer_class = byte_buffer_class_new(vm);
+    vm_define_native(vm, "Float64Array", float64_array_native, 1);
+    vm_define_native(vm, "ByteBuffer", byte_buffer_native, 1);
+}
@@ -0,0 +1,10 @@
+#ifndef clox_buffer_h
+#define clox_buffer_h
+
+#include "object.h"
+
+// defines the Float64Array and ByteBuffer constructors and creates the
+// classes their buffers look methods up in
+void buffer_init(VM* vm);
+
+#endif
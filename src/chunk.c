@@ -1,5 +1,9 @@
+#include <string.h>
+
+#include "assert.h"
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 void chunk_init(Chunk* chunk) {
@@ -7,36 +11,401 @@ void chunk_init(Chunk* chunk) {
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
+    chunk->feedback = NULL;
+    chunk->invoke_caches = NULL;
+    chunk->invoke_cache_count = 0;
     value_array_init(&chunk->constants);
 }
 
-void chunk_free(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->count);
-    value_array_free(&chunk->constants);
+void chunk_free(VM* vm, Chunk* chunk) {
+    FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(vm, LineRun, chunk->lines, chunk->line_capacity);
+    FREE_ARRAY(vm, uint8_t, chunk->feedback, chunk->count);
+    FREE_ARRAY(vm, InvokeCache, chunk->invoke_caches,
+               chunk->invoke_cache_count);
+    value_array_free(vm, &chunk->constants);
     chunk_init(chunk);
 }
 
-void chunk_write(Chunk* chunk, uint8_t byte, int line) {
+void chunk_write(VM* vm, Chunk* chunk, uint8_t byte, int line) {
     // why not chunk->count == chunk->capacity?
     if (chunk->capacity < chunk->count + 1) {
         int old_capacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
         chunk->code =
-            GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
-
-        chunk->lines =
-            GROW_ARRAY(int, chunk->lines, old_capacity, chunk->capacity);
+            GROW_ARRAY(vm, uint8_t, chunk->code, old_capacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    if (chunk->line_count > 0 &&
+        chunk->lines[chunk->line_count - 1].line == line) {
+        return;
+    }
+    if (chunk->line_capacity < chunk->line_count + 1) {
+        int old_capacity = chunk->line_capacity;
+        chunk->line_capacity = GROW_CAPACITY(old_capacity);
+        chunk->lines = GROW_ARRAY(vm, LineRun, chunk->lines, old_capacity,
+                                  chunk->line_capacity);
+    }
+    chunk->lines[chunk->line_count].offset = chunk->count - 1;
+    chunk->lines[chunk->line_count].line = line;
+    chunk->line_count++;
+}
+
+void chunk_truncate(Chunk* chunk, int count) {
+    ASSERT(count <= chunk->count, "can only truncate to a shorter chunk");
+    chunk->count = count;
+    while (chunk->line_count > 0 &&
+           chunk->lines[chunk->line_count - 1].offset >= count) {
+        chunk->line_count--;
+    }
+}
+
+int chunk_line(Chunk* chunk, int offset) {
+    ASSERT(chunk->line_count > 0, "an empty chunk has no lines");
+    // the last run that starts at or before offset
+    int low = 0;
+    int high = chunk->line_count - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (chunk->lines[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return chunk->lines[low].line;
 }
 
-int chunk_add_constant(Chunk* chunk, Value constant) {
-    push(constant);
-    value_array_write(&chunk->constants, constant);
-    pop();
+int chunk_add_constant(VM* vm, Chunk* chunk, Value constant) {
+    push(vm, constant);
+    value_array_write(vm, &chunk->constants, constant);
+    pop(vm);
     return chunk->constants.count - 1;
 }
+
+int chunk_instruction_length(Chunk* chunk, int offset) {
+    switch ((OpCode)chunk->code[offset]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_POP:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_ITER_INIT:
+            return 1;
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_CALLER_LOCAL:
+        case OP_SET_CALLER_LOCAL:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE:
+        case OP_TAIL_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_BUILD_LIST:
+        case OP_BUILD_MAP:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_SUPER_INVOKE:
+        case OP_MOVE:
+        case OP_LOADK:
+        case OP_ADD_RR:
+        case OP_SUBTRACT_RR:
+        case OP_MULTIPLY_RR:
+        case OP_DIVIDE_RR:
+        case OP_LESS_RR:
+        case OP_GREATER_RR:
+        case OP_ADD_RK:
+        case OP_SUBTRACT_RK:
+        case OP_MULTIPLY_RK:
+        case OP_DIVIDE_RK:
+        case OP_LESS_RK:
+        case OP_GREATER_RK:
+            return 3;
+        case OP_ADD_RRR:
+        case OP_SUBTRACT_RRR:
+        case OP_MULTIPLY_RRR:
+        case OP_DIVIDE_RRR:
+        case OP_ADD_RRK:
+        case OP_SUBTRACT_RRK:
+        case OP_MULTIPLY_RRK:
+        case OP_DIVIDE_RRK:
+            return 4;
+        case OP_INVOKE:
+        case OP_ITER_NEXT:
+            return 5;
+        case OP_WIDE: {
+            // one more byte for each widened operand
+            if (chunk->code[offset + 1] == OP_CLOSURE ||
+                chunk->code[offset + 1] == OP_LOCAL_FUNCTION) {
+                int constant =
+                    (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+                Value function = chunk->constants.values[constant];
+                return 4 + AS_FUNCTION(function)->upvalue_count * 3;
+            }
+            return 2 + chunk_instruction_length(chunk, offset + 1);
+        }
+        case OP_CLOSURE:
+        case OP_LOCAL_FUNCTION: {
+            Value constant = chunk->constants.values[chunk->code[offset + 1]];
+            return 2 + AS_FUNCTION(constant)->upvalue_count * 2;
+        }
+    }
+
+    UNREACHABLE("encountered an unknown instruction");
+}
+
+// how many values the instruction at offset leaves on the stack, minus how
+// many it takes, when it falls through to the next one
+static int stack_effect(Chunk* chunk, int offset) {
+    OpCode op = (OpCode)chunk->code[offset];
+    // the operand after a widened one is one byte further
+    int wide = 0;
+    if (op == OP_WIDE) {
+        op = (OpCode)chunk->code[offset + 1];
+        offset++;
+        wide = 1;
+    }
+    uint8_t* operands = &chunk->code[offset + 1];
+
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_GET_CALLER_LOCAL:
+        case OP_CLOSURE:
+        case OP_LOCAL_FUNCTION:
+        case OP_CLASS:
+        case OP_ITER_INIT:
+        case OP_ADD_RR:
+        case OP_SUBTRACT_RR:
+        case OP_MULTIPLY_RR:
+        case OP_DIVIDE_RR:
+        case OP_LESS_RR:
+        case OP_GREATER_RR:
+        case OP_ADD_RK:
+        case OP_SUBTRACT_RK:
+        case OP_MULTIPLY_RK:
+        case OP_DIVIDE_RK:
+        case OP_LESS_RK:
+        case OP_GREATER_RK:
+            return 1;
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_SET_CALLER_LOCAL:
+        case OP_GET_PROPERTY:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_ITER_NEXT:
+        case OP_MOVE:
+        case OP_LOADK:
+        case OP_ADD_RRR:
+        case OP_SUBTRACT_RRR:
+        case OP_MULTIPLY_RRR:
+        case OP_DIVIDE_RRR:
+        case OP_ADD_RRK:
+        case OP_SUBTRACT_RRK:
+        case OP_MULTIPLY_RRK:
+        case OP_DIVIDE_RRK:
+            return 0;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_GET_INDEX:
+            return -1;
+        case OP_SET_INDEX:
+            return -2;
+        case OP_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE:
+        case OP_TAIL_CALL:
+            return -operands[0];
+        case OP_INVOKE:
+            return -operands[1 + wide];
+        case OP_SUPER_INVOKE:
+            // the superclass is popped too
+            return -operands[1 + wide] - 1;
+        case OP_BUILD_LIST:
+            return 1 - operands[0];
+        case OP_BUILD_MAP:
+            return 1 - 2 * operands[0];
+        case OP_WIDE:
+            break;
+    }
+
+    UNREACHABLE("encountered an unknown instruction");
+}
+
+// the targets of jumps ahead record the deepest stack any jump to them has,
+// and the code after an unconditional jump starts from that. the compiler
+// leaves the stack as deep at the end of each statement as at its start, so
+// walking the code in order this way finds the deepest stack of every path
+int chunk_max_stack(VM* vm, Chunk* chunk, int start) {
+    int* targets = ALLOCATE(vm, int, chunk->count + 1);
+    for (int i = 0; i <= chunk->count; i++) {
+        targets[i] = 0;
+    }
+
+    int depth = start;
+    int max = start;
+    for (int offset = 0; offset < chunk->count;) {
+        if (targets[offset] > depth) {
+            depth = targets[offset];
+        }
+
+        OpCode op = (OpCode)chunk->code[offset];
+        uint8_t* operands = &chunk->code[offset + 1];
+        int next = offset + chunk_instruction_length(chunk, offset);
+        int after = depth + stack_effect(chunk, offset);
+        if (after > max) {
+            max = after;
+        }
+
+        switch (op) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE: {
+                int target = next + ((operands[0] << 8) | operands[1]);
+                if (after > targets[target]) {
+                    targets[target] = after;
+                }
+                break;
+            }
+            case OP_ITER_NEXT: {
+                // to the exit at the same depth, or to the body with the
+                // next value pushed
+                int exit = next + ((operands[0] << 8) | operands[1]);
+                int body = next + ((operands[2] << 8) | operands[3]);
+                if (depth > targets[exit]) {
+                    targets[exit] = depth;
+                }
+                if (depth + 1 > targets[body]) {
+                    targets[body] = depth + 1;
+                }
+                if (depth + 1 > max) {
+                    max = depth + 1;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        // the code after an unconditional jump is only reached from a jump
+        // to it, or it's dead code that's as deep as the code before it
+        if (op != OP_JUMP && op != OP_LOOP && op != OP_RETURN) {
+            depth = after;
+        }
+        offset = next;
+    }
+
+    FREE_ARRAY(vm, int, targets, chunk->count + 1);
+    return max;
+}
+
+uint8_t* chunk_feedback(VM* vm, Chunk* chunk, int offset) {
+    if (chunk->feedback == NULL) {
+        chunk->feedback = ALLOCATE(vm, uint8_t, chunk->count);
+        memset(chunk->feedback, 0, chunk->count);
+    }
+
+    return &chunk->feedback[offset];
+}
+
+InvokeCache* chunk_invoke_cache(VM* vm, Chunk* chunk, int index) {
+    ASSERT(index < chunk->invoke_cache_count, "the cache index is in range");
+    if (chunk->invoke_caches == NULL) {
+        chunk->invoke_caches =
+            ALLOCATE(vm, InvokeCache, chunk->invoke_cache_count);
+        for (int i = 0; i < chunk->invoke_cache_count; i++) {
+            chunk->invoke_caches[i].klass = NULL;
+            chunk->invoke_caches[i].slot = 0;
+        }
+    }
+
+    return &chunk->invoke_caches[index];
+}
+
+OpCode unquickened_op(OpCode op) {
+    switch (op) {
+        case OP_ADD_NUM:
+            return OP_ADD;
+        case OP_SUBTRACT_NUM:
+            return OP_SUBTRACT;
+        case OP_MULTIPLY_NUM:
+            return OP_MULTIPLY;
+        case OP_DIVIDE_NUM:
+            return OP_DIVIDE;
+        case OP_GREATER_NUM:
+            return OP_GREATER;
+        case OP_LESS_NUM:
+            return OP_LESS;
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE:
+            return OP_CALL;
+        default:
+            return op;
+    }
+}
@@ -26,6 +26,10 @@ typedef enum OpCode {
     OP_DEFINE_GLOBAL,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    // the variables of a local function that only the function declaring it
+    // calls, read from the slots of the calling frame instead of upvalues
+    OP_GET_CALLER_LOCAL,
+    OP_SET_CALLER_LOCAL,
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
     OP_GET_SUPER,
@@ -34,27 +38,133 @@ typedef enum OpCode {
     OP_JUMP_IF_FALSE,
     OP_LOOP,
     OP_CALL,
+    // OP_CALL followed by OP_RETURN. a call to a closure reuses the frame of
+    // the caller instead
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
     OP_CLOSURE,
+    // OP_CLOSURE of a local function whose variables are caller locals. the
+    // upvalue operands are skipped
+    OP_LOCAL_FUNCTION,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
+    OP_BUILD_LIST,  // the operand is the number of items
+    OP_BUILD_MAP,   // the operand is the number of key and value pairs
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    // pushes the state of a for-in loop over the value on top of the stack
+    OP_ITER_INIT,
+    // pushes the next value of a for-in loop and jumps by the second operand,
+    // or jumps by the first when there are no more. falls through to the
+    // iterate() calls for instances
+    OP_ITER_NEXT,
+    // followed by another instruction whose first operand, and for
+    // OP_CLOSURE and OP_LOCAL_FUNCTION its upvalue indices, are 2 bytes
+    // instead of 1
+    OP_WIDE,
+    // register instructions, emitted instead of stack instruction sequences
+    // when REGISTER_VM is defined. R operands are frame slots and K operands
+    // are constant indices. the order within each group matters to the
+    // compiler
+    OP_MOVE,   // R[a] = R[b]
+    OP_LOADK,  // R[a] = K[b]
+    OP_ADD_RR,  // push(R[a] op R[b])
+    OP_SUBTRACT_RR,
+    OP_MULTIPLY_RR,
+    OP_DIVIDE_RR,
+    OP_LESS_RR,
+    OP_GREATER_RR,
+    OP_ADD_RK,  // push(R[a] op K[b])
+    OP_SUBTRACT_RK,
+    OP_MULTIPLY_RK,
+    OP_DIVIDE_RK,
+    OP_LESS_RK,
+    OP_GREATER_RK,
+    OP_ADD_RRR,  // R[a] = R[b] op R[c]
+    OP_SUBTRACT_RRR,
+    OP_MULTIPLY_RRR,
+    OP_DIVIDE_RRR,
+    OP_ADD_RRK,  // R[a] = R[b] op K[c]
+    OP_SUBTRACT_RRK,
+    OP_MULTIPLY_RRK,
+    OP_DIVIDE_RRK,
+    // quickened instructions. the vm rewrites arithmetic instructions to
+    // these once they have only seen number operands, they are never emitted
+    // by the compiler
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    // OP_CALL once it has only called closures with the right number of
+    // arguments, or only natives
+    OP_CALL_CLOSURE,
+    OP_CALL_NATIVE,
 } OpCode;
 
+// bits of a type feedback slot, one per ValueType
+#define FEEDBACK_TYPE(type) (1 << (type))
+// bits of the feedback slot of an OP_CALL, one per kind of callee
+#define FEEDBACK_CLOSURE (1 << 0)
+#define FEEDBACK_NATIVE (1 << 1)
+#define FEEDBACK_OTHER_CALLEE (1 << 2)
+
+// the instructions from offset up to the offset of the next run were all
+// compiled from line
+typedef struct LineRun {
+    int offset;
+    int line;
+} LineRun;
+
+// the class an OP_INVOKE last looked its method up in, and the method's slot
+// in the class's vtable. klass is NULL until the first lookup
+typedef struct InvokeCache {
+    struct ObjClass* klass;
+    int slot;
+} InvokeCache;
+
 typedef struct Chunk {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    // sorted by offset, a run starts wherever the line changes
+    LineRun* lines;
+    int line_count;
+    int line_capacity;
     ValueArray constants;
+    // operand types seen by each arithmetic instruction, indexed by the
+    // instruction's offset. allocated when the first type is recorded
+    uint8_t* feedback;
+    // indexed by the operand of each OP_INVOKE, allocated when the first one
+    // runs
+    InvokeCache* invoke_caches;
+    int invoke_cache_count;
 } Chunk;
 
 void chunk_init(Chunk* chunk);
-void chunk_free(Chunk* chunk);
-void chunk_write(Chunk* chunk, uint8_t byte, int line);
-int chunk_add_constant(Chunk* chunk, Value constant);
+void chunk_free(VM* vm, Chunk* chunk);
+void chunk_write(VM* vm, Chunk* chunk, uint8_t byte, int line);
+// drops the code from count on
+void chunk_truncate(Chunk* chunk, int count);
+// the line the byte at offset was compiled from
+int chunk_line(Chunk* chunk, int offset);
+int chunk_add_constant(VM* vm, Chunk* chunk, Value constant);
+// size in bytes of the instruction at offset, including its operands
+int chunk_instruction_length(Chunk* chunk, int offset);
+// the most values the chunk's code has on the stack at once, given the
+// `start` values below it when it begins
+int chunk_max_stack(VM* vm, Chunk* chunk, int start);
+// the feedback slot of the instruction at offset, only valid once the chunk
+// has been fully written
+uint8_t* chunk_feedback(VM* vm, Chunk* chunk, int offset);
+InvokeCache* chunk_invoke_cache(VM* vm, Chunk* chunk, int index);
+// the generic instruction a quickened instruction was rewritten from, or op
+// itself if it isn't quickened
+OpCode unquickened_op(OpCode op);
 
 #endif
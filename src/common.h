@@ -5,7 +5,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "clox.h"
+
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 #define UNUSED(x) (void)(x)
 
+// every thread gets its own copy of the variable, for the compiler's state
+#if defined(_MSC_VER) && !defined(__clang__)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #endif
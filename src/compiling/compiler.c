@@ -8,12 +8,15 @@
 #include "memory.h"
 #include "object.h"
 #include "scanner.h"
+#include "vm.h"
 
 #ifdef DEBUG_TRACE_CODE
 #include "debug.h"
 #endif
 
 typedef struct Parser {
+    // owns the objects the compiler allocates
+    VM* vm;
     Token prev_token;
     Token curr_token;
     bool had_error;
@@ -46,11 +49,23 @@ typedef struct Local {
     Token name;
     // the scope depth of the local, -1 means the variable has not defined yet
     int depth;
-    bool is_captured;
+    // how many functions declared in this one capture the local
+    int capture_count;
+    // the offset of the closure instruction of a function declared in a
+    // block, -1 for other locals
+    int closure_offset;
+    // whether the local function is used for anything but calling it
+    bool escapes;
 } Local;
 
+// an OP_TAIL_CALL of a local function
+typedef struct LocalTailCall {
+    int local;
+    int offset;
+} LocalTailCall;
+
 typedef struct {
-    uint8_t index;
+    uint16_t index;
     bool is_local;
 } Upvalue;
 
@@ -61,15 +76,48 @@ typedef enum FunctionType {
     TYPE_SCRIPT,
 } FunctionType;
 
+#define RECENT_OPS_COUNT 4
+// an initializer assigning more fields than this counts the first ones only
+#define INIT_FIELDS_MAX 64
+
 typedef struct Compiler {
     struct Compiler* enclosing;
     ObjFunction* function;
     FunctionType type;
 
-    Local locals[UINT8_COUNT];
+    // both grow up to UINT16_COUNT entries
+    Local* locals;
     int local_count;
-    Upvalue upvalues[UINT8_COUNT];
+    int local_capacity;
+    Upvalue* upvalues;
+    int upvalue_capacity;
     int scope_depth;
+
+    // open addressed hash set of the chunk's constants, so each value is
+    // added once. a slot holds a constant index + 1, or 0 when it's empty
+    int* constant_slots;
+    int constant_capacity;
+
+    // start offsets of the most recently emitted instructions, most recent
+    // first, -1 if there is none. used to rewrite instruction sequences
+    int recent_ops[RECENT_OPS_COUNT];
+    // offset of the most recent jump target, instructions before it must not
+    // be merged with instructions after it
+    int last_label;
+
+    // name constants of the fields an initializer assigns to this, there are
+    // function->field_count of them
+    int init_fields[INIT_FIELDS_MAX];
+
+    // the local function about to be called, and the one the latest OP_CALL
+    // calls, -1 if the callee is something else
+    int calling_local;
+    int called_local;
+    // a local function reading its caller's frame needs the frame it was
+    // called from, so these go back to OP_CALL if it ends up doing that
+    LocalTailCall* tail_calls;
+    int tail_call_count;
+    int tail_call_capacity;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -77,6 +125,7 @@ typedef struct ClassCompiler {
     bool has_superclass;
 } ClassCompiler;
 
+static void add_local(Token name);
 static void declaration(void);
 static void class_declaration(void);
 static void method(void);
@@ -96,11 +145,14 @@ static void parse_precedence(Precedence precedence);
 static void expression(void);
 static void call(bool can_assign);
 static void dot(bool can_assign);
+static void subscript(bool can_assign);
 static void binary(bool can_assign);
 static void and_(bool can_assign);
 static void or_(bool can_assign);
 static void unary(bool can_assign);
 static void grouping(bool can_assign);
+static void list(bool can_assign);
+static void map(bool can_assign);
 static void variable(bool can_assign);
 static void this_(bool can_assign);
 static void super_(bool can_assign);
@@ -111,8 +163,11 @@ static void string(bool can_assign);
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {map, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET] = {list, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, dot, PREC_CALL},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
@@ -138,6 +193,7 @@ ParseRule rules[] = {
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
     [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
     [TOKEN_IF] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IN] = {NULL, NULL, PREC_NONE},
     [TOKEN_NIL] = {literal, NULL, PREC_NONE},
     [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
@@ -151,36 +207,62 @@ ParseRule rules[] = {
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
 
-Parser parser = {0};
-Compiler* current = NULL;
-ClassCompiler* current_class = NULL;
+// per thread, so threads running their own VMs can compile at the same time
+THREAD_LOCAL Parser parser = {0};
+THREAD_LOCAL Compiler* current = NULL;
+THREAD_LOCAL ClassCompiler* current_class = NULL;
 
 static void compiler_init(Compiler* compiler, FunctionType type) {
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->local_count = 0;
+    compiler->local_capacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalue_capacity = 0;
     compiler->scope_depth = 0;
-    compiler->function = function_new();
+    compiler->constant_slots = NULL;
+    compiler->constant_capacity = 0;
+    for (int i = 0; i < RECENT_OPS_COUNT; i++) {
+        compiler->recent_ops[i] = -1;
+    }
+    compiler->last_label = 0;
+    compiler->calling_local = -1;
+    compiler->called_local = -1;
+    compiler->tail_calls = NULL;
+    compiler->tail_call_count = 0;
+    compiler->tail_call_capacity = 0;
+    compiler->function = function_new(parser.vm);
     current = compiler;
     if (type != TYPE_SCRIPT) {
         // we call init compiler right parsing the function name, so we can grab
         // the name from the previous token
         current->function->name =
-            copy_string(parser.prev_token.start, parser.prev_token.length);
+            copy_string(parser.vm, parser.prev_token.start,
+                        parser.prev_token.length);
     }
 
-    Local* local = &compiler->locals[compiler->local_count++];
-    local->depth = 0;
-    local->is_captured = false;
-
+    Token name;
     if (type != TYPE_FUNCTION) {
-        local->name.start = "this";
-        local->name.length = 4;
+        name.start = "this";
+        name.length = 4;
     } else {
-        local->name.start = "";
-        local->name.length = 0;
+        name.start = "";
+        name.length = 0;
     }
+    add_local(name);
+    compiler->locals[0].depth = 0;
+}
+
+static void compiler_free(Compiler* compiler) {
+    FREE_ARRAY(parser.vm, Local, compiler->locals, compiler->local_capacity);
+    FREE_ARRAY(parser.vm, Upvalue, compiler->upvalues,
+               compiler->upvalue_capacity);
+    FREE_ARRAY(parser.vm, int, compiler->constant_slots,
+               compiler->constant_capacity);
+    FREE_ARRAY(parser.vm, LocalTailCall, compiler->tail_calls,
+               compiler->tail_call_capacity);
 }
 
 static Chunk* curr_chunk(void) {
@@ -214,24 +296,274 @@ static void error(const char* msg) {
 
 #pragma region compiling
 static void emit_byte(uint8_t byte) {
-    chunk_write(curr_chunk(), byte, parser.prev_token.line);
+    chunk_write(parser.vm, curr_chunk(), byte, parser.prev_token.line);
 }
 
-static void emit_byte2(uint8_t byte1, uint8_t byte2) {
-    emit_byte(byte1);
-    emit_byte(byte2);
+static void push_recent_op(int start) {
+    for (int i = RECENT_OPS_COUNT - 1; i > 0; i--) {
+        current->recent_ops[i] = current->recent_ops[i - 1];
+    }
+    current->recent_ops[0] = start;
+}
+
+static int mark_label(void) {
+    current->last_label = curr_chunk()->count;
+    return current->last_label;
 }
 
-static uint8_t make_constant(Value value) {
-    int constant = chunk_add_constant(curr_chunk(), value);
-    if (constant > UINT8_MAX) {
+// the opcode of the nth most recent instruction, or -1 if there is no such
+// instruction or a jump target lies between it and the end of the chunk
+static int recent_op(int n) {
+    int start = current->recent_ops[n];
+    if (start < 0 || start < current->last_label) {
+        return -1;
+    }
+
+    return curr_chunk()->code[start];
+}
+
+// the nth operand byte of the nth most recent instruction
+static uint8_t recent_operand(int n, int operand) {
+    return curr_chunk()->code[current->recent_ops[n] + 1 + operand];
+}
+
+// remove the n most recent instructions from the chunk
+static void drop_recent_ops(int n) {
+    chunk_truncate(curr_chunk(), current->recent_ops[n - 1]);
+    for (int i = 0; i < RECENT_OPS_COUNT; i++) {
+        current->recent_ops[i] =
+            i + n < RECENT_OPS_COUNT ? current->recent_ops[i + n] : -1;
+    }
+}
+
+#ifdef REGISTER_VM
+
+// maps a stack arithmetic or comparison instruction to its position in the
+// register instruction groups, -1 if it has no register form
+static int register_op_index(int op) {
+    switch (op) {
+        case OP_ADD:
+            return 0;
+        case OP_SUBTRACT:
+            return 1;
+        case OP_MULTIPLY:
+            return 2;
+        case OP_DIVIDE:
+            return 3;
+        case OP_LESS:
+            return 4;
+        case OP_GREATER:
+            return 5;
+        default:
+            return -1;
+    }
+}
+
+static void emit_register_op(uint8_t op, uint8_t a, uint8_t b, uint8_t c) {
+    push_recent_op(curr_chunk()->count);
+    emit_byte(op);
+    emit_byte(a);
+    emit_byte(b);
+    if (op >= OP_ADD_RRR && op <= OP_DIVIDE_RRK) {
+        emit_byte(c);
+    }
+}
+
+// rewrites the stack instructions that precede `op` into a register
+// instruction that works on frame slots directly, returns true if `op` was
+// absorbed into the rewritten instruction
+static bool fuse_register_op(uint8_t op) {
+    int index = register_op_index(op);
+    if (index != -1 && recent_op(1) == OP_GET_LOCAL) {
+        uint8_t a = recent_operand(1, 0);
+        uint8_t b = recent_operand(0, 0);
+        if (recent_op(0) == OP_GET_LOCAL) {
+            drop_recent_ops(2);
+            emit_register_op(OP_ADD_RR + index, a, b, 0);
+            return true;
+        } else if (recent_op(0) == OP_CONSTANT) {
+            drop_recent_ops(2);
+            emit_register_op(OP_ADD_RK + index, a, b, 0);
+            return true;
+        }
+    }
+
+    if (op != OP_POP || recent_op(0) != OP_SET_LOCAL) {
+        return false;
+    }
+
+    // `dst = <value>;` where the value is computed by a single instruction
+    uint8_t dst = recent_operand(0, 0);
+    int value_op = recent_op(1);
+    if (value_op == OP_GET_LOCAL || value_op == OP_CONSTANT) {
+        uint8_t src = recent_operand(1, 0);
+        drop_recent_ops(2);
+        emit_register_op(value_op == OP_GET_LOCAL ? OP_MOVE : OP_LOADK, dst,
+                         src, 0);
+        return true;
+    }
+
+    bool is_rr = value_op >= OP_ADD_RR && value_op <= OP_DIVIDE_RR;
+    bool is_rk = value_op >= OP_ADD_RK && value_op <= OP_DIVIDE_RK;
+    if (is_rr || is_rk) {
+        uint8_t a = recent_operand(1, 0);
+        uint8_t b = recent_operand(1, 1);
+        uint8_t fused = is_rr ? OP_ADD_RRR + (value_op - OP_ADD_RR)
+                              : OP_ADD_RRK + (value_op - OP_ADD_RK);
+        drop_recent_ops(2);
+        emit_register_op(fused, dst, a, b);
+        return true;
+    }
+
+    return false;
+}
+#endif
+
+static void emit_op(uint8_t op) {
+#ifdef REGISTER_VM
+    if (fuse_register_op(op)) {
+        return;
+    }
+#endif
+
+    push_recent_op(curr_chunk()->count);
+    emit_byte(op);
+}
+
+static void emit_short(int operand) {
+    emit_byte((operand >> 8) & 0xFF);
+    emit_byte(operand & 0xFF);
+}
+
+// emits an instruction with a single operand, behind OP_WIDE when the operand
+// doesn't fit in a byte. the instruction's other operands follow
+static void emit_byte2(uint8_t op, int operand) {
+    if (operand > UINT8_MAX) {
+        emit_op(OP_WIDE);
+        emit_byte(op);
+        emit_short(operand);
+        return;
+    }
+
+    emit_op(op);
+    emit_byte((uint8_t)operand);
+}
+
+// each OP_INVOKE gets its own invoke cache, numbered in the order they're
+// emitted
+static void emit_invoke(int name_constant, uint8_t arg_count) {
+    Chunk* chunk = curr_chunk();
+    if (chunk->invoke_cache_count == UINT16_COUNT) {
+        error("too many method calls in one function");
+    } else {
+        chunk->invoke_cache_count++;
+    }
+
+    emit_byte2(OP_INVOKE, name_constant);
+    emit_byte(arg_count);
+    emit_short(chunk->invoke_cache_count - 1);
+}
+
+// numbers are the same constant when their bits are, so 0 and -0 stay apart
+static uint32_t constant_hash(Value value) {
+    uint64_t bits = 0;
+    switch (value.type) {
+        case VAL_NIL:
+            break;
+        case VAL_BOOL:
+            bits = AS_BOOL(value);
+            break;
+        case VAL_NUMBER: {
+            double number = AS_NUMBER(value);
+            memcpy(&bits, &number, sizeof(bits));
+            break;
+        }
+        case VAL_OBJ:
+            if (IS_STRING(value)) {
+                return AS_STRING(value)->hash;
+            }
+            bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+            break;
+    }
+    bits ^= bits >> 32;
+    return (uint32_t)bits * 2654435761u;
+}
+
+static bool same_constant(Value a, Value b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    switch (a.type) {
+        case VAL_NIL:
+            return true;
+        case VAL_BOOL:
+            return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NUMBER: {
+            double x = AS_NUMBER(a);
+            double y = AS_NUMBER(b);
+            return memcmp(&x, &y, sizeof(x)) == 0;
+        }
+        case VAL_OBJ:
+            // strings are interned
+            return AS_OBJ(a) == AS_OBJ(b);
+    }
+
+    UNREACHABLE("encountered an unknown value type");
+}
+
+// the slot that holds value, or the empty one it would go in
+static int* find_constant_slot(Value value) {
+    ValueArray* constants = &curr_chunk()->constants;
+    uint32_t mask = (uint32_t)current->constant_capacity - 1;
+    uint32_t index = constant_hash(value) & mask;
+    for (;;) {
+        int* slot = &current->constant_slots[index];
+        if (*slot == 0 ||
+            same_constant(constants->values[*slot - 1], value)) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void grow_constant_slots(void) {
+    int old_capacity = current->constant_capacity;
+    int capacity = old_capacity < 16 ? 16 : old_capacity * 2;
+    FREE_ARRAY(parser.vm, int, current->constant_slots, old_capacity);
+    current->constant_slots = ALLOCATE(parser.vm, int, capacity);
+    current->constant_capacity = capacity;
+    memset(current->constant_slots, 0, sizeof(int) * capacity);
+
+    ValueArray* constants = &curr_chunk()->constants;
+    for (int i = 0; i < constants->count; i++) {
+        *find_constant_slot(constants->values[i]) = i + 1;
+    }
+}
+
+static int make_constant(Value value) {
+    // keeps the table at most half full. growing it can collect garbage, and
+    // a new string is only reachable from here
+    if (2 * (curr_chunk()->constants.count + 1) >
+        current->constant_capacity) {
+        push(parser.vm, value);
+        grow_constant_slots();
+        pop(parser.vm);
+    }
+    int* slot = find_constant_slot(value);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    int constant = chunk_add_constant(parser.vm, curr_chunk(), value);
+    if (constant > UINT16_MAX) {
         error(
             "too many constants in one chunk, can only have a maximum of "
-            "255 constants in one chunk");
+            "65536 constants in one chunk");
         return 0;
     }
 
-    return (uint8_t)constant;
+    *slot = constant + 1;
+    return constant;
 }
 
 static void emit_constant(Value value) {
@@ -242,15 +574,156 @@ static void emit_return(void) {
     if (current->type == TYPE_INITIALIZER) {
         emit_byte2(OP_GET_LOCAL, 0);  // get instance
     } else {
-        emit_byte(OP_NIL);
+        emit_op(OP_NIL);
+    }
+
+    emit_op(OP_RETURN);
+}
+
+static void add_local_tail_call(int local, int offset) {
+    if (current->tail_call_capacity < current->tail_call_count + 1) {
+        int old_capacity = current->tail_call_capacity;
+        current->tail_call_capacity = GROW_CAPACITY(old_capacity);
+        current->tail_calls =
+            GROW_ARRAY(parser.vm, LocalTailCall, current->tail_calls,
+                       old_capacity, current->tail_call_capacity);
+    }
+
+    LocalTailCall* call = &current->tail_calls[current->tail_call_count++];
+    call->local = local;
+    call->offset = offset;
+}
+
+// the function of the [OP_WIDE] OP_CLOSURE at offset
+static ObjFunction* closure_function(Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+    int constant = code[0] == OP_WIDE ? (code[2] << 8) | code[3] : code[1];
+    return AS_FUNCTION(chunk->constants.values[constant]);
+}
+
+// the slot of the local the nth upvalue of the closure at offset captures, or
+// -1 if it captures an upvalue of the enclosing function
+static int closure_upvalue_slot(Chunk* chunk, int offset, int n) {
+    bool wide = chunk->code[offset] == OP_WIDE;
+    uint8_t* upvalue =
+        &chunk->code[offset + (wide ? 4 + n * 3 : 2 + n * 2)];
+    if (!upvalue[0]) {
+        return -1;
+    }
+    return wide ? (upvalue[1] << 8) | upvalue[2] : upvalue[1];
+}
+
+// whether every upvalue of the closure at offset captures a local of the
+// function declaring it, and no closure inside it captures its upvalues, so
+// they can all be read from the frame calling it
+static bool reads_caller_locals(Chunk* chunk, int offset) {
+    ObjFunction* function = closure_function(chunk, offset);
+    for (int i = 0; i < function->upvalue_count; i++) {
+        if (closure_upvalue_slot(chunk, offset, i) == -1) {
+            return false;
+        }
     }
 
-    emit_byte(OP_RETURN);
+    Chunk* body = &function->chunk;
+    for (int i = 0; i < body->count; i += chunk_instruction_length(body, i)) {
+        bool wide = body->code[i] == OP_WIDE;
+        uint8_t* code = &body->code[i + wide];
+        if (*code == OP_CLOSURE) {
+            ObjFunction* inner = closure_function(body, i);
+            for (int j = 0; j < inner->upvalue_count; j++) {
+                if (closure_upvalue_slot(body, i, j) == -1) {
+                    return false;
+                }
+            }
+        } else if (!wide &&
+                   (*code == OP_GET_UPVALUE || *code == OP_SET_UPVALUE) &&
+                   closure_upvalue_slot(chunk, offset, code[1]) > UINT8_MAX) {
+            // the slot doesn't fit the operand
+            return false;
+        }
+    }
+    return true;
+}
+
+// turns the upvalue instructions of the function declared by the closure at
+// offset into ones reading the caller's frame, and the closure into an
+// OP_LOCAL_FUNCTION that captures nothing
+static void read_caller_locals(Chunk* chunk, int offset) {
+    ObjFunction* function = closure_function(chunk, offset);
+    Chunk* body = &function->chunk;
+    for (int i = 0; i < body->count; i += chunk_instruction_length(body, i)) {
+        bool wide = body->code[i] == OP_WIDE;
+        uint8_t* code = &body->code[i + wide];
+        if (*code != OP_GET_UPVALUE && *code != OP_SET_UPVALUE) {
+            continue;
+        }
+
+        int upvalue = wide ? (code[1] << 8) | code[2] : code[1];
+        int slot = closure_upvalue_slot(chunk, offset, upvalue);
+        code[0] = code[0] == OP_GET_UPVALUE ? OP_GET_CALLER_LOCAL
+                                            : OP_SET_CALLER_LOCAL;
+        if (wide) {
+            code[1] = (slot >> 8) & 0xFF;
+            code[2] = slot & 0xFF;
+        } else {
+            code[1] = (uint8_t)slot;
+        }
+    }
+
+    for (int i = 0; i < function->upvalue_count; i++) {
+        current->locals[closure_upvalue_slot(chunk, offset, i)]
+            .capture_count--;
+    }
+    chunk->code[offset + (chunk->code[offset] == OP_WIDE)] = OP_LOCAL_FUNCTION;
+}
+
+// called when a local goes out of scope. a function declared in a block and
+// only ever called by the function declaring it is always called from that
+// function's frame, so it doesn't need upvalues for its variables there
+static void resolve_local_function(int index) {
+    Local* local = &current->locals[index];
+    if (local->closure_offset == -1) {
+        return;
+    }
+
+    Chunk* chunk = curr_chunk();
+    int offset = local->closure_offset;
+    bool reads_caller = !parser.had_error && !local->escapes &&
+                        reads_caller_locals(chunk, offset);
+    // a function with upvalues can't replace its caller's frame
+    bool keeps_caller =
+        reads_caller && closure_function(chunk, offset)->upvalue_count > 0;
+    for (int i = current->tail_call_count - 1; i >= 0; i--) {
+        LocalTailCall* call = &current->tail_calls[i];
+        if (call->local != index) {
+            continue;
+        }
+        if (keeps_caller) {
+            chunk->code[call->offset] = OP_CALL;
+        }
+        *call = current->tail_calls[--current->tail_call_count];
+    }
+
+    if (reads_caller) {
+        read_caller_locals(chunk, offset);
+    }
 }
 
 static ObjFunction* end_compiler(void) {
     emit_return();
+    for (int i = current->local_count - 1; i >= 0; i--) {
+        resolve_local_function(i);
+    }
     ObjFunction* function = current->function;
+    // the jumps of code with errors may not have been patched
+    if (!parser.had_error) {
+        // the callee and the arguments are on the stack when the code starts
+        int max_stack =
+            chunk_max_stack(parser.vm, curr_chunk(), function->arity + 1);
+        if (max_stack > function->max_slots) {
+            function->max_slots = max_stack;
+        }
+    }
 
 #ifdef DEBUG_TRACE_CODE
     if (!parser.had_error) {
@@ -274,10 +747,11 @@ static void end_scope(void) {
     while (current->local_count > 0 &&
            current->locals[current->local_count - 1].depth >
                current->scope_depth) {
-        if (current->locals[current->local_count - 1].is_captured) {
-            emit_byte(OP_CLOSE_UPVALUE);
+        resolve_local_function(current->local_count - 1);
+        if (current->locals[current->local_count - 1].capture_count > 0) {
+            emit_op(OP_CLOSE_UPVALUE);
         } else {
-            emit_byte(OP_POP);
+            emit_op(OP_POP);
         }
         current->local_count--;
     }
@@ -346,20 +820,33 @@ static void consume(TokenType type, const char* msg) {
     }
 }
 
-static uint8_t identifier_constant(Token* token) {
-    return make_constant(OBJ_VAL(copy_string(token->start, token->length)));
+static int identifier_constant(Token* token) {
+    return make_constant(
+        OBJ_VAL(copy_string(parser.vm, token->start, token->length)));
 }
 
 static void add_local(Token name) {
-    if (current->local_count == UINT8_COUNT) {
+    if (current->local_count == UINT16_COUNT) {
         error("too many local variables in function");
         return;
     }
 
+    if (current->local_capacity < current->local_count + 1) {
+        int old_capacity = current->local_capacity;
+        current->local_capacity = GROW_CAPACITY(old_capacity);
+        current->locals = GROW_ARRAY(parser.vm, Local, current->locals,
+                                     old_capacity, current->local_capacity);
+    }
+
     Local* local = &current->locals[current->local_count++];
+    if (current->local_count > current->function->max_slots) {
+        current->function->max_slots = current->local_count;
+    }
     local->name = name;
     local->depth = -1;
-    local->is_captured = false;
+    local->capture_count = 0;
+    local->closure_offset = -1;
+    local->escapes = false;
 }
 
 static bool identifiers_equal(Token* a, Token* b) {
@@ -392,7 +879,7 @@ static void declare_variable(void) {
     add_local(*name);
 }
 
-static uint8_t parse_variable(const char* err_msg) {
+static int parse_variable(const char* err_msg) {
     consume(TOKEN_IDENTIFIER, err_msg);
 
     declare_variable();
@@ -410,7 +897,7 @@ static void mark_initialized(void) {
     current->locals[current->local_count - 1].depth = current->scope_depth;
 }
 
-static void define_variable(uint8_t global) {
+static void define_variable(int global) {
     if (current->scope_depth > 0) {
         mark_initialized();
         // no need to do anything else because the initializer expression
@@ -436,7 +923,7 @@ static int resolve_local(Compiler* compiler, Token* name) {
     return -1;
 }
 
-static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local) {
+static int add_upvalue(Compiler* compiler, uint16_t index, bool is_local) {
     int upvalue_index = compiler->function->upvalue_count;
 
     for (int i = 0; i < upvalue_index; i++) {
@@ -446,11 +933,19 @@ static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local) {
         }
     }
 
-    if (compiler->function->upvalue_count == UINT8_COUNT) {
+    if (compiler->function->upvalue_count == UINT16_COUNT) {
         error("too many closure variables in function");
         return 0;
     }
 
+    if (compiler->upvalue_capacity < upvalue_index + 1) {
+        int old_capacity = compiler->upvalue_capacity;
+        compiler->upvalue_capacity = GROW_CAPACITY(old_capacity);
+        compiler->upvalues =
+            GROW_ARRAY(parser.vm, Upvalue, compiler->upvalues, old_capacity,
+                       compiler->upvalue_capacity);
+    }
+
     compiler->upvalues[upvalue_index].is_local = is_local;
     compiler->upvalues[upvalue_index].index = index;
     compiler->function->upvalue_count++;
@@ -465,13 +960,19 @@ static int resolve_upvalue(Compiler* compiler, Token* name) {
 
     int local = resolve_local(compiler->enclosing, name);
     if (local != -1) {
-        compiler->enclosing->locals[local].is_captured = true;
-        return add_upvalue(compiler, (uint8_t)local, true);
+        Local* captured = &compiler->enclosing->locals[local];
+        captured->escapes = true;
+        int count = compiler->function->upvalue_count;
+        int upvalue = add_upvalue(compiler, (uint16_t)local, true);
+        if (compiler->function->upvalue_count > count) {
+            captured->capture_count++;
+        }
+        return upvalue;
     }
 
     int upvalue = resolve_upvalue(compiler->enclosing, name);
     if (upvalue != -1) {
-        return add_upvalue(compiler, (uint8_t)upvalue, false);
+        return add_upvalue(compiler, (uint16_t)upvalue, false);
     }
 
     return -1;
@@ -484,6 +985,13 @@ static void named_variable(Token name, bool can_assign) {
     if (arg != -1) {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
+        if (current->locals[arg].closure_offset != -1) {
+            if (check(TOKEN_LEFT_PAREN)) {
+                current->calling_local = arg;
+            } else {
+                current->locals[arg].escapes = true;
+            }
+        }
     } else if ((arg = resolve_upvalue(current, &name)) != -1) {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
@@ -495,9 +1003,9 @@ static void named_variable(Token name, bool can_assign) {
 
     if (can_assign && match(TOKEN_EQUAL)) {
         expression();
-        emit_byte2(set_op, (uint8_t)arg);
+        emit_byte2(set_op, arg);
     } else {
-        emit_byte2(get_op, (uint8_t)arg);
+        emit_byte2(get_op, arg);
     }
 }
 
@@ -531,7 +1039,7 @@ static void function(FunctionType type) {
                     "can't have more than 255 parameters in a function");
             }
 
-            uint8_t constant = parse_variable("expected parameter name");
+            int constant = parse_variable("expected parameter name");
             define_variable(constant);
         } while (match(TOKEN_COMMA));
     }
@@ -541,13 +1049,30 @@ static void function(FunctionType type) {
 
     ObjFunction* function = end_compiler();
 
-    emit_byte2(OP_CLOSURE, make_constant(OBJ_VAL(function)));
+    // a wide closure has wide upvalue indices too
+    int constant = make_constant(OBJ_VAL(function));
+    bool wide = constant > UINT8_MAX;
+    for (int i = 0; i < function->upvalue_count; i++) {
+        wide = wide || compiler.upvalues[i].index > UINT8_MAX;
+    }
 
-    for (int i = 0; i < compiler.function->upvalue_count; i++) {
+    if (wide) {
+        emit_op(OP_WIDE);
+        emit_byte(OP_CLOSURE);
+        emit_short(constant);
+    } else {
+        emit_byte2(OP_CLOSURE, constant);
+    }
+    for (int i = 0; i < function->upvalue_count; i++) {
         Upvalue* upvalue = &compiler.upvalues[i];
         emit_byte(upvalue->is_local ? 1 : 0);
-        emit_byte(upvalue->index);
+        if (wide) {
+            emit_short(upvalue->index);
+        } else {
+            emit_byte((uint8_t)upvalue->index);
+        }
     }
+    compiler_free(&compiler);
 }
 
 static Token synthetic_token(const char* text) {
@@ -560,7 +1085,7 @@ static Token synthetic_token(const char* text) {
 static void class_declaration(void) {
     consume(TOKEN_IDENTIFIER, "expected class name");
     Token class_name = parser.prev_token;
-    uint8_t name_constant = identifier_constant(&parser.prev_token);
+    int name_constant = identifier_constant(&parser.prev_token);
 
     declare_variable();
     emit_byte2(OP_CLASS, name_constant);
@@ -585,7 +1110,7 @@ static void class_declaration(void) {
         define_variable(0);
 
         named_variable(class_name, false);
-        emit_byte(OP_INHERIT);
+        emit_op(OP_INHERIT);
         class_compiler.has_superclass = true;
     }
 
@@ -595,7 +1120,7 @@ static void class_declaration(void) {
         method();
     }
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
 
     if (class_compiler.has_superclass) {
         end_scope();
@@ -605,7 +1130,7 @@ static void class_declaration(void) {
 
 static void method(void) {
     consume(TOKEN_IDENTIFIER, "expected method name");
-    uint8_t name = identifier_constant(&parser.prev_token);
+    int name = identifier_constant(&parser.prev_token);
 
     FunctionType type = TYPE_METHOD;
     if (parser.prev_token.length == 4 &&
@@ -617,19 +1142,23 @@ static void method(void) {
 }
 
 static void fun_declaration(void) {
-    uint8_t global = parse_variable("expected function name");
+    int global = parse_variable("expected function name");
     mark_initialized();
+    if (current->scope_depth > 0) {
+        current->locals[current->local_count - 1].closure_offset =
+            curr_chunk()->count;
+    }
     function(TYPE_FUNCTION);
     define_variable(global);
 }
 
 static void var_declaration(void) {
-    uint8_t global = parse_variable("expected variable name");
+    int global = parse_variable("expected variable name");
 
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
-        emit_byte(OP_NIL);
+        emit_op(OP_NIL);
     }
 
     consume(TOKEN_SEMICOLON, "expected ';' at end of variable declaration");
@@ -660,7 +1189,7 @@ static void statement(void) {
 static void print_statement(void) {
     expression();
     consume(TOKEN_SEMICOLON, "expected ';' after value");
-    emit_byte(OP_PRINT);
+    emit_op(OP_PRINT);
 }
 
 static void block(void) {
@@ -674,19 +1203,20 @@ static void block(void) {
 static void expression_statement(void) {
     expression();
     consume(TOKEN_SEMICOLON, "expected ';' after expression");
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
 }
 
 static int emit_jump(uint8_t jump_op) {
-    emit_byte(jump_op);
+    emit_op(jump_op);
     emit_byte(0xFF);
     emit_byte(0xFF);
     return curr_chunk()->count - 2;
 }
 
-static void patch_jump(int offset) {
-    // -2 to adjust for the bytecode for the jump offset itself
-    int jump = curr_chunk()->count - offset - 2;
+// points the jump operand at offset to the end of the chunk, relative to
+// base
+static void patch_jump_from(int offset, int base) {
+    int jump = curr_chunk()->count - base;
 
     if (jump > UINT16_MAX) {
         error("too much code to jump over");
@@ -696,6 +1226,12 @@ static void patch_jump(int offset) {
     uint8_t lower_byte = jump & 0xFF;
     curr_chunk()->code[offset] = upper_byte;
     curr_chunk()->code[offset + 1] = lower_byte;
+    mark_label();
+}
+
+static void patch_jump(int offset) {
+    // +2 to adjust for the bytecode for the jump offset itself
+    patch_jump_from(offset, offset + 2);
 }
 
 static void if_statement(void) {
@@ -706,7 +1242,7 @@ static void if_statement(void) {
     int then_jump = emit_jump(OP_JUMP_IF_FALSE);  //> expr jumpf off1 off2
 
     // pop the value of the condition expression if the then branch executes
-    emit_byte(OP_POP);  //> expr jumpf off1 off2 pop
+    emit_op(OP_POP);  //> expr jumpf off1 off2 pop
     //> expr jumpf off1 off2 pop stmt
     statement();
 
@@ -720,7 +1256,7 @@ static void if_statement(void) {
     // this is not included with the rest of the else branch because it needs to
     // execute even if there is no explicit else
     //> expr jumpf 00 05 pop then_stmt jump off1 off2 pop
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
     if (match(TOKEN_ELSE)) {
         //> expr jumpf 00 05 pop then_stmt jump off1 off2 pop else_statement
         statement();
@@ -746,11 +1282,21 @@ static void return_statement(void) {
 
     expression();
     consume(TOKEN_SEMICOLON, "expected ';' after expression");
-    emit_byte(OP_RETURN);
+    // the call's frame can replace this one. the return stays for callees
+    // that can't, like natives. `return this.m()` compiles to OP_INVOKE and
+    // is deliberately left alone, a tail form of it would have to repeat
+    // its cached method dispatch
+    if (recent_op(0) == OP_CALL) {
+        if (current->called_local != -1) {
+            add_local_tail_call(current->called_local, current->recent_ops[0]);
+        }
+        curr_chunk()->code[current->recent_ops[0]] = OP_TAIL_CALL;
+    }
+    emit_op(OP_RETURN);
 }
 
 static void emit_loop(int loop_start) {
-    emit_byte(OP_LOOP);
+    emit_op(OP_LOOP);
 
     // +2 because we need to jump after the offset bytes
     int offset = curr_chunk()->count + 2 - loop_start;
@@ -763,7 +1309,7 @@ static void emit_loop(int loop_start) {
 }
 
 static void while_statement(void) {
-    int loop_start = curr_chunk()->count;
+    int loop_start = mark_label();
 
     consume(TOKEN_LEFT_PAREN, "expected '(' after 'while'");
     expression();
@@ -772,12 +1318,69 @@ static void while_statement(void) {
 
     int exit_jump = emit_jump(OP_JUMP_IF_FALSE);
 
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
     statement();
     emit_loop(loop_start);
 
     patch_jump(exit_jump);
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
+}
+
+// sequence.method(state)
+static void emit_iter_invoke(int sequence, int state, const char* name) {
+    Token method = synthetic_token(name);
+    emit_byte2(OP_GET_LOCAL, sequence);
+    emit_byte2(OP_GET_LOCAL, state);
+    emit_invoke(identifier_constant(&method), 1);
+}
+
+static void for_in_statement(void) {
+    // for ([var] identifier in expr) stmt
+    // the sequence and the loop state are hidden locals. the loop variable is
+    // a new local in every iteration, so each closure captures its own
+
+    consume(TOKEN_IDENTIFIER, "expected loop variable name");
+    Token name = parser.prev_token;
+    consume(TOKEN_IN, "expected 'in' after loop variable");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "expected ')' after for-in sequence");
+
+    add_local(synthetic_token("(sequence)"));
+    mark_initialized();
+    int sequence = current->local_count - 1;
+    emit_op(OP_ITER_INIT);
+    add_local(synthetic_token("(state)"));
+    mark_initialized();
+    int state = current->local_count - 1;
+
+    //> iter_next exit body
+    int loop_start = mark_label();
+    emit_op(OP_ITER_NEXT);
+    int exit_jump = curr_chunk()->count;
+    for (int i = 0; i < 4; i++) {
+        emit_byte(0xFF);
+    }
+    int operands_end = curr_chunk()->count;
+
+    // instances implement `iterate(state)`, which returns the next state or
+    // a falsy value when done, and `iteratorValue(state)`
+    emit_iter_invoke(sequence, state, "iterate");
+    emit_byte2(OP_SET_LOCAL, state);
+    int done_jump = emit_jump(OP_JUMP_IF_FALSE);
+    emit_op(OP_POP);
+    emit_iter_invoke(sequence, state, "iteratorValue");
+
+    patch_jump_from(exit_jump + 2, operands_end);
+    begin_scope();
+    add_local(name);
+    mark_initialized();
+    statement();
+    end_scope();
+    emit_loop(loop_start);
+
+    patch_jump(done_jump);
+    emit_op(OP_POP);
+    patch_jump_from(exit_jump, operands_end);
 }
 
 static void for_statement(void) {
@@ -788,33 +1391,40 @@ static void for_statement(void) {
 
     consume(TOKEN_LEFT_PAREN, "expected '(' after 'for'");
 
+    bool declares = match(TOKEN_VAR);
+    if (check(TOKEN_IDENTIFIER) && scanner_peek_token().type == TOKEN_IN) {
+        for_in_statement();
+        end_scope();
+        return;
+    }
+
     // initializer
-    if (match(TOKEN_SEMICOLON)) {
-        // no initializer
-    } else if (match(TOKEN_VAR)) {
+    if (declares) {
         var_declaration();
+    } else if (match(TOKEN_SEMICOLON)) {
+        // no initializer
     } else {
         expression_statement();
     }
 
     // condition
-    int loop_start = curr_chunk()->count;
+    int loop_start = mark_label();
     int exit_jump = -1;
     if (!match(TOKEN_SEMICOLON)) {
         expression();
         consume(TOKEN_SEMICOLON, "expected ';' after 'for' condition clause");
 
         exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-        emit_byte(OP_POP);
+        emit_op(OP_POP);
     }
 
     if (!match(TOKEN_RIGHT_PAREN)) {
         int body_jump = emit_jump(OP_JUMP);
 
-        int increment_start = curr_chunk()->count;
+        int increment_start = mark_label();
         expression();
         consume(TOKEN_RIGHT_PAREN, "expected ')' after for clauses");
-        emit_byte(OP_POP);
+        emit_op(OP_POP);
 
         emit_loop(loop_start);
         loop_start = increment_start;
@@ -828,7 +1438,7 @@ static void for_statement(void) {
 
     if (exit_jump != -1) {
         patch_jump(exit_jump);
-        emit_byte(OP_POP);
+        emit_op(OP_POP);
     }
 
     end_scope();
@@ -877,28 +1487,84 @@ static uint8_t argument_list(void) {
     return arg_count;
 }
 
+// removes the OP_GET_PROPERTY that was just emitted and returns its name
+// constant, or returns -1 if the last instruction is something else
+static int take_get_property(void) {
+    int op = recent_op(0);
+    int name;
+    if (op == OP_GET_PROPERTY) {
+        name = recent_operand(0, 0);
+    } else if (op == OP_WIDE && recent_operand(0, 0) == OP_GET_PROPERTY) {
+        name = (recent_operand(0, 1) << 8) | recent_operand(0, 2);
+    } else {
+        return -1;
+    }
+
+    drop_recent_ops(1);
+    return name;
+}
+
 static void call(bool can_assign) {
     UNUSED(can_assign);
+    // (a.b)(...) invokes the method like a.b(...) does, instead of binding
+    // it first
+    int name_constant = take_get_property();
+    int local = current->calling_local;
+    current->calling_local = -1;
     uint8_t arg_count = argument_list();
-    emit_byte2(OP_CALL, arg_count);
+    if (name_constant == -1) {
+        emit_byte2(OP_CALL, arg_count);
+    } else {
+        emit_invoke(name_constant, arg_count);
+    }
+    current->called_local = local;
+}
+
+// counts a field the initializer assigns to this, so instances can be
+// created with room for it
+static void add_init_field(int name_constant) {
+    ObjFunction* function = current->function;
+    for (int i = 0; i < function->field_count; i++) {
+        if (current->init_fields[i] == name_constant) {
+            return;
+        }
+    }
+    if (function->field_count < INIT_FIELDS_MAX) {
+        current->init_fields[function->field_count++] = name_constant;
+    }
 }
 
 static void dot(bool can_assign) {
     consume(TOKEN_IDENTIFIER, "expected property name after '.'");
-    uint8_t name_constant = identifier_constant(&parser.prev_token);
+    int name_constant = identifier_constant(&parser.prev_token);
 
     if (can_assign && match(TOKEN_EQUAL)) {
+        if (current->type == TYPE_INITIALIZER &&
+            recent_op(0) == OP_GET_LOCAL && recent_operand(0, 0) == 0) {
+            add_init_field(name_constant);
+        }
         expression();
         emit_byte2(OP_SET_PROPERTY, name_constant);
     } else if (match(TOKEN_LEFT_PAREN)) {
         uint8_t arg_count = argument_list();
-        emit_byte2(OP_INVOKE, name_constant);
-        emit_byte(arg_count);
+        emit_invoke(name_constant, arg_count);
     } else {
         emit_byte2(OP_GET_PROPERTY, name_constant);
     }
 }
 
+static void subscript(bool can_assign) {
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "expected ']' after index");
+
+    if (can_assign && match(TOKEN_EQUAL)) {
+        expression();
+        emit_op(OP_SET_INDEX);
+    } else {
+        emit_op(OP_GET_INDEX);
+    }
+}
+
 static void binary(bool can_assign) {
     UNUSED(can_assign);
 
@@ -908,34 +1574,37 @@ static void binary(bool can_assign) {
 
     switch (operatorType) {
         case TOKEN_PLUS:
-            emit_byte(OP_ADD);
+            emit_op(OP_ADD);
             break;
         case TOKEN_MINUS:
-            emit_byte(OP_SUBTRACT);
+            emit_op(OP_SUBTRACT);
             break;
         case TOKEN_STAR:
-            emit_byte(OP_MULTIPLY);
+            emit_op(OP_MULTIPLY);
             break;
         case TOKEN_SLASH:
-            emit_byte(OP_DIVIDE);
+            emit_op(OP_DIVIDE);
             break;
         case TOKEN_EQUAL_EQUAL:
-            emit_byte(OP_EQUAL);
+            emit_op(OP_EQUAL);
             break;
         case TOKEN_BANG_EQUAL:
-            emit_byte2(OP_EQUAL, OP_NOT);
+            emit_op(OP_EQUAL);
+            emit_op(OP_NOT);
             break;
         case TOKEN_GREATER:
-            emit_byte(OP_GREATER);
+            emit_op(OP_GREATER);
             break;
         case TOKEN_LESS_EQUAL:
-            emit_byte2(OP_GREATER, OP_NOT);
+            emit_op(OP_GREATER);
+            emit_op(OP_NOT);
             break;
         case TOKEN_LESS:
-            emit_byte(OP_LESS);
+            emit_op(OP_LESS);
             break;
         case TOKEN_GREATER_EQUAL:
-            emit_byte2(OP_LESS, OP_NOT);
+            emit_op(OP_LESS);
+            emit_op(OP_NOT);
             break;
         default: {
             UNREACHABLE("encountered invalid binary operator");
@@ -947,7 +1616,7 @@ static void and_(bool can_assign) {
     UNUSED(can_assign);
     int end_jump = emit_jump(OP_JUMP_IF_FALSE);
 
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
     parse_precedence(PREC_AND);
 
     patch_jump(end_jump);
@@ -959,7 +1628,7 @@ static void or_(bool can_assign) {
     int end_jump = emit_jump(OP_JUMP);
     patch_jump(else_jump);
 
-    emit_byte(OP_POP);
+    emit_op(OP_POP);
     parse_precedence(PREC_OR);
 
     patch_jump(end_jump);
@@ -973,10 +1642,10 @@ static void unary(bool can_assign) {
 
     switch (operatorType) {
         case TOKEN_MINUS:
-            emit_byte(OP_NEGATE);
+            emit_op(OP_NEGATE);
             break;
         case TOKEN_BANG:
-            emit_byte(OP_NOT);
+            emit_op(OP_NOT);
             break;
         default:
             UNREACHABLE("encountered invalid unary operator")
@@ -989,6 +1658,52 @@ static void grouping(bool can_assign) {
     consume(TOKEN_RIGHT_PAREN, "expected ')' after expression");
 }
 
+static void list(bool can_assign) {
+    UNUSED(can_assign);
+    uint8_t item_count = 0;
+    if (!check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            // allows a trailing comma
+            if (check(TOKEN_RIGHT_BRACKET)) {
+                break;
+            }
+            expression();
+            if (item_count == 255) {
+                error("can't have more than 255 items in a list literal");
+            }
+            item_count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "expected ']' after list items");
+    emit_byte2(OP_BUILD_LIST, item_count);
+}
+
+// `{key: value, ...}`, only parsed where an expression is expected so it
+// doesn't clash with blocks
+static void map(bool can_assign) {
+    UNUSED(can_assign);
+    uint8_t entry_count = 0;
+    if (!check(TOKEN_RIGHT_BRACE)) {
+        do {
+            // allows a trailing comma
+            if (check(TOKEN_RIGHT_BRACE)) {
+                break;
+            }
+            expression();
+            consume(TOKEN_COLON, "expected ':' after map key");
+            expression();
+            if (entry_count == 255) {
+                error("can't have more than 255 entries in a map literal");
+            }
+            entry_count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "expected '}' after map entries");
+    emit_byte2(OP_BUILD_MAP, entry_count);
+}
+
 static void variable(bool can_assign) {
     named_variable(parser.prev_token, can_assign);
 }
@@ -1015,7 +1730,7 @@ void super_(bool can_assign) {
 
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifier_constant(&parser.prev_token);
+    int name = identifier_constant(&parser.prev_token);
 
     named_variable(synthetic_token("this"), false);
 
@@ -1034,13 +1749,13 @@ static void literal(bool can_assign) {
     UNUSED(can_assign);
     switch (parser.prev_token.type) {
         case TOKEN_NIL:
-            emit_byte(OP_NIL);
+            emit_op(OP_NIL);
             break;
         case TOKEN_TRUE:
-            emit_byte(OP_TRUE);
+            emit_op(OP_TRUE);
             break;
         case TOKEN_FALSE:
-            emit_byte(OP_FALSE);
+            emit_op(OP_FALSE);
             break;
         default:
             UNREACHABLE("encountered an invalid character in literal function");
@@ -1055,12 +1770,13 @@ static void number(bool can_assign) {
 
 static void string(bool can_assign) {
     UNUSED(can_assign);
-    emit_constant(OBJ_VAL(copy_string(parser.prev_token.start + 1,
+    emit_constant(OBJ_VAL(copy_string(parser.vm, parser.prev_token.start + 1,
                                       parser.prev_token.length - 2)));
 }
 #pragma endregion
 
-ObjFunction* compile(const char* source) {
+ObjFunction* compile(VM* vm, const char* source) {
+    parser.vm = vm;
     scanner_init(source);
 
     Compiler compiler;
@@ -1076,14 +1792,15 @@ ObjFunction* compile(const char* source) {
     }
 
     ObjFunction* function = end_compiler();
+    compiler_free(&compiler);
 
     return parser.had_error ? NULL : function;
 }
 
-void mark_compiler_roots(void) {
+void mark_compiler_roots(VM* vm) {
     Compiler* compiler = current;
     while (compiler != NULL) {
-        mark_object((Obj*)compiler->function);
+        mark_object(vm, (Obj*)compiler->function);
         compiler = compiler->enclosing;
     }
 }
@@ -4,7 +4,7 @@
 #include "chunk.h"
 #include "object.h"
 
-ObjFunction* compile(const char* source);
-void mark_compiler_roots(void);
+ObjFunction* compile(VM* vm, const char* source);
+void mark_compiler_roots(VM* vm);
 
 #endif
@@ -11,7 +11,7 @@ typedef struct Scanner {
     int32_t line;
 } Scanner;
 
-Scanner scanner;
+THREAD_LOCAL Scanner scanner;
 
 static bool is_digit(char c) {
     return c >= '0' && c <= '9';
@@ -155,7 +155,15 @@ static TokenType identifier_type(void) {
         case 'e':
             return check_keyword(1, 3, "lse", TOKEN_ELSE);
         case 'i':
-            return check_keyword(1, 1, "f", TOKEN_IF);
+            if (scanner.curr - scanner.start > 1) {
+                switch (scanner.start[1]) {
+                    case 'f':
+                        return check_keyword(2, 0, "", TOKEN_IF);
+                    case 'n':
+                        return check_keyword(2, 0, "", TOKEN_IN);
+                }
+            }
+            break;
         case 'n':
             return check_keyword(1, 2, "il", TOKEN_NIL);
         case 'o':
@@ -234,8 +242,14 @@ Token scanner_next_token(void) {
             return make_token(TOKEN_LEFT_BRACE);
         case '}':
             return make_token(TOKEN_RIGHT_BRACE);
+        case '[':
+            return make_token(TOKEN_LEFT_BRACKET);
+        case ']':
+            return make_token(TOKEN_RIGHT_BRACKET);
         case ';':
             return make_token(TOKEN_SEMICOLON);
+        case ':':
+            return make_token(TOKEN_COLON);
         case ',':
             return make_token(TOKEN_COMMA);
         case '.':
@@ -262,3 +276,10 @@ Token scanner_next_token(void) {
 
     return token_error("unexpected character");
 }
+
+Token scanner_peek_token(void) {
+    Scanner saved = scanner;
+    Token token = scanner_next_token();
+    scanner = saved;
+    return token;
+}
@@ -9,6 +9,9 @@ typedef enum TokenType {
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
+    TOKEN_COLON,
     TOKEN_COMMA,
     TOKEN_DOT,
     TOKEN_MINUS,
@@ -37,6 +40,7 @@ typedef enum TokenType {
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IN,
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
@@ -60,5 +64,7 @@ typedef struct Token {
 
 void scanner_init(const char* source);
 Token scanner_next_token(void);
+// the token scanner_next_token() would return, without consuming it
+Token scanner_peek_token(void);
 
 #endif
@@ -17,13 +17,25 @@ static int constant_instruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+// prints the invoke cache index of an OP_INVOKE at offset
+static int cache_operand(Chunk* chunk, int offset) {
+    printf(" cache %d", (chunk->code[offset] << 8) | chunk->code[offset + 1]);
+    return offset + 2;
+}
+
 static int invoke_instruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     uint8_t arg_count = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, arg_count, constant);
     value_print(chunk->constants.values[constant]);
-    printf("'\n");
-    return offset + 3;
+    printf("'");
+    offset += 3;
+    // OP_SUPER_INVOKE has no invoke cache
+    if (chunk->code[offset - 3] == OP_INVOKE) {
+        offset = cache_operand(chunk, offset);
+    }
+    printf("\n");
+    return offset;
 }
 
 static int byte_instruction(const char* name, Chunk* chunk, int offset) {
@@ -32,6 +44,27 @@ static int byte_instruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+// prints register operands as R<slot> and constant operands as K<index>
+// followed by the constant, `kinds` holds one 'R' or 'K' per operand
+static int register_instruction(const char* name,
+                                const char* kinds,
+                                Chunk* chunk,
+                                int offset) {
+    printf("%-16s", name);
+    int operand = offset + 1;
+    for (const char* kind = kinds; *kind; kind++, operand++) {
+        uint8_t index = chunk->code[operand];
+        printf(" %c%d", *kind, index);
+        if (*kind == 'K') {
+            printf(" '");
+            value_print(value_get(&chunk->constants, index));
+            printf("'");
+        }
+    }
+    printf("\n");
+    return operand;
+}
+
 static int jump_instruction(const char* name,
                             int sign,
                             Chunk* chunk,
@@ -42,6 +75,83 @@ static int jump_instruction(const char* name,
     return offset + 3;
 }
 
+// the loop exit and the start of its body
+static int iter_next_instruction(Chunk* chunk, int offset) {
+    uint16_t exit = (uint16_t)(chunk->code[offset + 1] << 8);
+    exit |= (uint16_t)(chunk->code[offset + 2]);
+    uint16_t body = (uint16_t)(chunk->code[offset + 3] << 8);
+    body |= (uint16_t)(chunk->code[offset + 4]);
+    printf("%-16s %4d -> %d, %d\n", "OP_ITER_NEXT", offset, offset + 5 + exit,
+           offset + 5 + body);
+    return offset + 5;
+}
+
+// an instruction with the OP_WIDE prefix, whose operand is 2 bytes
+static int wide_instruction(Chunk* chunk, int offset) {
+    static const char* names[UINT8_COUNT] = {
+        [OP_CONSTANT] = "OP_CONSTANT",
+        [OP_GET_LOCAL] = "OP_GET_LOCAL",
+        [OP_SET_LOCAL] = "OP_SET_LOCAL",
+        [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+        [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+        [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+        [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+        [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+        [OP_GET_CALLER_LOCAL] = "OP_GET_CALLER_LOCAL",
+        [OP_SET_CALLER_LOCAL] = "OP_SET_CALLER_LOCAL",
+        [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+        [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+        [OP_GET_SUPER] = "OP_GET_SUPER",
+        [OP_CLASS] = "OP_CLASS",
+        [OP_METHOD] = "OP_METHOD",
+        [OP_CLOSURE] = "OP_CLOSURE",
+        [OP_LOCAL_FUNCTION] = "OP_LOCAL_FUNCTION",
+        [OP_INVOKE] = "OP_INVOKE",
+        [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    };
+    uint8_t op = chunk->code[offset + 1];
+    int index = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    printf("OP_WIDE %-16s %5d", names[op], index);
+    offset += 4;
+
+    switch (op) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_CALLER_LOCAL:
+        case OP_SET_CALLER_LOCAL:
+            printf("\n");
+            return offset;
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            printf(" (%d args)", chunk->code[offset++]);
+            break;
+        default:
+            break;
+    }
+
+    printf(" '");
+    value_print(value_get(&chunk->constants, index));
+    printf("'");
+    if (op == OP_INVOKE) {
+        offset = cache_operand(chunk, offset);
+    }
+    printf("\n");
+
+    if (op == OP_CLOSURE || op == OP_LOCAL_FUNCTION) {
+        ObjFunction* function = AS_FUNCTION(chunk->constants.values[index]);
+        for (int j = 0; j < function->upvalue_count; j++) {
+            int is_local = chunk->code[offset];
+            int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+            printf("%04d      |                     %s %d\n", offset,
+                   is_local ? "local" : "upvalue", slot);
+            offset += 3;
+        }
+    }
+    return offset;
+}
+
 void disassemble_chunk(Chunk* chunk, const char* name) {
     printf("== %s ==\n", name);
 
@@ -53,10 +163,11 @@ void disassemble_chunk(Chunk* chunk, const char* name) {
 int disassemble_instruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = chunk_line(chunk, offset);
+    if (offset > 0 && line == chunk_line(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -79,6 +190,18 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return simple_instruction("OP_GREATER", offset);
         case OP_LESS:
             return simple_instruction("OP_LESS", offset);
+        case OP_ADD_NUM:
+            return simple_instruction("OP_ADD_NUM", offset);
+        case OP_SUBTRACT_NUM:
+            return simple_instruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:
+            return simple_instruction("OP_MULTIPLY_NUM", offset);
+        case OP_DIVIDE_NUM:
+            return simple_instruction("OP_DIVIDE_NUM", offset);
+        case OP_GREATER_NUM:
+            return simple_instruction("OP_GREATER_NUM", offset);
+        case OP_LESS_NUM:
+            return simple_instruction("OP_LESS_NUM", offset);
         case OP_RETURN:
             return simple_instruction("OP_RETURN", offset);
         case OP_CLOSE_UPVALUE:
@@ -109,6 +232,10 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return byte_instruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
             return byte_instruction("OP_SET_UPVALUE", chunk, offset);
+        case OP_GET_CALLER_LOCAL:
+            return byte_instruction("OP_GET_CALLER_LOCAL", chunk, offset);
+        case OP_SET_CALLER_LOCAL:
+            return byte_instruction("OP_SET_CALLER_LOCAL", chunk, offset);
         case OP_GET_PROPERTY:
             return constant_instruction("OP_GET_PROPERTY", chunk, offset);
         case OP_SET_PROPERTY:
@@ -121,10 +248,14 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:
             return jump_instruction("OP_LOOP", -1, chunk, offset);
-        case OP_CLOSURE: {
+        case OP_CLOSURE:
+        case OP_LOCAL_FUNCTION: {
+            const char* name = chunk->code[offset] == OP_CLOSURE
+                                   ? "OP_CLOSURE"
+                                   : "OP_LOCAL_FUNCTION";
             offset++;
             uint8_t constant = chunk->code[offset++];
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
+            printf("%-16s %4d ", name, constant);
             value_print(chunk->constants.values[constant]);
             printf("\n");
 
@@ -141,6 +272,12 @@ int disassemble_instruction(Chunk* chunk, int offset) {
         }
         case OP_CALL:
             return byte_instruction("OP_CALL", chunk, offset);
+        case OP_CALL_CLOSURE:
+            return byte_instruction("OP_CALL_CLOSURE", chunk, offset);
+        case OP_CALL_NATIVE:
+            return byte_instruction("OP_CALL_NATIVE", chunk, offset);
+        case OP_TAIL_CALL:
+            return byte_instruction("OP_TAIL_CALL", chunk, offset);
         case OP_INVOKE:
             return invoke_instruction("OP_INVOKE", chunk, offset);
         case OP_SUPER_INVOKE:
@@ -151,6 +288,68 @@ int disassemble_instruction(Chunk* chunk, int offset) {
             return simple_instruction("OP_INHERIT", offset);
         case OP_METHOD:
             return constant_instruction("OP_METHOD", chunk, offset);
+        case OP_BUILD_LIST:
+            return byte_instruction("OP_BUILD_LIST", chunk, offset);
+        case OP_BUILD_MAP:
+            return byte_instruction("OP_BUILD_MAP", chunk, offset);
+        case OP_GET_INDEX:
+            return simple_instruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simple_instruction("OP_SET_INDEX", offset);
+        case OP_ITER_INIT:
+            return simple_instruction("OP_ITER_INIT", offset);
+        case OP_ITER_NEXT:
+            return iter_next_instruction(chunk, offset);
+        case OP_WIDE:
+            return wide_instruction(chunk, offset);
+        case OP_MOVE:
+            return register_instruction("OP_MOVE", "RR", chunk, offset);
+        case OP_LOADK:
+            return register_instruction("OP_LOADK", "RK", chunk, offset);
+        case OP_ADD_RR:
+            return register_instruction("OP_ADD_RR", "RR", chunk, offset);
+        case OP_SUBTRACT_RR:
+            return register_instruction("OP_SUBTRACT_RR", "RR", chunk, offset);
+        case OP_MULTIPLY_RR:
+            return register_instruction("OP_MULTIPLY_RR", "RR", chunk, offset);
+        case OP_DIVIDE_RR:
+            return register_instruction("OP_DIVIDE_RR", "RR", chunk, offset);
+        case OP_LESS_RR:
+            return register_instruction("OP_LESS_RR", "RR", chunk, offset);
+        case OP_GREATER_RR:
+            return register_instruction("OP_GREATER_RR", "RR", chunk, offset);
+        case OP_ADD_RK:
+            return register_instruction("OP_ADD_RK", "RK", chunk, offset);
+        case OP_SUBTRACT_RK:
+            return register_instruction("OP_SUBTRACT_RK", "RK", chunk, offset);
+        case OP_MULTIPLY_RK:
+            return register_instruction("OP_MULTIPLY_RK", "RK", chunk, offset);
+        case OP_DIVIDE_RK:
+            return register_instruction("OP_DIVIDE_RK", "RK", chunk, offset);
+        case OP_LESS_RK:
+            return register_instruction("OP_LESS_RK", "RK", chunk, offset);
+        case OP_GREATER_RK:
+            return register_instruction("OP_GREATER_RK", "RK", chunk, offset);
+        case OP_ADD_RRR:
+            return register_instruction("OP_ADD_RRR", "RRR", chunk, offset);
+        case OP_SUBTRACT_RRR:
+            return register_instruction("OP_SUBTRACT_RRR", "RRR", chunk,
+                                        offset);
+        case OP_MULTIPLY_RRR:
+            return register_instruction("OP_MULTIPLY_RRR", "RRR", chunk,
+                                        offset);
+        case OP_DIVIDE_RRR:
+            return register_instruction("OP_DIVIDE_RRR", "RRR", chunk, offset);
+        case OP_ADD_RRK:
+            return register_instruction("OP_ADD_RRK", "RRK", chunk, offset);
+        case OP_SUBTRACT_RRK:
+            return register_instruction("OP_SUBTRACT_RRK", "RRK", chunk,
+                                        offset);
+        case OP_MULTIPLY_RRK:
+            return register_instruction("OP_MULTIPLY_RRK", "RRK", chunk,
+                                        offset);
+        case OP_DIVIDE_RRK:
+            return register_instruction("OP_DIVIDE_RRK", "RRK", chunk, offset);
         default:
             printf("unknown instruction %d\n", instruction);
             return offset + 1;
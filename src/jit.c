@@ -0,0 +1,1105 @@
+#include "jit.h"
+
+#ifdef ENABLE_JIT
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "assert.h"
+#include "chunk.h"
+#include "memory.h"
+#include "profiler.h"
+
+// The JIT is a template compiler for x86-64 System V. Every bytecode
+// instruction becomes a fixed machine code sequence: simple stack shuffling
+// is emitted inline, everything else calls a helper below, and jumps become
+// native jumps. Instructions it can't handle (calls, returns, classes...)
+// store their address in frame->ip and return to the interpreter.
+//
+// Register usage in compiled code:
+//   r12: CallFrame* of the running function
+//   r13: VM*
+//
+// Helpers that can fail get frame->ip pointing past their instruction before
+// they run, just like the interpreter, so runtime_error(vm) reports the right
+// line.
+
+typedef int (*JitEntry)(VM* vm, CallFrame* frame, void* target);
+typedef int (*JitHelper)(VM* vm, CallFrame* frame, int operand);
+
+struct JitCode {
+    uint8_t* memory;
+    size_t size;
+    // native offset of the instruction at each bytecode offset
+    uint32_t* entries;
+    int entry_count;
+};
+
+// target_offset of fixups that jump to the error exit
+#define ERROR_EXIT -1
+
+typedef struct Fixup {
+    // position of the rel32 to patch
+    int position;
+    // bytecode offset of the instruction to jump to or ERROR_EXIT
+    int target_offset;
+} Fixup;
+
+typedef struct Assembler {
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+} Assembler;
+
+#pragma region helpers
+static Value read_constant(CallFrame* frame, int index) {
+    return frame->closure->function->chunk.constants.values[index];
+}
+
+static int check_numbers(VM* vm, const char* op, Value a, Value b) {
+    if (!IS_NUMBER(a)) {
+        runtime_error(vm, "left operand of '%s' operator must be a number", op);
+        return 1;
+    }
+    if (!IS_NUMBER(b)) {
+        runtime_error(vm, "right operand of '%s' operator must be a number",
+                      op);
+        return 1;
+    }
+    return 0;
+}
+
+static int helper_get_global(VM* vm, CallFrame* frame, int operand) {
+    ObjString* name = AS_STRING(read_constant(frame, operand));
+    Value value;
+    if (!table_get(&vm->globals, name, &value)) {
+        runtime_error(vm, "undefined variable: '%s'", name->chars);
+        return 1;
+    }
+
+    push(vm, value);
+    return 0;
+}
+
+static int helper_set_global(VM* vm, CallFrame* frame, int operand) {
+    ObjString* name = AS_STRING(read_constant(frame, operand));
+    if (table_set(vm, &vm->globals, name, vm->stack_top[-1])) {
+        table_delete(&vm->globals, name);
+        runtime_error(vm, "undefined variable: '%s'", name->chars);
+        return 1;
+    }
+    return 0;
+}
+
+static int helper_define_global(VM* vm, CallFrame* frame, int operand) {
+    ObjString* name = AS_STRING(read_constant(frame, operand));
+    table_set(vm, &vm->globals, name, vm->stack_top[-1]);
+    pop(vm);
+    return 0;
+}
+
+static int helper_get_upvalue(VM* vm, CallFrame* frame, int operand) {
+    push(vm, *frame->closure->upvalues[operand]->location);
+    return 0;
+}
+
+static int helper_set_upvalue(VM* vm, CallFrame* frame, int operand) {
+    *frame->closure->upvalues[operand]->location = vm->stack_top[-1];
+    return 0;
+}
+
+static int helper_get_caller_local(VM* vm, CallFrame* frame, int operand) {
+    push(vm, (frame - 1)->slots[operand]);
+    return 0;
+}
+
+static int helper_set_caller_local(VM* vm, CallFrame* frame, int operand) {
+    (frame - 1)->slots[operand] = vm->stack_top[-1];
+    return 0;
+}
+
+static int helper_equal(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    Value b = pop(vm);
+    Value a = pop(vm);
+    push(vm, BOOL_VAL(values_equal(a, b)));
+    return 0;
+}
+
+static int helper_add(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    Value result;
+    if (!add_values(vm, vm->stack_top[-2], vm->stack_top[-1], &result)) {
+        return 1;
+    }
+
+    vm->stack_top -= 2;
+    push(vm, result);
+    return 0;
+}
+
+#define NUMBER_HELPER(name, value_type, op)                                 \
+    static int name(VM* vm, CallFrame* frame, int operand) {                \
+        UNUSED(frame);                                                      \
+        UNUSED(operand);                                                    \
+        if (check_numbers(vm, #op, vm->stack_top[-2], vm->stack_top[-1])) { \
+            return 1;                                                       \
+        }                                                                   \
+        double b = AS_NUMBER(pop(vm));                                      \
+        double a = AS_NUMBER(pop(vm));                                      \
+        push(vm, value_type(a op b));                                       \
+        return 0;                                                           \
+    }
+
+NUMBER_HELPER(helper_subtract, NUMBER_VAL, -)
+NUMBER_HELPER(helper_multiply, NUMBER_VAL, *)
+NUMBER_HELPER(helper_divide, NUMBER_VAL, /)
+NUMBER_HELPER(helper_greater, BOOL_VAL, >)
+NUMBER_HELPER(helper_less, BOOL_VAL, <)
+
+#undef NUMBER_HELPER
+
+static int helper_not(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    push(vm, BOOL_VAL(is_falsy(pop(vm))));
+    return 0;
+}
+
+static int helper_negate(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    if (!IS_NUMBER(vm->stack_top[-1])) {
+        runtime_error(vm, "negation operand must be a number");
+        return 1;
+    }
+
+    push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+    return 0;
+}
+
+static int helper_build_list(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    build_list(vm, operand);
+    return 0;
+}
+
+static int helper_build_map(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    return build_map(vm, operand) ? 0 : 1;
+}
+
+static int helper_get_index(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    Value result;
+    if (!get_index(vm, vm->stack_top[-2], vm->stack_top[-1], &result)) {
+        return 1;
+    }
+
+    vm->stack_top -= 2;
+    push(vm, result);
+    return 0;
+}
+
+static int helper_set_index(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    Value value = vm->stack_top[-1];
+    if (!set_index(vm, vm->stack_top[-3], vm->stack_top[-2], value)) {
+        return 1;
+    }
+
+    vm->stack_top -= 3;
+    push(vm, value);
+    return 0;
+}
+
+static int helper_iter_init(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    return iter_init(vm) ? 0 : 1;
+}
+
+static int helper_iter_next(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    return (int)iter_next(vm);
+}
+
+static int helper_profiler_sample(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    profiler_sample(vm);
+    return 0;
+}
+
+static int helper_print(VM* vm, CallFrame* frame, int operand) {
+    UNUSED(frame);
+    UNUSED(operand);
+    value_print(pop(vm));
+    printf("\n");
+    return 0;
+}
+
+// runs any register instruction, the operand packs the opcode in the low
+// byte and the instruction's operands in the bytes above it
+static int helper_register(VM* vm, CallFrame* frame, int operand) {
+    OpCode op = (OpCode)(operand & 0xFF);
+    uint8_t a = (operand >> 8) & 0xFF;
+    uint8_t b = (operand >> 16) & 0xFF;
+    uint8_t c = (operand >> 24) & 0xFF;
+    Value* slots = frame->slots;
+
+    switch (op) {
+        case OP_MOVE:
+            slots[a] = slots[b];
+            return 0;
+        case OP_LOADK:
+            slots[a] = read_constant(frame, b);
+            return 0;
+        case OP_ADD_RR:
+        case OP_ADD_RK: {
+            Value right = op == OP_ADD_RR ? slots[b] : read_constant(frame, b);
+            Value result;
+            if (!add_values(vm, slots[a], right, &result)) {
+                return 1;
+            }
+            push(vm, result);
+            return 0;
+        }
+        case OP_ADD_RRR:
+        case OP_ADD_RRK: {
+            Value right = op == OP_ADD_RRR ? slots[c] : read_constant(frame, c);
+            return add_values(vm, slots[b], right, &slots[a]) ? 0 : 1;
+        }
+        default:
+            break;
+    }
+
+    Value left;
+    Value right;
+    bool is_store = op >= OP_ADD_RRR;
+    if (is_store) {
+        left = slots[b];
+        right = op <= OP_DIVIDE_RRR ? slots[c] : read_constant(frame, c);
+    } else {
+        left = slots[a];
+        right = op <= OP_GREATER_RR ? slots[b] : read_constant(frame, b);
+    }
+
+    const char* symbol = NULL;
+    switch (op) {
+        case OP_SUBTRACT_RR:
+        case OP_SUBTRACT_RK:
+        case OP_SUBTRACT_RRR:
+        case OP_SUBTRACT_RRK:
+            symbol = "-";
+            break;
+        case OP_MULTIPLY_RR:
+        case OP_MULTIPLY_RK:
+        case OP_MULTIPLY_RRR:
+        case OP_MULTIPLY_RRK:
+            symbol = "*";
+            break;
+        case OP_DIVIDE_RR:
+        case OP_DIVIDE_RK:
+        case OP_DIVIDE_RRR:
+        case OP_DIVIDE_RRK:
+            symbol = "/";
+            break;
+        case OP_LESS_RR:
+        case OP_LESS_RK:
+            symbol = "<";
+            break;
+        case OP_GREATER_RR:
+        case OP_GREATER_RK:
+            symbol = ">";
+            break;
+        default:
+            UNREACHABLE("encountered an unknown register instruction");
+    }
+
+    if (check_numbers(vm, symbol, left, right)) {
+        return 1;
+    }
+
+    double x = AS_NUMBER(left);
+    double y = AS_NUMBER(right);
+    Value result;
+    switch (symbol[0]) {
+        case '-':
+            result = NUMBER_VAL(x - y);
+            break;
+        case '*':
+            result = NUMBER_VAL(x * y);
+            break;
+        case '/':
+            result = NUMBER_VAL(x / y);
+            break;
+        case '<':
+            result = BOOL_VAL(x < y);
+            break;
+        default:
+            result = BOOL_VAL(x > y);
+            break;
+    }
+
+    if (is_store) {
+        slots[a] = result;
+    } else {
+        push(vm, result);
+    }
+    return 0;
+}
+#pragma endregion
+
+#pragma region assembler
+static void emit(Assembler* as, const uint8_t* bytes, int count) {
+    if (as->capacity < as->count + count) {
+        while (as->capacity < as->count + count) {
+            as->capacity = GROW_CAPACITY(as->capacity);
+        }
+        as->code = realloc(as->code, as->capacity);
+        ASSERT(as->code != NULL, "we are able to allocate memory");
+    }
+
+    memcpy(as->code + as->count, bytes, count);
+    as->count += count;
+}
+
+#define EMIT(as, ...)                                           \
+    do {                                                        \
+        const uint8_t bytes_[] = {__VA_ARGS__};                 \
+        emit((as), bytes_, (int)sizeof(bytes_));                \
+    } while (false)
+
+static void emit_u32(Assembler* as, uint32_t value) {
+    emit(as, (const uint8_t*)&value, 4);
+}
+
+static void emit_u64(Assembler* as, uint64_t value) {
+    emit(as, (const uint8_t*)&value, 8);
+}
+
+// mov rax, imm64
+static void emit_load_rax(Assembler* as, uint64_t value) {
+    EMIT(as, 0x48, 0xB8);
+    emit_u64(as, value);
+}
+
+// the rel32 that follows is patched to jump to the bytecode offset target
+static void emit_fixup(Assembler* as, int target) {
+    if (as->fixup_capacity < as->fixup_count + 1) {
+        as->fixup_capacity = GROW_CAPACITY(as->fixup_capacity);
+        as->fixups =
+            realloc(as->fixups, sizeof(Fixup) * as->fixup_capacity);
+        ASSERT(as->fixups != NULL, "we are able to allocate memory");
+    }
+
+    as->fixups[as->fixup_count++] = (Fixup){as->count, target};
+    emit_u32(as, 0);
+}
+
+// frame->ip = ip
+static void emit_store_ip(Assembler* as, uint8_t* ip) {
+    emit_load_rax(as, (uint64_t)(uintptr_t)ip);
+    // mov [r12 + disp8], rax
+    EMIT(as, 0x49, 0x89, 0x44, 0x24, (uint8_t)offsetof(CallFrame, ip));
+}
+
+// rcx = vm->stack_top
+static void emit_load_stack_top(Assembler* as) {
+    // mov rcx, [r13 + disp32]
+    EMIT(as, 0x49, 0x8B, 0x8D);
+    emit_u32(as, (uint32_t)offsetof(VM, stack_top));
+}
+
+// vm->stack_top = rcx
+static void emit_store_stack_top(Assembler* as) {
+    // mov [r13 + disp32], rcx
+    EMIT(as, 0x49, 0x89, 0x8D);
+    emit_u32(as, (uint32_t)offsetof(VM, stack_top));
+}
+
+static void emit_push_value(Assembler* as, Value value) {
+    uint64_t words[2] = {0, 0};
+    memcpy(words, &value, sizeof(Value));
+
+    emit_load_stack_top(as);
+    emit_load_rax(as, words[0]);
+    EMIT(as, 0x48, 0x89, 0x01);  // mov [rcx], rax
+    emit_load_rax(as, words[1]);
+    EMIT(as, 0x48, 0x89, 0x41, 0x08);  // mov [rcx + 8], rax
+    EMIT(as, 0x48, 0x83, 0xC1, 0x10);  // add rcx, 16
+    emit_store_stack_top(as);
+}
+
+// rax = frame->slots
+static void emit_load_slots(Assembler* as) {
+    // mov rax, [r12 + disp8]
+    EMIT(as, 0x49, 0x8B, 0x44, 0x24, (uint8_t)offsetof(CallFrame, slots));
+}
+
+static void emit_get_local(Assembler* as, int slot) {
+    emit_load_slots(as);
+    emit_load_stack_top(as);
+    EMIT(as, 0xF3, 0x0F, 0x6F, 0x80);  // movdqu xmm0, [rax + disp32]
+    emit_u32(as, slot * (uint32_t)sizeof(Value));
+    EMIT(as, 0xF3, 0x0F, 0x7F, 0x01);  // movdqu [rcx], xmm0
+    EMIT(as, 0x48, 0x83, 0xC1, 0x10);  // add rcx, 16
+    emit_store_stack_top(as);
+}
+
+static void emit_set_local(Assembler* as, int slot) {
+    emit_load_slots(as);
+    emit_load_stack_top(as);
+    EMIT(as, 0xF3, 0x0F, 0x6F, 0x41, 0xF0);  // movdqu xmm0, [rcx - 16]
+    EMIT(as, 0xF3, 0x0F, 0x7F, 0x80);        // movdqu [rax + disp32], xmm0
+    emit_u32(as, slot * (uint32_t)sizeof(Value));
+}
+
+static void emit_pop(Assembler* as) {
+    // sub qword [r13 + disp32], 16
+    EMIT(as, 0x49, 0x83, 0xAD);
+    emit_u32(as, (uint32_t)offsetof(VM, stack_top));
+    EMIT(as, 0x10);
+}
+
+// eax = helper(vm, frame, operand)
+static void emit_call(Assembler* as, JitHelper helper, int operand) {
+    EMIT(as, 0x4C, 0x89, 0xEF);  // mov rdi, r13
+    EMIT(as, 0x4C, 0x89, 0xE6);  // mov rsi, r12
+    EMIT(as, 0xBA);              // mov edx, imm32
+    emit_u32(as, (uint32_t)operand);
+    emit_load_rax(as, (uint64_t)(uintptr_t)helper);
+    EMIT(as, 0xFF, 0xD0);  // call rax
+}
+
+static void emit_jump_to(Assembler* as, int target) {
+    EMIT(as, 0xE9);  // jmp rel32
+    emit_fixup(as, target);
+}
+
+// samples the call stack if the profiling timer fired, like the interpreter
+// does on loop back-edges
+static void emit_profiler_poll(Assembler* as, uint8_t* next_ip) {
+    EMIT(as, 0x48, 0xB8);  // mov rax, imm64
+    emit_u64(as, (uint64_t)(uintptr_t)&profiler_pending);
+    EMIT(as, 0x83, 0x38, 0x00);  // cmp dword [rax], 0
+    EMIT(as, 0x0F, 0x84);        // je rel32
+    int position = as->count;
+    emit_u32(as, 0);
+    emit_store_ip(as, next_ip);
+    emit_call(as, helper_profiler_sample, 0);
+    int32_t rel = as->count - (position + 4);
+    memcpy(as->code + position, &rel, 4);
+}
+
+// jumps to the shared error exit when the helper that just ran failed
+static void emit_check_error(Assembler* as) {
+    EMIT(as, 0x85, 0xC0);  // test eax, eax
+    EMIT(as, 0x0F, 0x85);  // jnz rel32
+    emit_fixup(as, ERROR_EXIT);
+}
+
+static void emit_epilogue(Assembler* as) {
+    EMIT(as, 0x41, 0x5D);  // pop r13
+    EMIT(as, 0x41, 0x5C);  // pop r12
+    EMIT(as, 0x5B);        // pop rbx
+    EMIT(as, 0xC3);        // ret
+}
+
+static void emit_exit(Assembler* as, uint8_t* ip, JitResult result) {
+    emit_store_ip(as, ip);
+    EMIT(as, 0xB8);  // mov eax, imm32
+    emit_u32(as, (uint32_t)result);
+    emit_epilogue(as);
+}
+#pragma endregion
+
+#pragma region number fast paths
+// registers that hold the base address of memory operands
+#define BASE_SLOTS 0  // rax, loaded with frame->slots
+#define BASE_STACK 1  // rcx, loaded with vm->stack_top
+
+typedef struct Operand {
+    bool is_constant;
+    int base;
+    // offset of the Value from the base register
+    int32_t disp;
+    double constant;
+} Operand;
+
+static Operand stack_operand(int distance) {
+    return (Operand){false, BASE_STACK, -16 * (distance + 1), 0};
+}
+
+static Operand slot_operand(uint8_t slot) {
+    return (Operand){false, BASE_SLOTS, slot * (int32_t)sizeof(Value), 0};
+}
+
+static Operand constant_operand(double value) {
+    return (Operand){true, 0, 0, value};
+}
+
+// ModRM and displacement for [base + disp32]
+static void emit_memory(Assembler* as, int reg, int base, int32_t disp) {
+    EMIT(as, (uint8_t)(0x80 | (reg << 3) | base));
+    emit_u32(as, (uint32_t)disp);
+}
+
+// the rel32 that follows is patched later with patch_here()
+static int emit_forward_rel32(Assembler* as) {
+    int position = as->count;
+    emit_u32(as, 0);
+    return position;
+}
+
+static void patch_here(Assembler* as, int position) {
+    int32_t rel = as->count - (position + 4);
+    memcpy(as->code + position, &rel, 4);
+}
+
+// jumps to the slow path unless the operand is a number
+static void emit_expect_number(Assembler* as,
+                               Operand operand,
+                               int* slow_jumps,
+                               int* slow_jump_count) {
+    if (operand.is_constant) {
+        return;
+    }
+
+    // cmp dword [base + disp32], imm8
+    EMIT(as, 0x83);
+    emit_memory(as, 7, operand.base,
+                operand.disp + (int32_t)offsetof(Value, type));
+    EMIT(as, VAL_NUMBER);
+    EMIT(as, 0x0F, 0x85);  // jne rel32
+    slow_jumps[(*slow_jump_count)++] = emit_forward_rel32(as);
+}
+
+// xmm<reg> = the operand's number
+static void emit_load_number(Assembler* as, int xmm, Operand operand) {
+    if (operand.is_constant) {
+        uint64_t bits;
+        memcpy(&bits, &operand.constant, sizeof(bits));
+        EMIT(as, 0x48, 0xBA);  // mov rdx, imm64
+        emit_u64(as, bits);
+        // movq xmm, rdx
+        EMIT(as, 0x66, 0x48, 0x0F, 0x6E, (uint8_t)(0xC2 | (xmm << 3)));
+        return;
+    }
+
+    EMIT(as, 0xF2, 0x0F, 0x10);  // movsd xmm, [base + disp32]
+    emit_memory(as, xmm, operand.base,
+                operand.disp + (int32_t)offsetof(Value, as));
+}
+
+typedef enum Destination {
+    // the result replaces the left operand on the stack and the right one is
+    // popped, like the stack instructions
+    DEST_REPLACE,
+    DEST_PUSH,
+    DEST_SLOT,
+} Destination;
+
+// inline code for `left op right` on two numbers, anything else calls
+// `slow` which runs the whole instruction
+static void emit_number_op(Assembler* as,
+                           OpCode op,
+                           Operand left,
+                           Operand right,
+                           Destination destination,
+                           uint8_t slot,
+                           uint8_t* next_ip,
+                           JitHelper slow,
+                           int slow_operand) {
+    emit_load_slots(as);
+    emit_load_stack_top(as);
+
+    int slow_jumps[2];
+    int slow_jump_count = 0;
+    emit_expect_number(as, left, slow_jumps, &slow_jump_count);
+    emit_expect_number(as, right, slow_jumps, &slow_jump_count);
+    emit_load_number(as, 0, left);
+    emit_load_number(as, 1, right);
+
+    int base = BASE_STACK;
+    int32_t disp = 0;
+    if (destination == DEST_REPLACE) {
+        disp = -32;
+    } else if (destination == DEST_SLOT) {
+        base = BASE_SLOTS;
+        disp = slot * (int32_t)sizeof(Value);
+    }
+
+    ValueType type = VAL_NUMBER;
+    switch (op) {
+        case OP_ADD:
+            EMIT(as, 0xF2, 0x0F, 0x58, 0xC1);  // addsd xmm0, xmm1
+            break;
+        case OP_SUBTRACT:
+            EMIT(as, 0xF2, 0x0F, 0x5C, 0xC1);  // subsd xmm0, xmm1
+            break;
+        case OP_MULTIPLY:
+            EMIT(as, 0xF2, 0x0F, 0x59, 0xC1);  // mulsd xmm0, xmm1
+            break;
+        case OP_DIVIDE:
+            EMIT(as, 0xF2, 0x0F, 0x5E, 0xC1);  // divsd xmm0, xmm1
+            break;
+        case OP_GREATER:
+        case OP_LESS:
+            type = VAL_BOOL;
+            // seta is false for unordered operands, so NaN compares false
+            if (op == OP_GREATER) {
+                EMIT(as, 0x66, 0x0F, 0x2E, 0xC1);  // ucomisd xmm0, xmm1
+            } else {
+                EMIT(as, 0x66, 0x0F, 0x2E, 0xC8);  // ucomisd xmm1, xmm0
+            }
+            EMIT(as, 0x0F, 0x97, 0xC0);  // seta al
+            break;
+        default:
+            UNREACHABLE("encountered an instruction without a fast path");
+    }
+
+    EMIT(as, 0xC7);  // mov dword [base + disp32], imm32
+    emit_memory(as, 0, base, disp + (int32_t)offsetof(Value, type));
+    emit_u32(as, (uint32_t)type);
+    if (type == VAL_NUMBER) {
+        EMIT(as, 0xF2, 0x0F, 0x11);  // movsd [base + disp32], xmm0
+    } else {
+        EMIT(as, 0x88);  // mov byte [base + disp32], al
+    }
+    emit_memory(as, 0, base, disp + (int32_t)offsetof(Value, as));
+
+    if (destination == DEST_REPLACE) {
+        EMIT(as, 0x48, 0x83, 0xE9, 0x10);  // sub rcx, 16
+        emit_store_stack_top(as);
+    } else if (destination == DEST_PUSH) {
+        EMIT(as, 0x48, 0x83, 0xC1, 0x10);  // add rcx, 16
+        emit_store_stack_top(as);
+    }
+
+    EMIT(as, 0xE9);  // jmp rel32
+    int done = emit_forward_rel32(as);
+
+    for (int i = 0; i < slow_jump_count; i++) {
+        patch_here(as, slow_jumps[i]);
+    }
+    emit_store_ip(as, next_ip);
+    emit_call(as, slow, slow_operand);
+    emit_check_error(as);
+
+    patch_here(as, done);
+}
+
+static void emit_jump_if_false(Assembler* as, int target) {
+    emit_load_stack_top(as);
+    EMIT(as, 0x8B);  // mov eax, [rcx + disp32]
+    emit_memory(as, 0, BASE_STACK, -16 + (int32_t)offsetof(Value, type));
+    EMIT(as, 0x83, 0xF8, VAL_NIL);  // cmp eax, imm8
+    EMIT(as, 0x0F, 0x84);           // je rel32
+    emit_fixup(as, target);
+    EMIT(as, 0x83, 0xF8, VAL_BOOL);  // cmp eax, imm8
+    EMIT(as, 0x0F, 0x85);            // jne rel32
+    int truthy = emit_forward_rel32(as);
+    EMIT(as, 0x80);  // cmp byte [rcx + disp32], imm8
+    emit_memory(as, 7, BASE_STACK, -16 + (int32_t)offsetof(Value, as));
+    EMIT(as, 0x00);
+    EMIT(as, 0x0F, 0x84);  // je rel32
+    emit_fixup(as, target);
+    patch_here(as, truthy);
+}
+
+// falls through to the next instruction for ITER_PROTOCOL
+static void emit_iter_next(Assembler* as, int exit, int body) {
+    emit_call(as, helper_iter_next, 0);
+    EMIT(as, 0x83, 0xF8, ITER_DONE);  // cmp eax, imm8
+    EMIT(as, 0x0F, 0x84);             // je rel32
+    emit_fixup(as, exit);
+    EMIT(as, 0x83, 0xF8, ITER_VALUE);  // cmp eax, imm8
+    EMIT(as, 0x0F, 0x84);              // je rel32
+    emit_fixup(as, body);
+}
+
+static void emit_move(Assembler* as, uint8_t dst, uint8_t src) {
+    emit_load_slots(as);
+    EMIT(as, 0xF3, 0x0F, 0x6F);  // movdqu xmm0, [rax + disp32]
+    emit_memory(as, 0, BASE_SLOTS, src * (int32_t)sizeof(Value));
+    EMIT(as, 0xF3, 0x0F, 0x7F);  // movdqu [rax + disp32], xmm0
+    emit_memory(as, 0, BASE_SLOTS, dst * (int32_t)sizeof(Value));
+}
+
+static void emit_load_constant(Assembler* as, uint8_t dst, Value value) {
+    uint64_t words[2] = {0, 0};
+    memcpy(words, &value, sizeof(Value));
+
+    emit_load_slots(as);
+    for (int i = 0; i < 2; i++) {
+        EMIT(as, 0x48, 0xBA);  // mov rdx, imm64
+        emit_u64(as, words[i]);
+        EMIT(as, 0x48, 0x89);  // mov [rax + disp32], rdx
+        emit_memory(as, 2, BASE_SLOTS, dst * (int32_t)sizeof(Value) + i * 8);
+    }
+}
+
+// the stack instruction a register instruction performs
+static OpCode register_base_op(OpCode op) {
+    switch (op) {
+        case OP_ADD_RR:
+        case OP_ADD_RK:
+        case OP_ADD_RRR:
+        case OP_ADD_RRK:
+            return OP_ADD;
+        case OP_SUBTRACT_RR:
+        case OP_SUBTRACT_RK:
+        case OP_SUBTRACT_RRR:
+        case OP_SUBTRACT_RRK:
+            return OP_SUBTRACT;
+        case OP_MULTIPLY_RR:
+        case OP_MULTIPLY_RK:
+        case OP_MULTIPLY_RRR:
+        case OP_MULTIPLY_RRK:
+            return OP_MULTIPLY;
+        case OP_DIVIDE_RR:
+        case OP_DIVIDE_RK:
+        case OP_DIVIDE_RRR:
+        case OP_DIVIDE_RRK:
+            return OP_DIVIDE;
+        case OP_LESS_RR:
+        case OP_LESS_RK:
+            return OP_LESS;
+        case OP_GREATER_RR:
+        case OP_GREATER_RK:
+            return OP_GREATER;
+        default:
+            UNREACHABLE("encountered an unknown register instruction");
+    }
+}
+
+static void translate_register_instruction(Assembler* as,
+                                           Chunk* chunk,
+                                           uint8_t* ip,
+                                           int length) {
+    OpCode op = (OpCode)ip[0];
+    if (op == OP_MOVE) {
+        emit_move(as, ip[1], ip[2]);
+        return;
+    }
+    if (op == OP_LOADK) {
+        emit_load_constant(as, ip[1], chunk->constants.values[ip[2]]);
+        return;
+    }
+
+    int packed = op;
+    for (int i = 1; i < length; i++) {
+        packed |= ip[i] << (8 * i);
+    }
+
+    bool is_store = length == 4;
+    bool has_constant = is_store ? op >= OP_ADD_RRK : op >= OP_ADD_RK;
+    uint8_t right_index = is_store ? ip[3] : ip[2];
+    Operand right = slot_operand(right_index);
+    if (has_constant) {
+        Value constant = chunk->constants.values[right_index];
+        if (!IS_NUMBER(constant)) {
+            // never a number, so there is no point in a fast path
+            emit_store_ip(as, ip + length);
+            emit_call(as, helper_register, packed);
+            emit_check_error(as);
+            return;
+        }
+        right = constant_operand(AS_NUMBER(constant));
+    }
+
+    Operand left = slot_operand(is_store ? ip[2] : ip[1]);
+    emit_number_op(as, register_base_op(op), left, right,
+                   is_store ? DEST_SLOT : DEST_PUSH, ip[1], ip + length,
+                   helper_register, packed);
+}
+#pragma endregion
+
+static JitHelper stack_helper(OpCode op, bool* can_fail) {
+    *can_fail = true;
+    switch (op) {
+        case OP_GET_GLOBAL:
+            return helper_get_global;
+        case OP_SET_GLOBAL:
+            return helper_set_global;
+        case OP_ADD:
+            return helper_add;
+        case OP_SUBTRACT:
+            return helper_subtract;
+        case OP_MULTIPLY:
+            return helper_multiply;
+        case OP_DIVIDE:
+            return helper_divide;
+        case OP_GREATER:
+            return helper_greater;
+        case OP_LESS:
+            return helper_less;
+        case OP_NEGATE:
+            return helper_negate;
+        case OP_BUILD_MAP:
+            return helper_build_map;
+        case OP_GET_INDEX:
+            return helper_get_index;
+        case OP_SET_INDEX:
+            return helper_set_index;
+        case OP_ITER_INIT:
+            return helper_iter_init;
+        default:
+            break;
+    }
+
+    *can_fail = false;
+    switch (op) {
+        case OP_DEFINE_GLOBAL:
+            return helper_define_global;
+        case OP_GET_UPVALUE:
+            return helper_get_upvalue;
+        case OP_SET_UPVALUE:
+            return helper_set_upvalue;
+        case OP_GET_CALLER_LOCAL:
+            return helper_get_caller_local;
+        case OP_SET_CALLER_LOCAL:
+            return helper_set_caller_local;
+        case OP_EQUAL:
+            return helper_equal;
+        case OP_NOT:
+            return helper_not;
+        case OP_PRINT:
+            return helper_print;
+        case OP_BUILD_LIST:
+            return helper_build_list;
+        default:
+            return NULL;
+    }
+}
+
+// runs the instruction at ip with its helper, or goes back to the
+// interpreter when it has none
+static void emit_helper_instruction(Assembler* as,
+                                    OpCode op,
+                                    uint8_t* ip,
+                                    int length,
+                                    int operand) {
+    bool can_fail;
+    JitHelper helper = stack_helper(op, &can_fail);
+    if (!helper) {
+        emit_exit(as, ip, JIT_EXIT);
+        return;
+    }
+
+    if (can_fail) {
+        emit_store_ip(as, ip + length);
+    }
+    emit_call(as, helper, operand);
+    if (can_fail) {
+        emit_check_error(as);
+    }
+}
+
+// OP_WIDE and the instruction after it, whose operand is 2 bytes
+static void translate_wide_instruction(Assembler* as,
+                                       Chunk* chunk,
+                                       uint8_t* ip,
+                                       int length) {
+    OpCode op = (OpCode)ip[1];
+    int operand = (ip[2] << 8) | ip[3];
+    switch (op) {
+        case OP_CONSTANT:
+            emit_push_value(as, chunk->constants.values[operand]);
+            return;
+        case OP_GET_LOCAL:
+            emit_get_local(as, operand);
+            return;
+        case OP_SET_LOCAL:
+            emit_set_local(as, operand);
+            return;
+        default:
+            emit_helper_instruction(as, op, ip, length, operand);
+            return;
+    }
+}
+
+static void translate_instruction(Assembler* as,
+                                  Chunk* chunk,
+                                  int offset,
+                                  int length) {
+    uint8_t* ip = chunk->code + offset;
+    // the fast paths check operand types anyway
+    OpCode op = unquickened_op((OpCode)ip[0]);
+
+    switch (op) {
+        case OP_WIDE:
+            translate_wide_instruction(as, chunk, ip, length);
+            return;
+        case OP_CONSTANT:
+            emit_push_value(as, chunk->constants.values[ip[1]]);
+            return;
+        case OP_NIL:
+            emit_push_value(as, NIL_VAL);
+            return;
+        case OP_TRUE:
+            emit_push_value(as, BOOL_VAL(true));
+            return;
+        case OP_FALSE:
+            emit_push_value(as, BOOL_VAL(false));
+            return;
+        case OP_POP:
+            emit_pop(as);
+            return;
+        case OP_GET_LOCAL:
+            emit_get_local(as, ip[1]);
+            return;
+        case OP_SET_LOCAL:
+            emit_set_local(as, ip[1]);
+            return;
+        case OP_JUMP:
+            emit_jump_to(as, offset + 3 + ((ip[1] << 8) | ip[2]));
+            return;
+        case OP_LOOP:
+            emit_profiler_poll(as, ip + length);
+            emit_jump_to(as, offset + 3 - ((ip[1] << 8) | ip[2]));
+            return;
+        case OP_JUMP_IF_FALSE:
+            emit_jump_if_false(as, offset + 3 + ((ip[1] << 8) | ip[2]));
+            return;
+        case OP_ITER_NEXT:
+            emit_iter_next(as, offset + 5 + ((ip[1] << 8) | ip[2]),
+                           offset + 5 + ((ip[3] << 8) | ip[4]));
+            return;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_GREATER:
+        case OP_LESS: {
+            bool can_fail;
+            emit_number_op(as, op, stack_operand(1), stack_operand(0),
+                           DEST_REPLACE, 0, ip + length,
+                           stack_helper(op, &can_fail), 0);
+            return;
+        }
+        default:
+            break;
+    }
+
+    if (op >= OP_MOVE && op <= OP_DIVIDE_RRK) {
+        translate_register_instruction(as, chunk, ip, length);
+        return;
+    }
+
+    emit_helper_instruction(as, op, ip, length, length > 1 ? ip[1] : 0);
+}
+
+bool jit_compile(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    Assembler as = {0};
+
+    uint32_t* entries = malloc(sizeof(uint32_t) * chunk->count);
+    if (!entries) {
+        return false;
+    }
+
+    // entry: save callee saved registers, keeping the stack 16 byte aligned
+    // for helper calls, then jump to the requested instruction
+    EMIT(&as, 0x53);              // push rbx
+    EMIT(&as, 0x41, 0x54);        // push r12
+    EMIT(&as, 0x41, 0x55);        // push r13
+    EMIT(&as, 0x49, 0x89, 0xFD);  // mov r13, rdi
+    EMIT(&as, 0x49, 0x89, 0xF4);  // mov r12, rsi
+    EMIT(&as, 0xFF, 0xE2);        // jmp rdx
+
+    for (int offset = 0; offset < chunk->count;) {
+        int length = chunk_instruction_length(chunk, offset);
+        entries[offset] = (uint32_t)as.count;
+        translate_instruction(&as, chunk, offset, length);
+        offset += length;
+    }
+
+    // every chunk ends in OP_RETURN, which exits, so control never falls
+    // through to the error path
+    int error_exit = as.count;
+    EMIT(&as, 0xB8);  // mov eax, imm32
+    emit_u32(&as, (uint32_t)JIT_ERROR);
+    emit_epilogue(&as);
+
+    for (int i = 0; i < as.fixup_count; i++) {
+        Fixup* fixup = &as.fixups[i];
+        int target = fixup->target_offset == ERROR_EXIT
+                         ? error_exit
+                         : (int)entries[fixup->target_offset];
+        int32_t rel = target - (fixup->position + 4);
+        memcpy(as.code + fixup->position, &rel, 4);
+    }
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)as.count + page_size - 1) / page_size * page_size;
+    uint8_t* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free(as.code);
+        free(as.fixups);
+        free(entries);
+        return false;
+    }
+
+    memcpy(memory, as.code, as.count);
+    free(as.code);
+    free(as.fixups);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        free(entries);
+        return false;
+    }
+
+    JitCode* code = malloc(sizeof(JitCode));
+    if (!code) {
+        munmap(memory, size);
+        free(entries);
+        return false;
+    }
+
+    code->memory = memory;
+    code->size = size;
+    code->entries = entries;
+    code->entry_count = chunk->count;
+    function->jit = code;
+    return true;
+}
+
+JitResult jit_run(VM* vm, CallFrame* frame) {
+    ObjFunction* function = frame->closure->function;
+    JitCode* code = function->jit;
+    int offset = (int)(frame->ip - function->chunk.code);
+    ASSERT(offset < code->entry_count, "frame->ip is inside of the chunk");
+
+    // ISO C has no conversion from data to function pointers
+    JitEntry entry;
+    memcpy(&entry, &code->memory, sizeof(entry));
+    return (JitResult)entry(vm, frame, code->memory + code->entries[offset]);
+}
+
+void jit_free(JitCode* code) {
+    if (!code) {
+        return;
+    }
+
+    munmap(code->memory, code->size);
+    free(code->entries);
+    free(code);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "config.h"
+#include "object.h"
+#include "vm.h"
+
+#ifdef ENABLE_JIT
+
+// calls plus loop iterations a function needs before it gets compiled
+#define JIT_THRESHOLD 1000
+
+typedef enum JitResult {
+    // reached an instruction the JIT can't compile, frame->ip points at it
+    JIT_EXIT,
+    JIT_ERROR,
+} JitResult;
+
+typedef struct JitCode JitCode;
+
+// translates the function's chunk to machine code, instructions that can't
+// be translated hand control back to the interpreter
+bool jit_compile(ObjFunction* function);
+// runs the compiled code of the frame's function starting at frame->ip
+JitResult jit_run(VM* vm, CallFrame* frame);
+void jit_free(JitCode* code);
+
+#endif
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "list.h"
+#include "memory.h"
+#include "native.h"
+#include "script.h"
+#include "vm.h"
+
+static ObjList* receiver(Value* args) {
+    ASSERT(IS_LIST(args[-1]), "list methods are only called on lists");
+    return AS_LIST(args[-1]);
+}
+
+// a whole number between 0 and the list's length, both included
+static bool bound(VM* vm, Value* args, int index, ObjList* list, int* result) {
+    double number;
+    if (!native_number(vm, args, index, &number)) {
+        return false;
+    }
+    if (number < 0 || number > list->items.count || number != (int)number) {
+        return native_error(vm, "slice bound %g out of range for length %d",
+                            number, list->items.count);
+    }
+    *result = (int)number;
+    return true;
+}
+
+static bool push_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    UNUSED(result);
+    // the value stays on the stack while the items grow
+    value_array_write(vm, &receiver(args)->items, args[0]);
+    return true;
+}
+
+static bool pop_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    ObjList* list = receiver(args);
+    if (list->items.count == 0) {
+        return native_error(vm, "can't pop from an empty list");
+    }
+    *result = list->items.values[--list->items.count];
+    return true;
+}
+
+static bool len_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    *result = NUMBER_VAL(receiver(args)->items.count);
+    return true;
+}
+
+// slice(start) or slice(start, end), a new list of the items from start up
+// to but not including end
+static bool slice_native(VM* vm, int arg_count, Value* args, Value* result) {
+    ObjList* list = receiver(args);
+    if (arg_count != 1 && arg_count != 2) {
+        return native_error(vm, "expected 1 or 2 arguments, got %d",
+                            arg_count);
+    }
+
+    int start = 0;
+    int end = list->items.count;
+    if (!bound(vm, args, 0, list, &start) ||
+        (arg_count == 2 && !bound(vm, args, 1, list, &end))) {
+        return false;
+    }
+    if (end < start) {
+        return native_error(vm, "slice end %d is before its start %d", end,
+                            start);
+    }
+
+    int count = end - start;
+    ObjList* slice = list_new(vm, count);
+    if (count > 0) {
+        memcpy(slice->items.values, list->items.values + start,
+               sizeof(Value) * count);
+    }
+    slice->items.count = count;
+    *result = OBJ_VAL(slice);
+    return true;
+}
+
+static int compare_numbers(const void* a, const void* b) {
+    double x = AS_NUMBER(*(const Value*)a);
+    double y = AS_NUMBER(*(const Value*)b);
+    return (x > y) - (x < y);
+}
+
+static int compare_strings(const void* a, const void* b) {
+    ObjString* x = AS_STRING(*(const Value*)a);
+    ObjString* y = AS_STRING(*(const Value*)b);
+    int length = x->len < y->len ? x->len : y->len;
+    int order = memcmp(x->chars, y->chars, length);
+    return order != 0 ? order : (x->len > y->len) - (x->len < y->len);
+}
+
+// sorts the list in place, its items must be all numbers or all strings
+static bool sort_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    UNUSED(result);
+    ObjList* list = receiver(args);
+    if (list->items.count < 2) {
+        return true;
+    }
+
+    bool numbers = IS_NUMBER(list->items.values[0]);
+    for (int i = 0; i < list->items.count; i++) {
+        Value item = list->items.values[i];
+        if (numbers ? !IS_NUMBER(item) : !IS_STRING(item)) {
+            return native_error(
+                vm, "can only sort lists of numbers or lists of strings");
+        }
+    }
+
+    qsort(list->items.values, list->items.count, sizeof(Value),
+          numbers ? compare_numbers : compare_strings);
+    return true;
+}
+
+ObjClass* list_class_new(VM* vm) {
+    ObjClass* klass = class_new(vm, shared_string(vm, "List", 4));
+    push(vm, OBJ_VAL(klass));
+    class_define_native(vm, klass, "push", push_native, 1);
+    class_define_native(vm, klass, "pop", pop_native, 0);
+    class_define_native(vm, klass, "len", len_native, 0);
+    class_define_native(vm, klass, "slice", slice_native, -1);
+    class_define_native(vm, klass, "sort", sort_native, 0);
+    pop(vm);
+    return klass;
+}
@@ -0,0 +1,9 @@
+#ifndef clox_list_h
+#define clox_list_h
+
+#include "object.h"
+
+// the class lists look their methods up in: push, pop, len, slice and sort
+ObjClass* list_class_new(VM* vm);
+
+#endif
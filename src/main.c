@@ -4,12 +4,13 @@
 
 #include "assert.h"
 #include "chunk.h"
+#include "clox.h"
 #include "common.h"
 #include "compiling/scanner.h"
 #include "debug.h"
-#include "vm.h"
+#include "profiler.h"
 
-static void repl(void) {
+static void repl(VM* vm) {
     char line[1024] = {0};
     for (;;) {
         printf("> ");
@@ -18,7 +19,7 @@ static void repl(void) {
             break;
         }
 
-        interpret(line);
+        vm_interpret(vm, line);
     }
 }
 
@@ -51,9 +52,9 @@ static char* read_file(const char* path) {
     return buffer;
 }
 
-static void run_file(const char* path) {
+static void run_file(VM* vm, const char* path) {
     char* source = read_file(path);
-    InterpretResult result = interpret(source);
+    InterpretResult result = vm_interpret(vm, source);
     free(source);
 
     switch (result) {
@@ -88,20 +89,48 @@ static void test_scanning(const char* path) {
     free(source);
 }
 
+#define PROFILE_FLAG "--profile"
+#define DEFAULT_PROFILE_PATH "clox.folded"
+
 int main(int argc, const char* argv[]) {
-    init_vm();
+    // --profile[=<path>] has to come before the other arguments
+    if (argc > 1 &&
+        strncmp(argv[1], PROFILE_FLAG, strlen(PROFILE_FLAG)) == 0) {
+        const char* path = argv[1] + strlen(PROFILE_FLAG);
+        if (*path == '=') {
+            path++;
+        } else if (*path == '\0') {
+            path = DEFAULT_PROFILE_PATH;
+        } else {
+            fprintf(stderr, "Usage: clox [--profile[=path]] [path] [scan]\n");
+            exit(64);
+        }
+
+        if (!profiler_start(path)) {
+            fprintf(stderr, "could not start the profiler\n");
+            exit(70);
+        }
+        argc--;
+        argv++;
+    }
+
+    VM* vm = vm_new();
+    if (vm == NULL) {
+        fprintf(stderr, "not enough memory to start the vm\n");
+        exit(70);
+    }
 
     if (argc == 1) {
-        repl();
+        repl(vm);
     } else if (argc == 2) {
-        run_file(argv[1]);
+        run_file(vm, argv[1]);
     } else if ((argc == 3) && (strcmp(argv[2], "scan") == 0)) {
         test_scanning(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path] [scan]\n");
+        fprintf(stderr, "Usage: clox [--profile[=path]] [path] [scan]\n");
         exit(64);
     }
 
-    free_vm();
+    vm_free(vm);
     return 0;
 }
@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "assert.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "script.h"
+#include "vm.h"
+
+#define MAP_MAX_LOAD 0.75
+
+#define EMPTY_KEY OBJ_VAL(NULL)
+
+static uint32_t hash_bits(uint64_t bits) {
+    // the finalizer of MurmurHash3, so nearby numbers spread out
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hash_value(Value value) {
+    switch (value.type) {
+        case VAL_NIL:
+            return 1;
+        case VAL_BOOL:
+            return AS_BOOL(value) ? 3 : 5;
+        case VAL_NUMBER: {
+            // -0 == 0, so they need the same hash
+            double number = AS_NUMBER(value) == 0 ? 0 : AS_NUMBER(value);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return hash_bits(bits);
+        }
+        case VAL_OBJ:
+            // strings are interned, so only strings with the same characters
+            // are equal
+            if (IS_STRING(value)) {
+                return AS_STRING(value)->hash;
+            }
+            // equal bound methods can be different objects
+            if (IS_BOUND_METHOD(value)) {
+                ObjBoundMethod* bound = AS_BOUND_METHOD(value);
+                return hash_value(bound->receiver) ^
+                       hash_bits((uint64_t)(uintptr_t)bound->method);
+            }
+            return hash_bits((uint64_t)(uintptr_t)AS_OBJ(value));
+    }
+
+    UNREACHABLE("encountered an unknown value type");
+}
+
+// capacity is a power of two, so the index wraps with a mask
+static MapEntry* find_entry(MapEntry* entries, int capacity, Value key) {
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = hash_value(key) & mask;
+    MapEntry* tombstone = NULL;
+    for (;;) {
+        MapEntry* entry = &entries[index];
+        if (!map_entry_used(entry)) {
+            if (IS_NIL(entry->value)) {
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL) {
+                tombstone = entry;
+            }
+        } else if (values_equal(entry->key, key)) {
+            return entry;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+static void adjust_capacity(VM* vm, ObjMap* map, int new_capacity) {
+    MapEntry* entries = ALLOCATE(vm, MapEntry, new_capacity);
+    for (int i = 0; i < new_capacity; i++) {
+        entries[i].key = EMPTY_KEY;
+        entries[i].value = NIL_VAL;
+    }
+
+    // tombstones aren't copied
+    map->count = 0;
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* src_entry = &map->entries[i];
+        if (!map_entry_used(src_entry)) {
+            continue;
+        }
+
+        MapEntry* dest_entry =
+            find_entry(entries, new_capacity, src_entry->key);
+        *dest_entry = *src_entry;
+        map->count++;
+    }
+
+    FREE_ARRAY(vm, MapEntry, map->entries, map->capacity);
+    map->entries = entries;
+    map->capacity = new_capacity;
+}
+
+bool map_check_key(VM* vm, Value key) {
+    // NaN isn't equal to itself, so it could never be found again
+    if (IS_NUMBER(key) && AS_NUMBER(key) != AS_NUMBER(key)) {
+        runtime_error(vm, "NaN can't be a map key");
+        return false;
+    }
+    return true;
+}
+
+bool map_get(ObjMap* map, Value key, Value* value) {
+    if (map->size == 0) {
+        return false;
+    }
+
+    MapEntry* entry = find_entry(map->entries, map->capacity, key);
+    if (!map_entry_used(entry)) {
+        return false;
+    }
+
+    *value = entry->value;
+    return true;
+}
+
+bool map_set(VM* vm, ObjMap* map, Value key, Value value) {
+    if (map->count + 1 > map->capacity * MAP_MAX_LOAD) {
+        adjust_capacity(vm, map, GROW_CAPACITY(map->capacity));
+    }
+
+    MapEntry* entry = find_entry(map->entries, map->capacity, key);
+    bool is_new_key = !map_entry_used(entry);
+    if (is_new_key) {
+        map->size++;
+        // reusing a tombstone doesn't change the load
+        if (IS_NIL(entry->value)) {
+            map->count++;
+        }
+    }
+
+    entry->key = key;
+    entry->value = value;
+    return is_new_key;
+}
+
+bool map_delete(ObjMap* map, Value key) {
+    if (map->size == 0) {
+        return false;
+    }
+
+    MapEntry* entry = find_entry(map->entries, map->capacity, key);
+    if (!map_entry_used(entry)) {
+        return false;
+    }
+
+    // place a tombstone
+    entry->key = EMPTY_KEY;
+    entry->value = BOOL_VAL(true);
+    map->size--;
+    return true;
+}
+
+static ObjMap* receiver(Value* args) {
+    ASSERT(IS_MAP(args[-1]), "map methods are only called on maps");
+    return AS_MAP(args[-1]);
+}
+
+static bool size_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    *result = NUMBER_VAL(receiver(args)->size);
+    return true;
+}
+
+static bool has_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    Value value;
+    *result = BOOL_VAL(map_get(receiver(args), args[0], &value));
+    return true;
+}
+
+// returns whether the key was in the map
+static bool remove_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
+    UNUSED(arg_count);
+    *result = BOOL_VAL(map_delete(receiver(args), args[0]));
+    return true;
+}
+
+// a list of the keys, or of the values, in the order the entries are stored
+static Value entries_list(VM* vm, ObjMap* map, bool keys) {
+    ObjList* list = list_new(vm, map->size);
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (map_entry_used(entry)) {
+            list->items.values[list->items.count++] =
+                keys ? entry->key : entry->value;
+        }
+    }
+    return OBJ_VAL(list);
+}
+
+static bool keys_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    *result = entries_list(vm, receiver(args), true);
+    return true;
+}
+
+static bool values_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(arg_count);
+    *result = entries_list(vm, receiver(args), false);
+    return true;
+}
+
+ObjClass* map_class_new(VM* vm) {
+    ObjClass* klass = class_new(vm, shared_string(vm, "Map", 3));
+    push(vm, OBJ_VAL(klass));
+    class_define_native(vm, klass, "size", size_native, 0);
+    class_define_native(vm, klass, "has", has_native, 1);
+    class_define_native(vm, klass, "remove", remove_native, 1);
+    class_define_native(vm, klass, "keys", keys_native, 0);
+    class_define_native(vm, klass, "values", values_native, 0);
+    pop(vm);
+    return klass;
+}
@@ -0,0 +1,17 @@
+#ifndef clox_map_h
+#define clox_map_h
+
+#include "object.h"
+
+// reports an error and returns false if key can't be a map key
+bool map_check_key(VM* vm, Value key);
+bool map_get(ObjMap* map, Value key, Value* value);
+// returns true if the key is new. the key must have been checked
+bool map_set(VM* vm, ObjMap* map, Value key, Value value);
+bool map_delete(ObjMap* map, Value key);
+
+// the class maps look their methods up in: size, has, remove, keys and
+// values
+ObjClass* map_class_new(VM* vm);
+
+#endif
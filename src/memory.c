@@ -2,6 +2,7 @@
 #include "assert.h"
 #include "compiling/compiler.h"
 #include "config.h"
+#include "jit.h"
 #include "object.h"
 #include "vm.h"
 
@@ -12,16 +13,18 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size) {
-    vm.bytes_allocated += new_size - old_size;
+void* reallocate(VM* vm, void* pointer, size_t old_size, size_t new_size) {
+    if (vm != NULL) {
+        vm->bytes_allocated += new_size - old_size;
 
-    if (new_size > old_size) {
+        if (new_size > old_size) {
 #ifdef DEBUG_STRESS_GC
-        collect_garbage();
+            collect_garbage(vm);
 #endif
 
-        if (vm.bytes_allocated > vm.next_gc) {
-            collect_garbage();
+            if (vm->bytes_allocated > vm->next_gc) {
+                collect_garbage(vm);
+            }
         }
     }
 
@@ -35,72 +38,107 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size) {
     return result;
 }
 
-static void free_object(Obj* object) {
+static void free_object(VM* vm, Obj* object) {
 #ifdef DEBUG_LOG_GC
     printf("%p free type %d\n", (void*)object, object->type);
 #endif
     switch (object->type) {
         case OBJ_BOUND_METHOD:
-            FREE(ObjBoundMethod, object);
+            FREE(vm, ObjBoundMethod, object);
+            break;
+        case OBJ_BUFFER: {
+            ObjBuffer* buffer = (ObjBuffer*)object;
+            FREE_ARRAY(vm, uint8_t, buffer->allocation,
+                       buffer_allocation_size(buffer->type, buffer->count));
+            FREE(vm, ObjBuffer, object);
             break;
+        }
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
-            table_free(&klass->methods);
-            FREE(ObjClass, object);
+            table_free(vm, &klass->methods);
+            value_array_free(vm, &klass->vtable);
+            FREE(vm, ObjClass, object);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            table_free(&instance->fields);
-            FREE(ObjInstance, object);
+            table_free(vm, &instance->fields);
+            if (object->is_foreign) {
+                ObjForeign* foreign = (ObjForeign*)object;
+                if (foreign->data != NULL && foreign->type->finalize != NULL) {
+                    foreign->type->finalize(foreign->data);
+                }
+                FREE(vm, ObjForeign, object);
+            } else {
+                FREE(vm, ObjInstance, object);
+            }
             break;
         }
         case OBJ_CLOSURE: {
-            FREE(ObjClosure, object);
+            ObjClosure* closure = (ObjClosure*)object;
+            FREE_ARRAY(vm, ObjUpvalue*, closure->upvalues,
+                       closure->upvalue_count);
+            FREE(vm, ObjClosure, object);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
-            chunk_free(&function->chunk);
-            FREE(ObjFunction, object);
+            chunk_free(vm, &function->chunk);
+#ifdef ENABLE_JIT
+            jit_free(function->jit);
+#endif
+            FREE(vm, ObjFunction, object);
+            break;
+        }
+        case OBJ_LIST: {
+            value_array_free(vm, &((ObjList*)object)->items);
+            FREE(vm, ObjList, object);
+            break;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            FREE_ARRAY(vm, MapEntry, map->entries, map->capacity);
+            FREE(vm, ObjMap, object);
             break;
         }
         case OBJ_NATIVE: {
-            FREE(ObjNative, object);
+            FREE(vm, ObjNative, object);
             break;
         }
+        case OBJ_RANGE:
+            FREE(vm, ObjRange, object);
+            break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->len + 1);
-            FREE(ObjString, object);
+            FREE_ARRAY(vm, char, string->chars, string->len + 1);
+            FREE(vm, ObjString, object);
             break;
         }
         case OBJ_UPVALUE: {
-            ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalue_count);
-            FREE(ObjUpvalue, object);
+            FREE(vm, ObjUpvalue, object);
             break;
         }
     }
 }
 
-void free_objects(void) {
-    Obj* curr_obj = vm.objects;
+void free_objects(VM* vm) {
+    Obj* curr_obj = vm->objects;
     while (curr_obj) {
         Obj* next_obj = curr_obj->next;
-        free_object(curr_obj);
+        free_object(vm, curr_obj);
         curr_obj = next_obj;
     }
 
-    free(vm.gray_stack);
+    free(vm->gray_stack);
 }
 
-void mark_object(Obj* obj) {
+void mark_object(VM* vm, Obj* obj) {
     if (obj == NULL) {
         return;
     }
 
-    if (obj->is_marked) {
+    // frozen objects only reference other frozen objects
+    if (obj->is_marked || obj->is_frozen) {
         return;
     }
 
@@ -112,53 +150,56 @@ void mark_object(Obj* obj) {
 
     obj->is_marked = true;
 
-    if (vm.gray_capacity < vm.gray_count + 1) {
-        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
-        vm.gray_stack =
-            (Obj**)realloc(vm.gray_stack, sizeof(Obj*) * vm.gray_capacity);
+    if (vm->gray_capacity < vm->gray_count + 1) {
+        vm->gray_capacity = GROW_CAPACITY(vm->gray_capacity);
+        vm->gray_stack =
+            (Obj**)realloc(vm->gray_stack, sizeof(Obj*) * vm->gray_capacity);
     }
 
-    if (!vm.gray_stack) {
+    if (!vm->gray_stack) {
         exit(1);
     }
 
-    vm.gray_stack[vm.gray_count++] = obj;
+    vm->gray_stack[vm->gray_count++] = obj;
 }
 
-static void mark_roots(void) {
-    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
-        mark_value(*slot);
+static void mark_roots(VM* vm) {
+    for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+        mark_value(vm, *slot);
     }
 
-    for (int i = 0; i < vm.frame_count; i++) {
-        mark_object((Obj*)vm.frames[i].closure);
+    for (int i = 0; i < vm->frame_count; i++) {
+        mark_object(vm, (Obj*)vm->frames[i].closure);
     }
 
-    for (ObjUpvalue* upvalue = vm.open_upvalues; upvalue != NULL;
-         upvalue = upvalue->next) {
-        mark_object((Obj*)upvalue);
+    for (int i = 0; i < vm->open_top; i++) {
+        mark_object(vm, (Obj*)vm->open_upvalues[i]);
     }
 
-    mark_table(&vm.globals);
+    mark_table(vm, &vm->globals);
 
-    mark_compiler_roots();
+    mark_compiler_roots(vm);
 
-    mark_object((Obj*)vm.init_string);
+    mark_object(vm, (Obj*)vm->init_string);
+    mark_object(vm, (Obj*)vm->list_class);
+    mark_object(vm, (Obj*)vm->map_class);
+    mark_object(vm, (Obj*)vm->float64_array_class);
+    mark_object(vm, (Obj*)vm->byte_buffer_class);
 }
 
-void mark_value(Value value) {
+void mark_value(VM* vm, Value value) {
     if (IS_OBJ(value)) {
-        mark_object(AS_OBJ(value));
+        mark_object(vm, AS_OBJ(value));
     }
 }
 
-static void mark_array(ValueArray* array) {
+static void mark_array(VM* vm, ValueArray* array) {
     for (int i = 0; i < array->count; i++) {
-        mark_value(array->values[i]);
+        mark_value(vm, array->values[i]);
     }
 }
 
-static void blacken_object(Obj* obj) {
+static void blacken_object(VM* vm, Obj* obj) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)obj);
     value_print(OBJ_VAL(obj));
@@ -168,58 +209,82 @@ static void blacken_object(Obj* obj) {
     switch (obj->type) {
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* bound = (ObjBoundMethod*)obj;
-            mark_value(bound->receiver);
-            mark_object((Obj*)bound->method);
+            mark_value(vm, bound->receiver);
+            mark_object(vm, (Obj*)bound->method);
             break;
         }
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)obj;
-            mark_object((Obj*)klass->name);
-            mark_table(&klass->methods);
+            mark_object(vm, (Obj*)klass->name);
+            mark_table(vm, &klass->methods);
+            mark_array(vm, &klass->vtable);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)obj;
-            mark_object((Obj*)instance->klass);
-            mark_table(&instance->fields);
+            mark_object(vm, (Obj*)instance->klass);
+            mark_table(vm, &instance->fields);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)obj;
 
-            mark_object((Obj*)closure->function);
+            mark_object(vm, (Obj*)closure->function);
 
             for (int i = 0; i < closure->upvalue_count; i++) {
-                mark_object((Obj*)closure->upvalues[i]);
+                mark_object(vm, (Obj*)closure->upvalues[i]);
             }
 
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)obj;
-            mark_object((Obj*)function->name);
-            mark_array(&function->chunk.constants);
+            mark_object(vm, (Obj*)function->name);
+            mark_object(vm, (Obj*)function->closure);
+            mark_array(vm, &function->chunk.constants);
+            // keeps a cached class from being freed and another allocated at
+            // its address, which would hit the cache
+            Chunk* chunk = &function->chunk;
+            if (chunk->invoke_caches != NULL) {
+                for (int i = 0; i < chunk->invoke_cache_count; i++) {
+                    mark_object(vm, (Obj*)chunk->invoke_caches[i].klass);
+                }
+            }
+            break;
+        }
+        case OBJ_LIST:
+            mark_array(vm, &((ObjList*)obj)->items);
+            break;
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)obj;
+            for (int i = 0; i < map->capacity; i++) {
+                mark_value(vm, map->entries[i].key);
+                mark_value(vm, map->entries[i].value);
+            }
             break;
         }
         case OBJ_UPVALUE:
-            mark_value(((ObjUpvalue*)obj)->closed);
+            mark_value(vm, ((ObjUpvalue*)obj)->closed);
             break;
+        // a buffer's elements are opaque numbers
+        case OBJ_BUFFER:
         case OBJ_NATIVE:
+        case OBJ_RANGE:
         case OBJ_STRING:
             break;
     }
 }
 
-static void trace_references(void) {
-    while (vm.gray_count > 0) {
-        Obj* obj = vm.gray_stack[--vm.gray_count];
-        blacken_object(obj);
+static void trace_references(VM* vm) {
+    while (vm->gray_count > 0) {
+        Obj* obj = vm->gray_stack[--vm->gray_count];
+        blacken_object(vm, obj);
     }
 }
 
-static void sweep() {
+static void sweep(VM* vm) {
     Obj* previous = NULL;
-    Obj* object = vm.objects;
+    Obj* object = vm->objects;
     while (object) {
         if (object->is_marked) {
             object->is_marked = false;
@@ -231,30 +296,37 @@ static void sweep() {
             if (previous) {
                 previous->next = object;
             } else {
-                vm.objects = object;
+                vm->objects = object;
             }
 
-            free_object(unreached);
+            free_object(vm, unreached);
         }
     }
 }
 
-void collect_garbage(void) {
+void collect_garbage(VM* vm) {
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
-    size_t before = vm.bytes_allocated;
+    size_t before = vm->bytes_allocated;
 #endif
 
-    mark_roots();
-    trace_references();
-    table_remove_white(&vm.strings);
-    sweep();
+    mark_roots(vm);
+    trace_references(vm);
+    table_remove_white(&vm->strings);
+    for (int i = 0; i < BOUND_METHOD_CACHE; i++) {
+        ObjBoundMethod* bound = vm->bound_methods[i];
+        if (bound != NULL && !bound->obj.is_marked) {
+            vm->bound_methods[i] = NULL;
+        }
+    }
+    sweep(vm);
 
-    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    vm->next_gc = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+           before - vm->bytes_allocated, before, vm->bytes_allocated,
+           vm->next_gc);
 #endif
 }
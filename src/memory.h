@@ -6,23 +6,25 @@
 #include "common.h"
 #include "object.h"
 
-#define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(vm, type, count) \
+    (type*)reallocate(vm, NULL, 0, sizeof(type) * (count))
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, old_count, new_count)    \
-    (type*)reallocate(pointer, sizeof(type) * (old_count), \
+#define GROW_ARRAY(vm, type, pointer, old_count, new_count)    \
+    (type*)reallocate(vm, pointer, sizeof(type) * (old_count), \
                       sizeof(type) * (new_count))
 
-#define FREE_ARRAY(type, pointer, old_count) \
-    (type*)reallocate(pointer, sizeof(type) * (old_count), 0)
+#define FREE_ARRAY(vm, type, pointer, old_count) \
+    (type*)reallocate(vm, pointer, sizeof(type) * (old_count), 0)
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size);
-void mark_object(Obj* obj);
-void mark_value(Value value);
-void collect_garbage(void);
-void free_objects(void);
+// a NULL vm allocates outside of any vm's heap, for frozen objects
+void* reallocate(VM* vm, void* pointer, size_t old_size, size_t new_size);
+void mark_object(VM* vm, Obj* obj);
+void mark_value(VM* vm, Value value);
+void collect_garbage(VM* vm);
+void free_objects(VM* vm);
 
 #endif
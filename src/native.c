@@ -0,0 +1,159 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "native.h"
+#include "object.h"
+#include "script.h"
+#include "vm.h"
+
+// longer messages are cut off
+#define ERROR_MAX 256
+
+// defines name in the table while both objects are on the stack, out of the
+// gc's reach
+static void define(VM* vm, Table* table, const char* name, Obj* obj) {
+    push(vm, OBJ_VAL(obj));
+    ObjString* key = shared_string(vm, name, (int)strlen(name));
+    push(vm, OBJ_VAL(key));
+    table_set(vm, table, key, OBJ_VAL(obj));
+    pop(vm);
+    pop(vm);
+}
+
+void vm_define_native(VM* vm, const char* name, NativeFn function, int arity) {
+    define(vm, &vm->globals, name, (Obj*)native_new(vm, function, arity));
+}
+
+void vm_define_foreign_class(VM* vm, const ForeignType* type) {
+    ObjString* name = shared_string(vm, type->name, (int)strlen(type->name));
+    ObjClass* klass = class_new(vm, name);
+    klass->foreign = type;
+    define(vm, &vm->globals, type->name, (Obj*)klass);
+}
+
+void class_define_native(VM* vm,
+                         ObjClass* klass,
+                         const char* name,
+                         NativeFn function,
+                         int arity) {
+    push(vm, OBJ_VAL(native_new(vm, function, arity)));
+    ObjString* key = shared_string(vm, name, (int)strlen(name));
+    push(vm, OBJ_VAL(key));
+    class_set_method(vm, klass, key, vm->stack_top[-2]);
+    pop(vm);
+    pop(vm);
+}
+
+bool vm_define_method(VM* vm,
+                      const char* class_name,
+                      const char* name,
+                      NativeFn function,
+                      int arity) {
+    ObjString* key = shared_string(vm, class_name, (int)strlen(class_name));
+    Value klass;
+    if (!table_get(&vm->globals, key, &klass) || !IS_CLASS(klass)) {
+        return false;
+    }
+
+    class_define_native(vm, AS_CLASS(klass), name, function, arity);
+    return true;
+}
+
+Value vm_string(VM* vm, const char* chars, int length) {
+    return OBJ_VAL(copy_string(vm, chars, length));
+}
+
+bool native_error(VM* vm, const char* format, ...) {
+    char message[ERROR_MAX];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    runtime_error(vm, "%s", message);
+    return false;
+}
+
+static bool type_error(VM* vm, int index, const char* expected) {
+    if (index == -1) {
+        return native_error(vm, "the receiver must be %s", expected);
+    }
+    return native_error(vm, "argument %d must be %s", index + 1, expected);
+}
+
+bool native_number(VM* vm, Value* args, int index, double* number) {
+    if (!IS_NUMBER(args[index])) {
+        return type_error(vm, index, "a number");
+    }
+    *number = AS_NUMBER(args[index]);
+    return true;
+}
+
+bool native_bool(VM* vm, Value* args, int index, bool* boolean) {
+    if (!IS_BOOL(args[index])) {
+        return type_error(vm, index, "a boolean");
+    }
+    *boolean = AS_BOOL(args[index]);
+    return true;
+}
+
+bool native_string(VM* vm,
+                   Value* args,
+                   int index,
+                   const char** chars,
+                   int* length) {
+    if (!IS_STRING(args[index])) {
+        return type_error(vm, index, "a string");
+    }
+    ObjString* string = AS_STRING(args[index]);
+    *chars = string->chars;
+    *length = string->len;
+    return true;
+}
+
+static ObjForeign* as_foreign(VM* vm,
+                              Value* args,
+                              int index,
+                              const ForeignType* type) {
+    Value value = args[index];
+    if (!IS_INSTANCE(value) || !AS_OBJ(value)->is_foreign ||
+        AS_FOREIGN(value)->type != type) {
+        char expected[ERROR_MAX];
+        snprintf(expected, sizeof(expected), "an instance of %s", type->name);
+        type_error(vm, index, expected);
+        return NULL;
+    }
+    return AS_FOREIGN(value);
+}
+
+bool native_foreign(VM* vm,
+                    Value* args,
+                    int index,
+                    const ForeignType* type,
+                    void** data) {
+    ObjForeign* foreign = as_foreign(vm, args, index, type);
+    if (foreign == NULL) {
+        return false;
+    }
+    *data = foreign->data;
+    return true;
+}
+
+bool native_set_foreign(VM* vm,
+                        Value* args,
+                        int index,
+                        const ForeignType* type,
+                        void* data) {
+    ObjForeign* foreign = as_foreign(vm, args, index, type);
+    if (foreign == NULL) {
+        return false;
+    }
+    if (foreign->data != NULL && foreign->data != data &&
+        type->finalize != NULL) {
+        type->finalize(foreign->data);
+    }
+    foreign->data = data;
+    return true;
+}
@@ -0,0 +1,13 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "object.h"
+
+// adds a native method to klass, which must be reachable by the gc
+void class_define_native(VM* vm,
+                         ObjClass* klass,
+                         const char* name,
+                         NativeFn function,
+                         int arity);
+
+#endif
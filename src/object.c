@@ -11,15 +11,18 @@
 #define FNV_OFFSET_BASIS 2166136261u
 #define FNV_PRIME 16777619
 
-#define ALLOCATE_OBJ(type, obj_type) (type*)allocate_obj(sizeof(type), obj_type)
+#define ALLOCATE_OBJ(vm, type, obj_type) \
+    (type*)allocate_obj(vm, sizeof(type), obj_type)
 
-static Obj* allocate_obj(size_t size, ObjType type) {
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
+static Obj* allocate_obj(VM* vm, size_t size, ObjType type) {
+    Obj* obj = (Obj*)reallocate(vm, NULL, 0, size);
     obj->type = type;
     obj->is_marked = false;
+    obj->is_frozen = false;
+    obj->is_foreign = false;
 
-    obj->next = vm.objects;
-    vm.objects = obj;
+    obj->next = vm->objects;
+    vm->objects = obj;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -28,21 +31,24 @@ static Obj* allocate_obj(size_t size, ObjType type) {
     return obj;
 }
 
-static ObjString* allocate_string_obj(char* chars, int len, uint32_t hash) {
-    ObjString* string_obj = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocate_string_obj(VM* vm,
+                                      char* chars,
+                                      int len,
+                                      uint32_t hash) {
+    ObjString* string_obj = ALLOCATE_OBJ(vm, ObjString, OBJ_STRING);
 
     string_obj->len = len;
     string_obj->chars = chars;
     string_obj->hash = hash;
 
-    push(OBJ_VAL(string_obj));
-    table_set(&vm.strings, string_obj, NIL_VAL);
-    pop();
+    push(vm, OBJ_VAL(string_obj));
+    table_set(vm, &vm->strings, string_obj, NIL_VAL);
+    pop(vm);
 
     return string_obj;
 }
 
-static uint32_t hash_string(const char* key, int len) {
+uint32_t hash_string(const char* key, int len) {
     uint32_t hash = FNV_OFFSET_BASIS;
     for (int i = 0; i < len; i++) {
         hash ^= (uint8_t)key[i];
@@ -52,90 +58,268 @@ static uint32_t hash_string(const char* key, int len) {
     return hash;
 }
 
-ObjBoundMethod* bound_method_new(Value receiver, ObjClosure* method) {
-    ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+ObjBoundMethod* bound_method_new(VM* vm, Value receiver, Obj* method) {
+    ObjBoundMethod* bound = ALLOCATE_OBJ(vm, ObjBoundMethod, OBJ_BOUND_METHOD);
     bound->receiver = receiver;
     bound->method = method;
     return bound;
 }
 
-ObjClass* class_new(ObjString* name) {
-    ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+size_t buffer_element_size(BufferType type) {
+    return type == BUFFER_FLOAT64 ? sizeof(double) : sizeof(uint8_t);
+}
+
+// the allocation has room to align the elements
+size_t buffer_allocation_size(BufferType type, int count) {
+    return count * buffer_element_size(type) + BUFFER_ALIGNMENT - 1;
+}
+
+ObjBuffer* buffer_new(VM* vm, BufferType type, int count) {
+    ObjBuffer* buffer = ALLOCATE_OBJ(vm, ObjBuffer, OBJ_BUFFER);
+    buffer->type = type;
+    buffer->count = 0;
+    buffer->data = NULL;
+    buffer->allocation = NULL;
+
+    push(vm, OBJ_VAL(buffer));
+    buffer->allocation =
+        ALLOCATE(vm, uint8_t, buffer_allocation_size(type, count));
+    pop(vm);
+
+    uintptr_t address = (uintptr_t)buffer->allocation + BUFFER_ALIGNMENT - 1;
+    buffer->data = (void*)(address & ~(uintptr_t)(BUFFER_ALIGNMENT - 1));
+    buffer->count = count;
+    memset(buffer->data, 0, count * buffer_element_size(type));
+    return buffer;
+}
+
+ObjClass* class_new(VM* vm, ObjString* name) {
+    ObjClass* klass = ALLOCATE_OBJ(vm, ObjClass, OBJ_CLASS);
     klass->name = name;
     table_init(&klass->methods);
+    value_array_init(&klass->vtable);
+    klass->initializer = NIL_VAL;
+    klass->inherited_field_count = 0;
+    klass->field_count = 0;
+    klass->foreign = NULL;
     return klass;
 }
 
-ObjInstance* instance_new(ObjClass* klass) {
-    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+int class_method_slot(ObjClass* klass, ObjString* name) {
+    Value slot;
+    if (!table_get(&klass->methods, name, &slot)) {
+        return -1;
+    }
+    return (int)AS_NUMBER(slot);
+}
+
+bool class_get_method(ObjClass* klass, ObjString* name, Value* method) {
+    int slot = class_method_slot(klass, name);
+    if (slot == -1) {
+        return false;
+    }
+    *method = klass->vtable.values[slot];
+    return true;
+}
+
+void class_set_method(VM* vm, ObjClass* klass, ObjString* name, Value method) {
+    if (name == vm->init_string) {
+        // a redefined init replaces the fields of the one before it
+        klass->initializer = method;
+        klass->field_count = klass->inherited_field_count;
+        if (IS_CLOSURE(method)) {
+            klass->field_count += AS_CLOSURE(method)->function->field_count;
+        }
+    }
+
+    int slot = class_method_slot(klass, name);
+    if (slot != -1) {
+        klass->vtable.values[slot] = method;
+        return;
+    }
+
+    value_array_write(vm, &klass->vtable, method);
+    table_set(vm, &klass->methods, name,
+              NUMBER_VAL(klass->vtable.count - 1));
+}
+
+void class_inherit(VM* vm, ObjClass* klass, ObjClass* superclass) {
+    ASSERT(klass->vtable.count == 0, "the subclass has no methods yet");
+    for (int i = 0; i < superclass->vtable.count; i++) {
+        value_array_write(vm, &klass->vtable, superclass->vtable.values[i]);
+    }
+    table_add_all(vm, &superclass->methods, &klass->methods);
+    klass->initializer = superclass->initializer;
+    klass->inherited_field_count = superclass->field_count;
+    klass->field_count = superclass->field_count;
+}
+
+ObjInstance* instance_new(VM* vm, ObjClass* klass) {
+    ObjInstance* instance;
+    if (klass->foreign != NULL) {
+        ObjForeign* foreign = ALLOCATE_OBJ(vm, ObjForeign, OBJ_INSTANCE);
+        foreign->instance.obj.is_foreign = true;
+        foreign->type = klass->foreign;
+        foreign->data = NULL;
+        instance = &foreign->instance;
+    } else {
+        instance = ALLOCATE_OBJ(vm, ObjInstance, OBJ_INSTANCE);
+    }
     instance->klass = klass;
     table_init(&instance->fields);
+    if (klass->field_count > 0) {
+        push(vm, OBJ_VAL(instance));
+        table_reserve(vm, &instance->fields, klass->field_count);
+        pop(vm);
+    }
 
     return instance;
 }
 
-ObjClosure* closure_new(ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalue_count);
+ObjClosure* closure_new(VM* vm, ObjFunction* function) {
+    ObjUpvalue** upvalues = ALLOCATE(vm, ObjUpvalue*, function->upvalue_count);
     for (int i = 0; i < function->upvalue_count; i++) {
         upvalues[i] = NULL;
     }
 
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    ObjClosure* closure = ALLOCATE_OBJ(vm, ObjClosure, OBJ_CLOSURE);
     closure->function = function;
     closure->upvalue_count = function->upvalue_count;
     closure->upvalues = upvalues;
     return closure;
 }
 
-ObjFunction* function_new(void) {
-    ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
+// the closure of a function that reads its variables from its caller's
+// frame. it can only be called by the function declaring it, so nothing can
+// tell one such closure from another
+ObjClosure* local_function_closure(VM* vm, ObjFunction* function) {
+    if (function->closure) {
+        return function->closure;
+    }
+
+    ObjClosure* closure = ALLOCATE_OBJ(vm, ObjClosure, OBJ_CLOSURE);
+    closure->function = function;
+    closure->upvalue_count = 0;
+    closure->upvalues = NULL;
+    if (!function->obj.is_frozen) {
+        function->closure = closure;
+    }
+    return closure;
+}
+
+ObjFunction* function_new(VM* vm) {
+    ObjFunction* function = ALLOCATE_OBJ(vm, ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalue_count = 0;
+    function->max_slots = 0;
+    function->field_count = 0;
     function->name = NULL;
+    function->closure = NULL;
     chunk_init(&function->chunk);
+#ifdef ENABLE_JIT
+    function->hotness = 0;
+    function->jit = NULL;
+#endif
 
     return function;
 }
 
-ObjNative* native_new(NativeFn function, int arity) {
-    ObjNative* native_fn = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+ObjList* list_new(VM* vm, int capacity) {
+    ObjList* list = ALLOCATE_OBJ(vm, ObjList, OBJ_LIST);
+    value_array_init(&list->items);
+    if (capacity > 0) {
+        push(vm, OBJ_VAL(list));
+        list->items.values = ALLOCATE(vm, Value, capacity);
+        list->items.capacity = capacity;
+        pop(vm);
+    }
+    return list;
+}
+
+ObjMap* map_new(VM* vm) {
+    ObjMap* map = ALLOCATE_OBJ(vm, ObjMap, OBJ_MAP);
+    map->count = 0;
+    map->size = 0;
+    map->capacity = 0;
+    map->entries = NULL;
+    return map;
+}
+
+ObjNative* native_new(VM* vm, NativeFn function, int arity) {
+    ObjNative* native_fn = ALLOCATE_OBJ(vm, ObjNative, OBJ_NATIVE);
     native_fn->function = function;
     native_fn->arity = arity;
     return native_fn;
 }
 
-ObjString* copy_string(const char* src, int len) {
+ObjRange* range_new(VM* vm, double start, double end) {
+    ObjRange* range = ALLOCATE_OBJ(vm, ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->end = end;
+    return range;
+}
+
+ObjString* copy_string(VM* vm, const char* src, int len) {
     uint32_t hash = hash_string(src, len);
-    ObjString* interned = table_find_string(&vm.strings, src, len, hash);
+    ObjString* interned = table_find_string(&vm->strings, src, len, hash);
     if (interned) {
         return interned;
     }
 
     // allocate chars array the string object will point to
-    char* string = ALLOCATE(char, len + 1);
+    char* string = ALLOCATE(vm, char, len + 1);
     memcpy(string, src, len);
     string[len] = '\0';
     // then allocate the string object itself
-    return allocate_string_obj(string, len, hash);
+    return allocate_string_obj(vm, string, len, hash);
 }
 
-ObjUpvalue* upvalue_new(Value* location) {
-    ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+ObjUpvalue* upvalue_new(VM* vm, Value* location) {
+    ObjUpvalue* upvalue = ALLOCATE_OBJ(vm, ObjUpvalue, OBJ_UPVALUE);
     upvalue->location = location;
     upvalue->closed = NIL_VAL;
-    upvalue->next = NULL;
     return upvalue;
 }
 
-ObjString* take_string(char* string, int len) {
+ObjString* take_string(VM* vm, char* string, int len) {
     uint32_t hash = hash_string(string, len);
-    ObjString* interned = table_find_string(&vm.strings, string, len, hash);
+    ObjString* interned = table_find_string(&vm->strings, string, len, hash);
     if (interned) {
-        FREE_ARRAY(char, string, len);
+        FREE_ARRAY(vm, char, string, len + 1);
         return interned;
     }
 
-    return allocate_string_obj(string, len, hash);
+    return allocate_string_obj(vm, string, len, hash);
+}
+
+static void list_print(ObjList* list) {
+    printf("[");
+    for (int i = 0; i < list->items.count; i++) {
+        if (i > 0) {
+            printf(", ");
+        }
+        value_print(list->items.values[i]);
+    }
+    printf("]");
+}
+
+static void map_print(ObjMap* map) {
+    printf("{");
+    bool first = true;
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (!map_entry_used(entry)) {
+            continue;
+        }
+        if (!first) {
+            printf(", ");
+        }
+        first = false;
+        value_print(entry->key);
+        printf(": ");
+        value_print(entry->value);
+    }
+    printf("}");
 }
 
 static void function_print(ObjFunction* function) {
@@ -152,7 +336,13 @@ void obj_print(Value value) {
 
     switch (OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD:
-            function_print(AS_BOUND_METHOD(value)->method->function);
+            obj_print(OBJ_VAL(AS_BOUND_METHOD(value)->method));
+            break;
+        case OBJ_BUFFER:
+            printf("<%s of %d>",
+                   AS_BUFFER(value)->type == BUFFER_FLOAT64 ? "Float64Array"
+                                                            : "ByteBuffer",
+                   AS_BUFFER(value)->count);
             break;
         case OBJ_CLASS:
             printf("<class %s>", AS_CLASS(value)->name->chars);
@@ -167,9 +357,19 @@ void obj_print(Value value) {
         case OBJ_FUNCTION:
             function_print(AS_FUNCTION(value));
             break;
+        case OBJ_LIST:
+            list_print(AS_LIST(value));
+            break;
+        case OBJ_MAP:
+            map_print(AS_MAP(value));
+            break;
         case OBJ_NATIVE:
             printf("<native fn>");
             break;
+        case OBJ_RANGE:
+            printf("<range %g..%g>", AS_RANGE(value)->start,
+                   AS_RANGE(value)->end);
+            break;
         case OBJ_STRING:
             printf("%s", AS_CSTRING(value));
             break;
@@ -3,16 +3,21 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "config.h"
 #include "table.h"
 #include "value.h"
 
 typedef enum ObjType {
     OBJ_BOUND_METHOD,
+    OBJ_BUFFER,
     OBJ_CLASS,
     OBJ_INSTANCE,
     OBJ_CLOSURE,
     OBJ_FUNCTION,
+    OBJ_LIST,
+    OBJ_MAP,
     OBJ_NATIVE,
+    OBJ_RANGE,
     OBJ_STRING,
     OBJ_UPVALUE,
 } ObjType;
@@ -20,6 +25,11 @@ typedef enum ObjType {
 struct Obj {
     ObjType type;
     bool is_marked;
+    // belongs to a Script, shared by every vm that runs it and never written
+    // to: the gc doesn't mark or sweep it and the vm doesn't rewrite it
+    bool is_frozen;
+    // an ObjForeign rather than a plain ObjInstance
+    bool is_foreign;
     struct Obj* next;
 };
 
@@ -27,18 +37,85 @@ typedef struct ObjFunction {
     Obj obj;
     int arity;
     int upvalue_count;
+    // the most values the function has on the stack at once, counting the
+    // slot of the callee, its locals and the temporaries of its expressions
+    int max_slots;
+    // in an initializer, how many distinct fields it assigns to this
+    int field_count;
     Chunk chunk;
     ObjString* name;
+    // the closure OP_LOCAL_FUNCTION made of the function, which has no
+    // upvalues so it can be reused. never set on frozen functions
+    struct ObjClosure* closure;
+#ifdef ENABLE_JIT
+    // calls and loop iterations, the function is compiled to machine code
+    // when this reaches JIT_THRESHOLD
+    uint32_t hotness;
+    struct JitCode* jit;
+#endif
 } ObjFunction;
 
-typedef Value (*NativeFn)(int arg_count, Value* args);
+typedef struct ObjList {
+    Obj obj;
+    ValueArray items;
+} ObjList;
+
+// a key of NULL marks an unused entry, which is empty when its value is nil
+// and a tombstone otherwise
+typedef struct MapEntry {
+    Value key;
+    Value value;
+} MapEntry;
+
+// a hash table keyed by any value but NaN. keys are compared like `==` does
+typedef struct ObjMap {
+    Obj obj;
+    // entries with a key plus tombstones
+    int count;
+    // entries with a key
+    int size;
+    // a power of two
+    int capacity;
+    MapEntry* entries;
+} ObjMap;
+
+static inline bool map_entry_used(MapEntry* entry) {
+    return !IS_OBJ(entry->key) || AS_OBJ(entry->key) != NULL;
+}
+
+typedef enum BufferType {
+    BUFFER_FLOAT64,
+    BUFFER_BYTE,
+} BufferType;
+
+// alignment of a buffer's elements, enough for any vector load
+#define BUFFER_ALIGNMENT 32
+
+// a Float64Array or a ByteBuffer. its elements are raw numbers the gc never
+// looks at
+typedef struct ObjBuffer {
+    Obj obj;
+    BufferType type;
+    int count;
+    // elements, BUFFER_ALIGNMENT aligned within the allocation
+    void* data;
+    void* allocation;
+} ObjBuffer;
 
 typedef struct ObjNative {
     Obj obj;
+    // -1 for any number of arguments
     int arity;
     NativeFn function;
 } ObjNative;
 
+// the numbers from start up to but not including end, counting up by 1
+typedef struct ObjRange {
+    Obj obj;
+    double start;
+    double end;
+} ObjRange;
+
 typedef struct ObjString {
     Obj obj;
     int len;
@@ -50,7 +127,6 @@ typedef struct ObjUpvalue {
     Obj obj;
     Value* location;
     Value closed;
-    struct ObjUpvalue* next;
 } ObjUpvalue;
 
 typedef struct ObjClosure {
@@ -63,7 +139,21 @@ typedef struct ObjClosure {
 typedef struct ObjClass {
     Obj obj;
     ObjString* name;
+    // maps the name of each method to its slot in the vtable
     Table methods;
+    // the methods by slot. a slot keeps its index when the method in it is
+    // redefined, and a subclass starts out with a copy of its superclass's
+    // vtable, so a slot can be cached in place of a method lookup
+    ValueArray vtable;
+    // the init method, nil if there is none. it's in the vtable too
+    Value initializer;
+    // the field_count of the superclass, 0 without one
+    int inherited_field_count;
+    // instances start out with room for this many fields, the ones the
+    // initializers of the class and its superclasses assign
+    int field_count;
+    // instances are ObjForeign when it isn't NULL
+    const ForeignType* foreign;
 } ObjClass;
 
 typedef struct ObjInstance {
@@ -72,44 +162,79 @@ typedef struct ObjInstance {
     Table fields;
 } ObjInstance;
 
+// an instance of a foreign class, obj.is_foreign tells them apart
+typedef struct ObjForeign {
+    ObjInstance instance;
+    const ForeignType* type;
+    void* data;
+} ObjForeign;
+
 typedef struct {
     Obj obj;
     Value receiver;
-    ObjClosure* method;
+    // a closure or a native
+    Obj* method;
 } ObjBoundMethod;
 
 #define OBJ_TYPE(value_struct) (AS_OBJ(value_struct)->type)
 
-#define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_BOUND_METHOD(value) obj_is_type(value, OBJ_BOUND_METHOD)
+#define IS_BUFFER(value) obj_is_type(value, OBJ_BUFFER)
 #define IS_CLASS(value) obj_is_type(value, OBJ_CLASS)
 #define IS_INSTANCE(value) obj_is_type(value, OBJ_INSTANCE)
 #define IS_CLOSURE(obj) (obj_is_type(obj, OBJ_CLOSURE))
 #define IS_FUNCTION(obj) (obj_is_type(obj, OBJ_FUNCTION))
+#define IS_LIST(obj) (obj_is_type(obj, OBJ_LIST))
+#define IS_MAP(obj) (obj_is_type(obj, OBJ_MAP))
 #define IS_NATIVE(obj) (obj_is_type(obj, OBJ_NATIVE))
+#define IS_RANGE(obj) (obj_is_type(obj, OBJ_RANGE))
 #define IS_STRING(obj) (obj_is_type(obj, OBJ_STRING))
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_BUFFER(value) ((ObjBuffer*)AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
+#define AS_FOREIGN(value) ((ObjForeign*)AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
+#define AS_LIST(value) ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap*)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value)))
+#define AS_RANGE(value) ((ObjRange*)AS_OBJ(value))
 
 static inline bool obj_is_type(Value value, ObjType type) {
     return IS_OBJ(value) && OBJ_TYPE(value) == type;
 }
 
-ObjBoundMethod* bound_method_new(Value receiver, ObjClosure* method);
-ObjClass* class_new(ObjString* name);
-ObjInstance* instance_new(ObjClass* klass);
-ObjClosure* closure_new(ObjFunction* function);
-ObjFunction* function_new(void);
-ObjNative* native_new(NativeFn function, int arity);
-ObjString* copy_string(const char* src, int len);
-ObjUpvalue* upvalue_new(Value* location);
-ObjString* take_string(char* chars, int len);
+ObjBoundMethod* bound_method_new(VM* vm, Value receiver, Obj* method);
+// count zeroed elements
+ObjBuffer* buffer_new(VM* vm, BufferType type, int count);
+size_t buffer_element_size(BufferType type);
+size_t buffer_allocation_size(BufferType type, int count);
+ObjClass* class_new(VM* vm, ObjString* name);
+// the slot of the method called name, -1 if the class has no such method
+int class_method_slot(ObjClass* klass, ObjString* name);
+bool class_get_method(ObjClass* klass, ObjString* name, Value* method);
+// defines or redefines a method. the caller keeps name and method reachable
+void class_set_method(VM* vm, ObjClass* klass, ObjString* name, Value method);
+// gives a class that has no methods yet the methods of superclass, in the
+// same slots
+void class_inherit(VM* vm, ObjClass* klass, ObjClass* superclass);
+ObjInstance* instance_new(VM* vm, ObjClass* klass);
+ObjClosure* closure_new(VM* vm, ObjFunction* function);
+ObjClosure* local_function_closure(VM* vm, ObjFunction* function);
+ObjFunction* function_new(VM* vm);
+// an empty list with room for capacity items
+ObjList* list_new(VM* vm, int capacity);
+ObjMap* map_new(VM* vm);
+ObjNative* native_new(VM* vm, NativeFn function, int arity);
+ObjRange* range_new(VM* vm, double start, double end);
+ObjString* copy_string(VM* vm, const char* src, int len);
+ObjUpvalue* upvalue_new(VM* vm, Value* location);
+ObjString* take_string(VM* vm, char* chars, int len);
+uint32_t hash_string(const char* key, int len);
 void obj_print(Value value);
 
 #endif
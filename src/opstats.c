@@ -0,0 +1,229 @@
+#include "opstats.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef DEBUG_OPCODE_CYCLES
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+#include "chunk.h"
+
+// how many of the most executed pairs get reported
+#define REPORTED_PAIRS 30
+// log2 buckets of the cycles a single instruction took
+#define CYCLE_BUCKETS 32
+
+static const char* opcode_names[UINT8_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_NOT] = "OP_NOT",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_POP] = "OP_POP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_CALLER_LOCAL] = "OP_GET_CALLER_LOCAL",
+    [OP_SET_CALLER_LOCAL] = "OP_SET_CALLER_LOCAL",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_LOCAL_FUNCTION] = "OP_LOCAL_FUNCTION",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_BUILD_LIST] = "OP_BUILD_LIST",
+    [OP_BUILD_MAP] = "OP_BUILD_MAP",
+    [OP_GET_INDEX] = "OP_GET_INDEX",
+    [OP_SET_INDEX] = "OP_SET_INDEX",
+    [OP_ITER_INIT] = "OP_ITER_INIT",
+    [OP_ITER_NEXT] = "OP_ITER_NEXT",
+    [OP_WIDE] = "OP_WIDE",
+    [OP_MOVE] = "OP_MOVE",
+    [OP_LOADK] = "OP_LOADK",
+    [OP_ADD_RR] = "OP_ADD_RR",
+    [OP_SUBTRACT_RR] = "OP_SUBTRACT_RR",
+    [OP_MULTIPLY_RR] = "OP_MULTIPLY_RR",
+    [OP_DIVIDE_RR] = "OP_DIVIDE_RR",
+    [OP_LESS_RR] = "OP_LESS_RR",
+    [OP_GREATER_RR] = "OP_GREATER_RR",
+    [OP_ADD_RK] = "OP_ADD_RK",
+    [OP_SUBTRACT_RK] = "OP_SUBTRACT_RK",
+    [OP_MULTIPLY_RK] = "OP_MULTIPLY_RK",
+    [OP_DIVIDE_RK] = "OP_DIVIDE_RK",
+    [OP_LESS_RK] = "OP_LESS_RK",
+    [OP_GREATER_RK] = "OP_GREATER_RK",
+    [OP_ADD_RRR] = "OP_ADD_RRR",
+    [OP_SUBTRACT_RRR] = "OP_SUBTRACT_RRR",
+    [OP_MULTIPLY_RRR] = "OP_MULTIPLY_RRR",
+    [OP_DIVIDE_RRR] = "OP_DIVIDE_RRR",
+    [OP_ADD_RRK] = "OP_ADD_RRK",
+    [OP_SUBTRACT_RRK] = "OP_SUBTRACT_RRK",
+    [OP_MULTIPLY_RRK] = "OP_MULTIPLY_RRK",
+    [OP_DIVIDE_RRK] = "OP_DIVIDE_RRK",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+    [OP_GREATER_NUM] = "OP_GREATER_NUM",
+    [OP_LESS_NUM] = "OP_LESS_NUM",
+    [OP_CALL_CLOSURE] = "OP_CALL_CLOSURE",
+    [OP_CALL_NATIVE] = "OP_CALL_NATIVE",
+};
+
+typedef struct OpStats {
+    uint64_t counts[UINT8_COUNT];
+    uint64_t pair_counts[UINT8_COUNT][UINT8_COUNT];
+    // UINT8_COUNT until the first instruction runs
+    int previous;
+#ifdef DEBUG_OPCODE_CYCLES
+    uint64_t cycles[UINT8_COUNT];
+    uint64_t histograms[UINT8_COUNT][CYCLE_BUCKETS];
+    uint64_t previous_start;
+#endif
+} OpStats;
+
+static OpStats stats = {.previous = UINT8_COUNT};
+
+typedef struct Row {
+    int op;
+    int next;
+    uint64_t count;
+} Row;
+
+void opstats_record(uint8_t instruction) {
+#ifdef DEBUG_OPCODE_CYCLES
+    uint64_t now = __rdtsc();
+#endif
+
+    stats.counts[instruction]++;
+    if (stats.previous != UINT8_COUNT) {
+        stats.pair_counts[stats.previous][instruction]++;
+#ifdef DEBUG_OPCODE_CYCLES
+        // includes the dispatch and this function, which every instruction
+        // pays about equally
+        uint64_t cycles = now - stats.previous_start;
+        int bucket = 0;
+        while (bucket < CYCLE_BUCKETS - 1 && (cycles >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+        stats.cycles[stats.previous] += cycles;
+        stats.histograms[stats.previous][bucket]++;
+#endif
+    }
+    stats.previous = instruction;
+
+#ifdef DEBUG_OPCODE_CYCLES
+    stats.previous_start = __rdtsc();
+#endif
+}
+
+static int compare_rows(const void* a, const void* b) {
+    uint64_t count_a = ((const Row*)a)->count;
+    uint64_t count_b = ((const Row*)b)->count;
+    return (count_a < count_b) - (count_a > count_b);
+}
+
+static const char* name_of(int op) {
+    return opcode_names[op] ? opcode_names[op] : "OP_UNKNOWN";
+}
+
+#ifdef DEBUG_OPCODE_CYCLES
+// smallest power of two that at least `fraction` of the samples are below
+static uint64_t cycle_percentile(int op, double fraction) {
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < CYCLE_BUCKETS; bucket++) {
+        seen += stats.histograms[op][bucket];
+        if (seen >= fraction * stats.counts[op]) {
+            return (uint64_t)1 << (bucket + 1);
+        }
+    }
+    return (uint64_t)1 << CYCLE_BUCKETS;
+}
+#endif
+
+void opstats_report(void) {
+    static Row rows[UINT8_COUNT * UINT8_COUNT];
+
+    uint64_t total = 0;
+    int row_count = 0;
+    for (int op = 0; op < UINT8_COUNT; op++) {
+        if (stats.counts[op] != 0) {
+            rows[row_count++] = (Row){op, 0, stats.counts[op]};
+            total += stats.counts[op];
+        }
+    }
+    qsort(rows, row_count, sizeof(Row), compare_rows);
+
+    fprintf(stderr, "== opcodes: %llu instructions ==\n",
+            (unsigned long long)total);
+#ifdef DEBUG_OPCODE_CYCLES
+    fprintf(stderr, "%-20s %14s %7s %10s %8s %8s\n", "opcode", "count", "share",
+            "cycles/op", "p50 <=", "p99 <=");
+#else
+    fprintf(stderr, "%-20s %14s %7s\n", "opcode", "count", "share");
+#endif
+    for (int i = 0; i < row_count; i++) {
+        int op = rows[i].op;
+        fprintf(stderr, "%-20s %14llu %6.2f%%", name_of(op),
+                (unsigned long long)rows[i].count,
+                100.0 * rows[i].count / total);
+#ifdef DEBUG_OPCODE_CYCLES
+        fprintf(stderr, " %10.1f %8llu %8llu",
+                (double)stats.cycles[op] / rows[i].count,
+                (unsigned long long)cycle_percentile(op, 0.5),
+                (unsigned long long)cycle_percentile(op, 0.99));
+#endif
+        fprintf(stderr, "\n");
+    }
+
+    row_count = 0;
+    for (int op = 0; op < UINT8_COUNT; op++) {
+        for (int next = 0; next < UINT8_COUNT; next++) {
+            if (stats.pair_counts[op][next] != 0) {
+                rows[row_count++] =
+                    (Row){op, next, stats.pair_counts[op][next]};
+            }
+        }
+    }
+    qsort(rows, row_count, sizeof(Row), compare_rows);
+
+    fprintf(stderr, "== opcode pairs ==\n");
+    for (int i = 0; i < row_count && i < REPORTED_PAIRS; i++) {
+        fprintf(stderr, "%-20s %-20s %14llu %6.2f%%\n", name_of(rows[i].op),
+                name_of(rows[i].next), (unsigned long long)rows[i].count,
+                100.0 * rows[i].count / total);
+    }
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef clox_opstats_h
+#define clox_opstats_h
+
+#include "common.h"
+#include "config.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+// counts an instruction the interpreter is about to execute, along with the
+// pair it forms with the previous one and, with DEBUG_OPCODE_CYCLES, the
+// cycles the previous one took
+void opstats_record(uint8_t instruction);
+// prints the counts to stderr, sorted from the most executed
+void opstats_report(void);
+
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "object.h"
+#include "script.h"
+#include "thread.h"
+
+// how many distinct sources the pool keeps compiled
+#define SCRIPT_CACHE_MAX 64
+
+// a script submitted before, compiled once and then shared by every vm that
+// runs the same source
+typedef struct CachedScript {
+    uint32_t hash;
+    Script* script;
+    // jobs that are queued or running the script, it's freed once none are
+    // left after it was evicted
+    int jobs;
+    bool evicted;
+    // most recently submitted first
+    struct CachedScript* prev;
+    struct CachedScript* next;
+} CachedScript;
+
+typedef struct Job {
+    CachedScript* cached;
+    InterpretResult* result;
+    struct Job* next;
+} Job;
+
+struct VmPool {
+    Thread* threads;
+    int thread_count;
+
+    // guards everything below
+    Mutex lock;
+    // signaled when a job is queued or the pool is stopping
+    Condition has_work;
+    // signaled when the last pending job finishes
+    Condition idle;
+    Job* head;
+    Job* tail;
+    // jobs that are queued or running
+    int pending;
+    bool stopping;
+
+    // guards the cache and the job counts of its scripts
+    Mutex cache_lock;
+    CachedScript* cache;
+    CachedScript* cache_tail;
+    int cache_count;
+};
+
+static int processor_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+// returns NULL once the pool is stopping and the queue is empty
+static Job* next_job(VmPool* pool) {
+    mutex_lock(&pool->lock);
+    while (pool->head == NULL && !pool->stopping) {
+        condition_wait(&pool->has_work, &pool->lock);
+    }
+
+    Job* job = pool->head;
+    if (job != NULL) {
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+    }
+    mutex_unlock(&pool->lock);
+    return job;
+}
+
+static void cached_script_free(CachedScript* cached) {
+    script_free(cached->script);
+    free(cached);
+}
+
+static void release_script(VmPool* pool, CachedScript* cached) {
+    mutex_lock(&pool->cache_lock);
+    bool unused = --cached->jobs == 0 && cached->evicted;
+    mutex_unlock(&pool->cache_lock);
+
+    if (unused) {
+        cached_script_free(cached);
+    }
+}
+
+static void finish_job(VmPool* pool, Job* job, InterpretResult result) {
+    release_script(pool, job->cached);
+
+    mutex_lock(&pool->lock);
+    if (job->result != NULL) {
+        *job->result = result;
+    }
+    if (--pool->pending == 0) {
+        condition_broadcast(&pool->idle);
+    }
+    mutex_unlock(&pool->lock);
+
+    free(job);
+}
+
+static void run_jobs(VmPool* pool) {
+    Job* job;
+    while ((job = next_job(pool)) != NULL) {
+        // a fresh vm for every script, so scripts never see each other's
+        // globals no matter which thread runs them
+        VM* vm = vm_new();
+        InterpretResult result = INTERPRET_RUNTIME_ERROR;
+        if (vm == NULL) {
+            fprintf(stderr, "not enough memory to start a vm\n");
+        } else {
+            result = vm_interpret_script(vm, job->cached->script);
+            vm_free(vm);
+        }
+        finish_job(pool, job, result);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker(LPVOID pool) {
+    run_jobs(pool);
+    return 0;
+}
+#else
+static void* worker(void* pool) {
+    run_jobs(pool);
+    return NULL;
+}
+#endif
+
+static bool thread_start(Thread* thread, VmPool* pool) {
+#ifdef _WIN32
+    *thread = CreateThread(NULL, 0, worker, pool, 0, NULL);
+    return *thread != NULL;
+#else
+    return pthread_create(thread, NULL, worker, pool) == 0;
+#endif
+}
+
+static void thread_join(Thread thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+// stops the first `started` threads once they have run every queued job
+static void stop_threads(VmPool* pool, int started) {
+    mutex_lock(&pool->lock);
+    pool->stopping = true;
+    condition_broadcast(&pool->has_work);
+    mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < started; i++) {
+        thread_join(pool->threads[i]);
+    }
+}
+
+static void pool_destroy(VmPool* pool) {
+    CachedScript* cached = pool->cache;
+    while (cached != NULL) {
+        CachedScript* next = cached->next;
+        cached_script_free(cached);
+        cached = next;
+    }
+
+    mutex_destroy(&pool->cache_lock);
+    condition_destroy(&pool->idle);
+    condition_destroy(&pool->has_work);
+    mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+VmPool* vm_pool_new(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = processor_count();
+    }
+
+    VmPool* pool = malloc(sizeof(VmPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc(sizeof(Thread) * thread_count);
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->thread_count = thread_count;
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->pending = 0;
+    pool->stopping = false;
+    pool->cache = NULL;
+    pool->cache_tail = NULL;
+    pool->cache_count = 0;
+    mutex_init(&pool->cache_lock);
+    mutex_init(&pool->lock);
+    condition_init(&pool->has_work);
+    condition_init(&pool->idle);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (!thread_start(&pool->threads[i], pool)) {
+            stop_threads(pool, i);
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void vm_pool_free(VmPool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    stop_threads(pool, pool->thread_count);
+    pool_destroy(pool);
+}
+
+int vm_pool_thread_count(VmPool* pool) {
+    return pool->thread_count;
+}
+
+static void cache_unlink(VmPool* pool, CachedScript* cached) {
+    if (cached->prev != NULL) {
+        cached->prev->next = cached->next;
+    } else {
+        pool->cache = cached->next;
+    }
+    if (cached->next != NULL) {
+        cached->next->prev = cached->prev;
+    } else {
+        pool->cache_tail = cached->prev;
+    }
+    pool->cache_count--;
+}
+
+static void cache_push(VmPool* pool, CachedScript* cached) {
+    cached->prev = NULL;
+    cached->next = pool->cache;
+    if (pool->cache != NULL) {
+        pool->cache->prev = cached;
+    } else {
+        pool->cache_tail = cached;
+    }
+    pool->cache = cached;
+    pool->cache_count++;
+}
+
+// the cached script compiled from source, moved to the front of the cache.
+// the caller must hold cache_lock
+static CachedScript* cache_find(VmPool* pool,
+                                const char* source,
+                                uint32_t hash) {
+    CachedScript* cached = pool->cache;
+    while (cached != NULL && (cached->hash != hash ||
+                              strcmp(cached->script->source, source) != 0)) {
+        cached = cached->next;
+    }
+
+    if (cached != NULL && cached != pool->cache) {
+        cache_unlink(pool, cached);
+        cache_push(pool, cached);
+    }
+    return cached;
+}
+
+// adds a job to the script compiled from source, compiling it if it isn't
+// cached. *cached is NULL if source doesn't compile. returns false if there
+// isn't enough memory
+static bool acquire_script(VmPool* pool,
+                           const char* source,
+                           CachedScript** cached) {
+    uint32_t hash = hash_string(source, (int)strlen(source));
+    mutex_lock(&pool->cache_lock);
+    *cached = cache_find(pool, source, hash);
+    if (*cached != NULL) {
+        (*cached)->jobs++;
+    }
+    mutex_unlock(&pool->cache_lock);
+    if (*cached != NULL) {
+        return true;
+    }
+
+    // other submissions go on while this compiles. another thread compiling
+    // the same source at the same time wastes its work but nothing else
+    Script* script = script_compile(source);
+    if (script == NULL) {
+        return true;
+    }
+    CachedScript* compiled = malloc(sizeof(CachedScript));
+    if (compiled == NULL) {
+        script_free(script);
+        return false;
+    }
+    compiled->hash = hash;
+    compiled->script = script;
+    compiled->jobs = 1;
+    compiled->evicted = false;
+
+    CachedScript* evicted = NULL;
+    mutex_lock(&pool->cache_lock);
+    *cached = cache_find(pool, source, hash);
+    if (*cached != NULL) {
+        (*cached)->jobs++;
+    } else {
+        *cached = compiled;
+        compiled = NULL;
+        cache_push(pool, *cached);
+        if (pool->cache_count > SCRIPT_CACHE_MAX) {
+            evicted = pool->cache_tail;
+            cache_unlink(pool, evicted);
+            evicted->evicted = true;
+            if (evicted->jobs > 0) {
+                // freed by the last job running it
+                evicted = NULL;
+            }
+        }
+    }
+    mutex_unlock(&pool->cache_lock);
+
+    if (compiled != NULL) {
+        cached_script_free(compiled);
+    }
+    if (evicted != NULL) {
+        cached_script_free(evicted);
+    }
+    return true;
+}
+
+bool vm_pool_submit(VmPool* pool, const char* source, InterpretResult* result) {
+    CachedScript* cached;
+    if (!acquire_script(pool, source, &cached)) {
+        return false;
+    }
+    if (cached == NULL) {
+        if (result != NULL) {
+            *result = INTERPRET_COMPILE_ERROR;
+        }
+        return true;
+    }
+
+    Job* job = malloc(sizeof(Job));
+    if (job == NULL) {
+        release_script(pool, cached);
+        return false;
+    }
+    job->cached = cached;
+    job->result = result;
+    job->next = NULL;
+
+    mutex_lock(&pool->lock);
+    if (pool->tail == NULL) {
+        pool->head = job;
+    } else {
+        pool->tail->next = job;
+    }
+    pool->tail = job;
+    pool->pending++;
+    condition_signal(&pool->has_work);
+    mutex_unlock(&pool->lock);
+    return true;
+}
+
+void vm_pool_wait(VmPool* pool) {
+    mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        condition_wait(&pool->idle, &pool->lock);
+    }
+    mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "vm.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+volatile sig_atomic_t profiler_pending = 0;
+
+// number of times a call stack was sampled
+typedef struct Sample {
+    // frames from the outermost to the innermost, separated by ';'
+    char* stack;
+    uint32_t hash;
+    uint64_t count;
+} Sample;
+
+typedef struct Profile {
+    const char* path;
+    Sample* samples;
+    int count;
+    int capacity;
+    // scratch space the sampled stack is formatted into
+    char* stack;
+    int stack_length;
+    int stack_capacity;
+} Profile;
+
+static Profile profile;
+
+static uint32_t hash_stack(const char* stack, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)stack[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static Sample* find_sample(Sample* samples,
+                           int capacity,
+                           const char* stack,
+                           int length,
+                           uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        Sample* sample = &samples[index];
+        if (sample->stack == NULL ||
+            (sample->hash == hash && strlen(sample->stack) == (size_t)length &&
+             memcmp(sample->stack, stack, length) == 0)) {
+            return sample;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void grow_samples(void) {
+    int capacity = GROW_CAPACITY(profile.capacity);
+    Sample* samples = calloc(capacity, sizeof(Sample));
+    if (samples == NULL) {
+        fprintf(stderr, "not enough memory to record profiler samples\n");
+        exit(74);
+    }
+
+    for (int i = 0; i < profile.capacity; i++) {
+        Sample* old = &profile.samples[i];
+        if (old->stack == NULL) {
+            continue;
+        }
+
+        Sample* sample = find_sample(samples, capacity, old->stack,
+                                     (int)strlen(old->stack), old->hash);
+        *sample = *old;
+    }
+
+    free(profile.samples);
+    profile.samples = samples;
+    profile.capacity = capacity;
+}
+
+static void append_frame(const char* name, int line) {
+    // "name:line;" with a 32 bit line takes at most 12 bytes more than name
+    int needed = profile.stack_length + (int)strlen(name) + 13;
+    if (needed > profile.stack_capacity) {
+        while (profile.stack_capacity < needed) {
+            profile.stack_capacity = GROW_CAPACITY(profile.stack_capacity);
+        }
+        profile.stack = realloc(profile.stack, profile.stack_capacity);
+        if (profile.stack == NULL) {
+            fprintf(stderr, "not enough memory to record profiler samples\n");
+            exit(74);
+        }
+    }
+
+    profile.stack_length +=
+        sprintf(profile.stack + profile.stack_length, "%s%s:%d",
+                profile.stack_length == 0 ? "" : ";", name, line);
+}
+
+void profiler_sample(VM* vm) {
+    profiler_pending = 0;
+    if (vm->frame_count == 0) {
+        return;
+    }
+
+    profile.stack_length = 0;
+    for (int i = 0; i < vm->frame_count; i++) {
+        CallFrame* frame = &vm->frames[i];
+        ObjFunction* function = frame->closure->function;
+        // ip points past the instruction being executed, except when the
+        // frame has just been pushed
+        int offset = (int)(frame->ip - function->chunk.code);
+        offset = offset > 0 ? offset - 1 : 0;
+        append_frame(function->name ? function->name->chars : "script",
+                     chunk_line(&function->chunk, offset));
+    }
+
+    if (profile.count + 1 > profile.capacity * TABLE_MAX_LOAD) {
+        grow_samples();
+    }
+
+    uint32_t hash = hash_stack(profile.stack, profile.stack_length);
+    Sample* sample = find_sample(profile.samples, profile.capacity,
+                                 profile.stack, profile.stack_length, hash);
+    if (sample->stack == NULL) {
+        sample->stack = malloc(profile.stack_length + 1);
+        if (sample->stack == NULL) {
+            fprintf(stderr, "not enough memory to record profiler samples\n");
+            exit(74);
+        }
+        memcpy(sample->stack, profile.stack, profile.stack_length + 1);
+        sample->hash = hash;
+        profile.count++;
+    }
+    sample->count++;
+}
+
+static void write_profile(void) {
+#ifndef _WIN32
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+
+    FILE* file = fopen(profile.path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "could not write profile to '%s'\n", profile.path);
+    }
+
+    for (int i = 0; i < profile.capacity; i++) {
+        Sample* sample = &profile.samples[i];
+        if (sample->stack == NULL) {
+            continue;
+        }
+
+        if (file != NULL) {
+            fprintf(file, "%s %llu\n", sample->stack,
+                    (unsigned long long)sample->count);
+        }
+        free(sample->stack);
+    }
+
+    if (file != NULL) {
+        fclose(file);
+    }
+    free(profile.samples);
+    free(profile.stack);
+}
+
+#ifdef _WIN32
+static VOID CALLBACK on_timer(PVOID parameter, BOOLEAN timer_fired) {
+    UNUSED(parameter);
+    UNUSED(timer_fired);
+    profiler_pending = 1;
+}
+#else
+static void on_timer(int signal) {
+    UNUSED(signal);
+    profiler_pending = 1;
+}
+#endif
+
+bool profiler_start(const char* path) {
+    profile.path = path;
+
+#ifdef _WIN32
+    // windows has no cpu time timers, so this samples wall clock time
+    HANDLE timer;
+    DWORD period = PROFILER_INTERVAL / 1000 > 0 ? PROFILER_INTERVAL / 1000 : 1;
+    if (!CreateTimerQueueTimer(&timer, NULL, on_timer, NULL, period, period,
+                               WT_EXECUTEDEFAULT)) {
+        return false;
+    }
+#else
+    struct sigaction action = {0};
+    action.sa_handler = on_timer;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        return false;
+    }
+
+    struct itimerval timer = {0};
+    timer.it_interval.tv_usec = PROFILER_INTERVAL;
+    timer.it_value.tv_usec = PROFILER_INTERVAL;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        return false;
+    }
+#endif
+
+    atexit(write_profile);
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <signal.h>
+
+#include "common.h"
+
+// microseconds of cpu time between samples
+#define PROFILER_INTERVAL 1000
+
+// set by the profiling timer, the vm checks it at safepoints (calls, returns
+// and loop back-edges) and takes a sample of the call stack when it's set
+extern volatile sig_atomic_t profiler_pending;
+
+// starts sampling, the samples get written to `path` in the collapsed stack
+// format flamegraph tools read when the program exits. the samples are global
+// to the process, so only one vm may run while profiling
+bool profiler_start(const char* path);
+// records the current call stack of the vm
+void profiler_sample(VM* vm);
+
+static inline void profiler_poll(VM* vm) {
+    if (profiler_pending) {
+        profiler_sample(vm);
+    }
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiling/compiler.h"
+#include "memory.h"
+#include "script.h"
+#include "table.h"
+#include "thread.h"
+#include "vm.h"
+
+// every frozen string, shared by all scripts and vms so a string has the same
+// object wherever it's used. each one maps to the number of scripts and vms
+// referring to it: the scripts whose functions use it and the vms it's
+// interned into. it's freed when the last of them is, so the table only holds
+// the strings of live scripts and vms
+static Mutex shared_lock = MUTEX_INITIALIZER;
+static Table shared_strings;
+static int shared_count = 0;
+
+// needs shared_lock
+static void retain(ObjString* string) {
+    Value refs;
+    table_get(&shared_strings, string, &refs);
+    table_set(NULL, &shared_strings, string, NUMBER_VAL(AS_NUMBER(refs) + 1));
+}
+
+// needs shared_lock
+static void release(ObjString* string) {
+    Value refs;
+    table_get(&shared_strings, string, &refs);
+    if (AS_NUMBER(refs) > 1) {
+        table_set(NULL, &shared_strings, string,
+                  NUMBER_VAL(AS_NUMBER(refs) - 1));
+        return;
+    }
+
+    table_delete(&shared_strings, string);
+    FREE_ARRAY(NULL, char, string->chars, string->len + 1);
+    FREE(NULL, ObjString, string);
+    // deleting leaves a tombstone in the table's count, the table is rebuilt
+    // without them once they outnumber the strings
+    shared_count--;
+    if (shared_strings.count - shared_count > shared_count) {
+        Table live;
+        table_init(&live);
+        table_reserve(NULL, &live, shared_count);
+        table_add_all(NULL, &shared_strings, &live);
+        table_free(NULL, &shared_strings);
+        shared_strings = live;
+    }
+}
+
+// adds a string that isn't referred to yet. needs shared_lock
+static void add_shared(ObjString* string) {
+    table_set(NULL, &shared_strings, string, NUMBER_VAL(0));
+    shared_count++;
+}
+
+static ObjString* frozen_string_new(const char* chars,
+                                    int length,
+                                    uint32_t hash) {
+    ObjString* string = ALLOCATE(NULL, ObjString, 1);
+    string->obj.type = OBJ_STRING;
+    string->obj.is_marked = false;
+    string->obj.is_frozen = true;
+    string->obj.is_foreign = false;
+    string->obj.next = NULL;
+    string->chars = ALLOCATE(NULL, char, length + 1);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    string->len = length;
+    string->hash = hash;
+
+    add_shared(string);
+    return string;
+}
+
+ObjString* shared_string(VM* vm, const char* chars, int length) {
+    uint32_t hash = hash_string(chars, length);
+    // the vm's own copy, if its scripts already made one, stays canonical
+    ObjString* interned = table_find_string(&vm->strings, chars, length, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    mutex_lock(&shared_lock);
+    ObjString* string =
+        table_find_string(&shared_strings, chars, length, hash);
+    if (string == NULL) {
+        string = frozen_string_new(chars, length, hash);
+    }
+    retain(string);
+    mutex_unlock(&shared_lock);
+
+    table_set(vm, &vm->strings, string, NIL_VAL);
+    return string;
+}
+
+static void add_function(Script* script, ObjFunction* function) {
+    if (script->function_capacity < script->function_count + 1) {
+        int old_capacity = script->function_capacity;
+        script->function_capacity = GROW_CAPACITY(old_capacity);
+        script->functions =
+            GROW_ARRAY(NULL, ObjFunction*, script->functions, old_capacity,
+                       script->function_capacity);
+    }
+    script->functions[script->function_count++] = function;
+}
+
+static ObjString* frozen_copy(Table* copies, ObjString* string) {
+    Value frozen;
+    return table_get(copies, string, &frozen) ? AS_STRING(frozen) : string;
+}
+
+// moves the functions and strings the compiler allocated in vm out of its
+// heap, and replaces the strings that already have a frozen copy with it.
+// needs shared_lock
+static void freeze(VM* vm, Script* script) {
+    // the compiler's strings that are duplicates of frozen ones, these stay in
+    // the vm's heap and get freed with it
+    Table copies;
+    table_init(&copies);
+
+    Obj** link = &vm->objects;
+    while (*link != NULL) {
+        Obj* obj = *link;
+        if (obj->type == OBJ_STRING) {
+            ObjString* string = (ObjString*)obj;
+            ObjString* frozen = table_find_string(
+                &shared_strings, string->chars, string->len, string->hash);
+            if (frozen != NULL) {
+                table_set(NULL, &copies, string, OBJ_VAL(frozen));
+                link = &obj->next;
+                continue;
+            }
+            // it stays interned in vm, which refers to it until it's freed
+            add_shared(string);
+            retain(string);
+        } else if (obj->type == OBJ_FUNCTION) {
+            add_function(script, (ObjFunction*)obj);
+        } else {
+            link = &obj->next;
+            continue;
+        }
+
+        obj->is_frozen = true;
+        *link = obj->next;
+        obj->next = NULL;
+    }
+
+    Table used;
+    table_init(&used);
+    for (int i = 0; i < script->function_count; i++) {
+        ObjFunction* function = script->functions[i];
+        if (function->name != NULL) {
+            function->name = frozen_copy(&copies, function->name);
+            table_set(NULL, &used, function->name, NIL_VAL);
+        }
+
+        ValueArray* constants = &function->chunk.constants;
+        for (int j = 0; j < constants->count; j++) {
+            if (IS_STRING(constants->values[j])) {
+                ObjString* string =
+                    frozen_copy(&copies, AS_STRING(constants->values[j]));
+                constants->values[j] = OBJ_VAL(string);
+                table_set(NULL, &used, string, NIL_VAL);
+            }
+        }
+    }
+
+    script->strings = ALLOCATE(NULL, ObjString*, used.count);
+    for (int i = 0; i < used.capacity; i++) {
+        if (used.entries[i].key != NULL) {
+            script->strings[script->string_count++] = used.entries[i].key;
+            retain(used.entries[i].key);
+        }
+    }
+
+    table_free(NULL, &used);
+    table_free(NULL, &copies);
+}
+
+Script* script_compile(const char* source) {
+    // the compiler allocates in a vm of its own, which is thrown away once
+    // the functions have been moved out of it
+    VM* vm = vm_new();
+    if (vm == NULL) {
+        return NULL;
+    }
+    ObjFunction* function = compile(vm, source);
+    if (function == NULL) {
+        vm_free(vm);
+        return NULL;
+    }
+
+    Script* script = ALLOCATE(NULL, Script, 1);
+    size_t length = strlen(source);
+    script->source = ALLOCATE(NULL, char, length + 1);
+    memcpy(script->source, source, length + 1);
+    script->function = function;
+    script->strings = NULL;
+    script->string_count = 0;
+    script->functions = NULL;
+    script->function_count = 0;
+    script->function_capacity = 0;
+
+    mutex_lock(&shared_lock);
+    freeze(vm, script);
+    mutex_unlock(&shared_lock);
+
+    vm_free(vm);
+    return script;
+}
+
+void script_free(Script* script) {
+    if (script == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < script->function_count; i++) {
+        ObjFunction* function = script->functions[i];
+        chunk_free(NULL, &function->chunk);
+        FREE(NULL, ObjFunction, function);
+    }
+    FREE_ARRAY(NULL, ObjFunction*, script->functions,
+               script->function_capacity);
+
+    mutex_lock(&shared_lock);
+    for (int i = 0; i < script->string_count; i++) {
+        release(script->strings[i]);
+    }
+    mutex_unlock(&shared_lock);
+    FREE_ARRAY(NULL, ObjString*, script->strings, script->string_count);
+    FREE_ARRAY(NULL, char, script->source, strlen(script->source) + 1);
+    FREE(NULL, Script, script);
+}
+
+bool script_link(VM* vm, const Script* script) {
+    bool linked = true;
+    mutex_lock(&shared_lock);
+    for (int i = 0; i < script->string_count; i++) {
+        ObjString* string = script->strings[i];
+        ObjString* interned = table_find_string(&vm->strings, string->chars,
+                                                string->len, string->hash);
+        if (interned == NULL) {
+            table_set(vm, &vm->strings, string, NIL_VAL);
+            retain(string);
+        } else if (interned != string) {
+            linked = false;
+            break;
+        }
+    }
+    mutex_unlock(&shared_lock);
+    return linked;
+}
+
+void script_release_strings(Table* strings) {
+    mutex_lock(&shared_lock);
+    for (int i = 0; i < strings->capacity; i++) {
+        ObjString* string = strings->entries[i].key;
+        if (string != NULL && string->obj.is_frozen) {
+            release(string);
+        }
+    }
+    mutex_unlock(&shared_lock);
+}
@@ -0,0 +1,32 @@
+#ifndef clox_script_h
+#define clox_script_h
+
+#include "common.h"
+#include "object.h"
+
+struct Script {
+    // compiled again by vms that can't share the frozen functions
+    char* source;
+    ObjFunction* function;
+    // every string the functions refer to, interned into a vm before it runs
+    // them so the vm's own strings are the same objects
+    ObjString** strings;
+    int string_count;
+    // all of the script's functions, including nested ones
+    ObjFunction** functions;
+    int function_count;
+    int function_capacity;
+};
+
+// returns the process wide frozen copy of the string and interns it into vm,
+// or the vm's own copy if it already has one
+ObjString* shared_string(VM* vm, const char* chars, int length);
+// interns the script's strings into vm. returns false if vm already has
+// different copies of some of them, which would break the identity of
+// strings the vm relies on
+bool script_link(VM* vm, const Script* script);
+// drops the references a vm's string table holds on the frozen strings
+// interned into it, before the table is freed
+void script_release_strings(Table* strings);
+
+#endif
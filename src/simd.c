@@ -0,0 +1,459 @@
+#include <math.h>
+
+#include "simd.h"
+
+#if defined(ENABLE_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// MSVC only generates AVX2 code for the whole program, so only GCC and Clang
+// get the runtime dispatch
+#if defined(SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// the whole kernel where there are no vectors, and the tail the vector loops
+// leave over everywhere else
+
+static double sum_scalar(const double* values, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+static double dot_scalar(const double* a, const double* b, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void scale_scalar(double* values, double factor, int count) {
+    for (int i = 0; i < count; i++) {
+        values[i] *= factor;
+    }
+}
+
+static void add_scalar(double* a, const double* b, int count) {
+    for (int i = 0; i < count; i++) {
+        a[i] += b[i];
+    }
+}
+
+static double min_scalar(double min, const double* values, int count) {
+    for (int i = 0; i < count; i++) {
+        min = values[i] < min ? values[i] : min;
+    }
+    return min;
+}
+
+static double max_scalar(double max, const double* values, int count) {
+    for (int i = 0; i < count; i++) {
+        max = values[i] > max ? values[i] : max;
+    }
+    return max;
+}
+
+static void map_scalar(SimdOp op, double* dst, const double* src, int count) {
+    for (int i = 0; i < count; i++) {
+        switch (op) {
+            case SIMD_ABS:
+                dst[i] = fabs(src[i]);
+                break;
+            case SIMD_NEG:
+                dst[i] = -src[i];
+                break;
+            case SIMD_SQRT:
+                dst[i] = sqrt(src[i]);
+                break;
+            case SIMD_SQUARE:
+                dst[i] = src[i] * src[i];
+                break;
+        }
+    }
+}
+
+static uint64_t sum_bytes_scalar(const uint8_t* bytes, int count) {
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+static uint8_t min_bytes_scalar(uint8_t min, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) {
+        min = bytes[i] < min ? bytes[i] : min;
+    }
+    return min;
+}
+
+static uint8_t max_bytes_scalar(uint8_t max, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) {
+        max = bytes[i] > max ? bytes[i] : max;
+    }
+    return max;
+}
+
+#ifdef SIMD_SSE2
+// two doubles or sixteen bytes at a time, every x86-64 processor has SSE2
+
+static double horizontal_sum_sse2(__m128d sums) {
+    return _mm_cvtsd_f64(_mm_add_sd(sums, _mm_unpackhi_pd(sums, sums)));
+}
+
+static double sum_sse2(const double* values, int count) {
+    // two accumulators hide the latency of the additions
+    __m128d sums0 = _mm_setzero_pd();
+    __m128d sums1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sums0 = _mm_add_pd(sums0, _mm_loadu_pd(values + i));
+        sums1 = _mm_add_pd(sums1, _mm_loadu_pd(values + i + 2));
+    }
+    return horizontal_sum_sse2(_mm_add_pd(sums0, sums1)) +
+           sum_scalar(values + i, count - i);
+}
+
+static double dot_sse2(const double* a, const double* b, int count) {
+    __m128d sums0 = _mm_setzero_pd();
+    __m128d sums1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sums0 = _mm_add_pd(
+            sums0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        sums1 = _mm_add_pd(sums1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                             _mm_loadu_pd(b + i + 2)));
+    }
+    return horizontal_sum_sse2(_mm_add_pd(sums0, sums1)) +
+           dot_scalar(a + i, b + i, count - i);
+}
+
+static void scale_sse2(double* values, double factor, int count) {
+    __m128d factors = _mm_set1_pd(factor);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(values + i,
+                      _mm_mul_pd(_mm_loadu_pd(values + i), factors));
+    }
+    scale_scalar(values + i, factor, count - i);
+}
+
+static void add_sse2(double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(a + i,
+                      _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    add_scalar(a + i, b + i, count - i);
+}
+
+static double min_sse2(const double* values, int count) {
+    __m128d mins = _mm_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        mins = _mm_min_pd(mins, _mm_loadu_pd(values + i));
+    }
+    mins = _mm_min_sd(mins, _mm_unpackhi_pd(mins, mins));
+    return min_scalar(_mm_cvtsd_f64(mins), values + i, count - i);
+}
+
+static double max_sse2(const double* values, int count) {
+    __m128d maxes = _mm_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        maxes = _mm_max_pd(maxes, _mm_loadu_pd(values + i));
+    }
+    maxes = _mm_max_sd(maxes, _mm_unpackhi_pd(maxes, maxes));
+    return max_scalar(_mm_cvtsd_f64(maxes), values + i, count - i);
+}
+
+static void map_sse2(SimdOp op, double* dst, const double* src, int count) {
+    // clearing the sign bit is abs, flipping it is negation
+    __m128d sign = _mm_set1_pd(-0.0);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d x = _mm_loadu_pd(src + i);
+        switch (op) {
+            case SIMD_ABS:
+                x = _mm_andnot_pd(sign, x);
+                break;
+            case SIMD_NEG:
+                x = _mm_xor_pd(sign, x);
+                break;
+            case SIMD_SQRT:
+                x = _mm_sqrt_pd(x);
+                break;
+            case SIMD_SQUARE:
+                x = _mm_mul_pd(x, x);
+                break;
+        }
+        _mm_storeu_pd(dst + i, x);
+    }
+    map_scalar(op, dst + i, src + i, count - i);
+}
+
+static uint64_t sum_bytes_sse2(const uint8_t* bytes, int count) {
+    // psadbw against zero adds each group of eight bytes into a 64-bit lane
+    __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(bytes + i));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(chunk, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    return lanes[0] + lanes[1] + sum_bytes_scalar(bytes + i, count - i);
+}
+
+static uint8_t min_bytes_sse2(const uint8_t* bytes, int count) {
+    __m128i mins = _mm_set1_epi8((char)bytes[0]);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        mins = _mm_min_epu8(mins,
+                            _mm_loadu_si128((const __m128i*)(bytes + i)));
+    }
+    uint8_t lanes[16];
+    _mm_storeu_si128((__m128i*)lanes, mins);
+    return min_bytes_scalar(min_bytes_scalar(bytes[0], lanes, 16), bytes + i,
+                            count - i);
+}
+
+static uint8_t max_bytes_sse2(const uint8_t* bytes, int count) {
+    __m128i maxes = _mm_set1_epi8((char)bytes[0]);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        maxes = _mm_max_epu8(maxes,
+                             _mm_loadu_si128((const __m128i*)(bytes + i)));
+    }
+    uint8_t lanes[16];
+    _mm_storeu_si128((__m128i*)lanes, maxes);
+    return max_bytes_scalar(max_bytes_scalar(bytes[0], lanes, 16), bytes + i,
+                            count - i);
+}
+#endif
+
+#ifdef SIMD_AVX2
+// four doubles or thirty-two bytes at a time, picked at runtime
+
+static bool has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+AVX2_TARGET static double horizontal_sum_avx2(__m256d sums) {
+    __m128d halves = _mm_add_pd(_mm256_castpd256_pd128(sums),
+                                _mm256_extractf128_pd(sums, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(halves, _mm_unpackhi_pd(halves, halves)));
+}
+
+AVX2_TARGET static double sum_avx2(const double* values, int count) {
+    __m256d sums0 = _mm256_setzero_pd();
+    __m256d sums1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sums0 = _mm256_add_pd(sums0, _mm256_loadu_pd(values + i));
+        sums1 = _mm256_add_pd(sums1, _mm256_loadu_pd(values + i + 4));
+    }
+    return horizontal_sum_avx2(_mm256_add_pd(sums0, sums1)) +
+           sum_scalar(values + i, count - i);
+}
+
+AVX2_TARGET static double dot_avx2(const double* a,
+                                   const double* b,
+                                   int count) {
+    __m256d sums0 = _mm256_setzero_pd();
+    __m256d sums1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        sums0 = _mm256_add_pd(sums0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                                   _mm256_loadu_pd(b + i)));
+        sums1 = _mm256_add_pd(sums1,
+                              _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                                            _mm256_loadu_pd(b + i + 4)));
+    }
+    return horizontal_sum_avx2(_mm256_add_pd(sums0, sums1)) +
+           dot_scalar(a + i, b + i, count - i);
+}
+
+AVX2_TARGET static void scale_avx2(double* values, double factor, int count) {
+    __m256d factors = _mm256_set1_pd(factor);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(values + i,
+                         _mm256_mul_pd(_mm256_loadu_pd(values + i), factors));
+    }
+    scale_scalar(values + i, factor, count - i);
+}
+
+AVX2_TARGET static void add_avx2(double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                              _mm256_loadu_pd(b + i)));
+    }
+    add_scalar(a + i, b + i, count - i);
+}
+
+AVX2_TARGET static double min_avx2(const double* values, int count) {
+    __m256d mins = _mm256_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        mins = _mm256_min_pd(mins, _mm256_loadu_pd(values + i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, mins);
+    return min_scalar(min_scalar(values[0], lanes, 4), values + i, count - i);
+}
+
+AVX2_TARGET static double max_avx2(const double* values, int count) {
+    __m256d maxes = _mm256_set1_pd(values[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        maxes = _mm256_max_pd(maxes, _mm256_loadu_pd(values + i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, maxes);
+    return max_scalar(max_scalar(values[0], lanes, 4), values + i, count - i);
+}
+
+AVX2_TARGET static void map_avx2(SimdOp op,
+                                 double* dst,
+                                 const double* src,
+                                 int count) {
+    __m256d sign = _mm256_set1_pd(-0.0);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(src + i);
+        switch (op) {
+            case SIMD_ABS:
+                x = _mm256_andnot_pd(sign, x);
+                break;
+            case SIMD_NEG:
+                x = _mm256_xor_pd(sign, x);
+                break;
+            case SIMD_SQRT:
+                x = _mm256_sqrt_pd(x);
+                break;
+            case SIMD_SQUARE:
+                x = _mm256_mul_pd(x, x);
+                break;
+        }
+        _mm256_storeu_pd(dst + i, x);
+    }
+    map_scalar(op, dst + i, src + i, count - i);
+}
+
+AVX2_TARGET static uint64_t sum_bytes_avx2(const uint8_t* bytes, int count) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i sums = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(bytes + i));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(chunk, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           sum_bytes_scalar(bytes + i, count - i);
+}
+
+AVX2_TARGET static uint8_t min_bytes_avx2(const uint8_t* bytes, int count) {
+    __m256i mins = _mm256_set1_epi8((char)bytes[0]);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        mins = _mm256_min_epu8(
+            mins, _mm256_loadu_si256((const __m256i*)(bytes + i)));
+    }
+    uint8_t lanes[32];
+    _mm256_storeu_si256((__m256i*)lanes, mins);
+    return min_bytes_scalar(min_bytes_scalar(bytes[0], lanes, 32), bytes + i,
+                            count - i);
+}
+
+AVX2_TARGET static uint8_t max_bytes_avx2(const uint8_t* bytes, int count) {
+    __m256i maxes = _mm256_set1_epi8((char)bytes[0]);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        maxes = _mm256_max_epu8(
+            maxes, _mm256_loadu_si256((const __m256i*)(bytes + i)));
+    }
+    uint8_t lanes[32];
+    _mm256_storeu_si256((__m256i*)lanes, maxes);
+    return max_bytes_scalar(max_bytes_scalar(bytes[0], lanes, 32), bytes + i,
+                            count - i);
+}
+#endif
+
+// picks the widest kernel the build and the processor support
+#if defined(SIMD_AVX2)
+#define DISPATCH(name, ...)              \
+    (has_avx2() ? name##_avx2(__VA_ARGS__) \
+                : name##_sse2(__VA_ARGS__))
+#elif defined(SIMD_SSE2)
+#define DISPATCH(name, ...) name##_sse2(__VA_ARGS__)
+#else
+#define DISPATCH(name, ...) name##_scalar(__VA_ARGS__)
+#endif
+
+double simd_sum(const double* values, int count) {
+    return DISPATCH(sum, values, count);
+}
+
+double simd_dot(const double* a, const double* b, int count) {
+    return DISPATCH(dot, a, b, count);
+}
+
+void simd_scale(double* values, double factor, int count) {
+    DISPATCH(scale, values, factor, count);
+}
+
+void simd_add(double* a, const double* b, int count) {
+    DISPATCH(add, a, b, count);
+}
+
+double simd_min(const double* values, int count) {
+#if defined(SIMD_SSE2)
+    return DISPATCH(min, values, count);
+#else
+    return min_scalar(values[0], values, count);
+#endif
+}
+
+double simd_max(const double* values, int count) {
+#if defined(SIMD_SSE2)
+    return DISPATCH(max, values, count);
+#else
+    return max_scalar(values[0], values, count);
+#endif
+}
+
+void simd_map(SimdOp op, double* dst, const double* src, int count) {
+    DISPATCH(map, op, dst, src, count);
+}
+
+uint64_t simd_sum_bytes(const uint8_t* bytes, int count) {
+    return DISPATCH(sum_bytes, bytes, count);
+}
+
+uint8_t simd_min_bytes(const uint8_t* bytes, int count) {
+#if defined(SIMD_SSE2)
+    return DISPATCH(min_bytes, bytes, count);
+#else
+    return min_bytes_scalar(bytes[0], bytes, count);
+#endif
+}
+
+uint8_t simd_max_bytes(const uint8_t* bytes, int count) {
+#if defined(SIMD_SSE2)
+    return DISPATCH(max_bytes, bytes, count);
+#else
+    return max_bytes_scalar(bytes[0], bytes, count);
+#endif
+}
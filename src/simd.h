@@ -0,0 +1,37 @@
+#ifndef clox_simd_h
+#define clox_simd_h
+
+#include "common.h"
+#include "config.h"
+
+// bulk kernels over raw arrays, used by the typed buffers. with ENABLE_SIMD
+// they use AVX2 when the processor has it and SSE2 otherwise on x86-64, and
+// plain loops everywhere else. the vector sums add in a different order than
+// a loop would, so they can round differently
+
+typedef enum SimdOp {
+    SIMD_ABS,
+    SIMD_NEG,
+    SIMD_SQRT,
+    SIMD_SQUARE,
+} SimdOp;
+
+double simd_sum(const double* values, int count);
+double simd_dot(const double* a, const double* b, int count);
+// values[i] *= factor
+void simd_scale(double* values, double factor, int count);
+// a[i] += b[i]
+void simd_add(double* a, const double* b, int count);
+// count must be above 0. which value results when some are NaN depends on
+// the kernel
+double simd_min(const double* values, int count);
+double simd_max(const double* values, int count);
+// dst[i] = op(src[i])
+void simd_map(SimdOp op, double* dst, const double* src, int count);
+
+uint64_t simd_sum_bytes(const uint8_t* bytes, int count);
+// count must be above 0
+uint8_t simd_min_bytes(const uint8_t* bytes, int count);
+uint8_t simd_max_bytes(const uint8_t* bytes, int count);
+
+#endif
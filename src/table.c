@@ -29,9 +29,9 @@ static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
     }
 }
 
-static void adjust_capacity(Table* table, int new_capacity) {
+static void adjust_capacity(VM* vm, Table* table, int new_capacity) {
     // TODO(OPT): merge the two loops
-    Entry* entries = ALLOCATE(Entry, new_capacity);
+    Entry* entries = ALLOCATE(vm, Entry, new_capacity);
 
     for (int i = 0; i < new_capacity; i++) {
         entries[i].key = NULL;
@@ -51,7 +51,7 @@ static void adjust_capacity(Table* table, int new_capacity) {
         table->count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity);
 
     table->entries = entries;
     table->capacity = new_capacity;
@@ -63,8 +63,8 @@ void table_init(Table* table) {
     table->entries = NULL;
 }
 
-void table_free(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->count);
+void table_free(VM* vm, Table* table) {
+    FREE_ARRAY(vm, Entry, table->entries, table->capacity);
     table_init(table);
 }
 
@@ -82,10 +82,10 @@ bool table_get(Table* table, ObjString* key, Value* value) {
     return true;
 }
 
-bool table_set(Table* table, ObjString* key, Value value) {
+bool table_set(VM* vm, Table* table, ObjString* key, Value value) {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
         int new_capacity = GROW_CAPACITY(table->capacity);
-        adjust_capacity(table, new_capacity);
+        adjust_capacity(vm, table, new_capacity);
     }
     Entry* entry = find_entry(table->entries, table->capacity, key);
     bool is_new_key = entry->key == NULL;
@@ -100,13 +100,20 @@ bool table_set(Table* table, ObjString* key, Value value) {
     return is_new_key;
 }
 
+void table_reserve(VM* vm, Table* table, int count) {
+    int capacity = (int)(count / TABLE_MAX_LOAD) + 1;
+    if (count > 0 && capacity > table->capacity) {
+        adjust_capacity(vm, table, capacity);
+    }
+}
+
 bool table_delete(Table* table, ObjString* key) {
     if (table->count == 0) {
         return false;
     }
 
     Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (entry->key) {
+    if (!entry->key) {
         return false;
     }
 
@@ -116,14 +123,14 @@ bool table_delete(Table* table, ObjString* key) {
     return true;
 }
 
-void table_add_all(Table* from, Table* to) {
+void table_add_all(VM* vm, Table* from, Table* to) {
     for (int i = 0; i < from->capacity; i++) {
         Entry* src_entry = &from->entries[i];
         if (!src_entry->key) {
             continue;
         }
 
-        table_set(to, src_entry->key, src_entry->value);
+        table_set(vm, to, src_entry->key, src_entry->value);
     }
 }
 
@@ -156,16 +163,19 @@ ObjString* table_find_string(Table* table,
 void table_remove_white(Table* table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.is_marked) {
+        // frozen strings are never marked, but must stay interned so
+        // copy_string() keeps returning the ones frozen code refers to
+        if (entry->key != NULL && !entry->key->obj.is_marked &&
+            !entry->key->obj.is_frozen) {
             table_delete(table, entry->key);
         }
     }
 }
 
-void mark_table(Table* table) {
+void mark_table(VM* vm, Table* table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        mark_object((Obj*)entry->key);
-        mark_value(entry->value);
+        mark_object(vm, (Obj*)entry->key);
+        mark_value(vm, entry->value);
     }
 }
@@ -16,16 +16,18 @@ typedef struct Table {
 } Table;
 
 void table_init(Table* table);
-void table_free(Table* table);
+void table_free(VM* vm, Table* table);
 bool table_get(Table* table, ObjString* key, Value* value);
-bool table_set(Table* table, ObjString* key, Value value);
+bool table_set(VM* vm, Table* table, ObjString* key, Value value);
 bool table_delete(Table* table, ObjString* key);
-void table_add_all(Table* from, Table* to);
+// makes room for count entries in all, so adding them doesn't grow the table
+void table_reserve(VM* vm, Table* table, int count);
+void table_add_all(VM* vm, Table* from, Table* to);
 ObjString* table_find_string(Table* table,
                              const char* chars,
                              int len,
                              uint32_t hash);
 void table_remove_white(Table* table);
-void mark_table(Table* table);
+void mark_table(VM* vm, Table* table);
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef clox_thread_h
+#define clox_thread_h
+
+// the few threading primitives clox needs, on top of pthreads or win32
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+#define MUTEX_INITIALIZER SRWLOCK_INIT
+
+#define mutex_init(mutex) InitializeSRWLock(mutex)
+#define mutex_destroy(mutex) ((void)(mutex))
+#define mutex_lock(mutex) AcquireSRWLockExclusive(mutex)
+#define mutex_unlock(mutex) ReleaseSRWLockExclusive(mutex)
+#define condition_init(condition) InitializeConditionVariable(condition)
+#define condition_destroy(condition) ((void)(condition))
+#define condition_wait(condition, mutex) \
+    SleepConditionVariableSRW((condition), (mutex), INFINITE, 0)
+#define condition_signal(condition) WakeConditionVariable(condition)
+#define condition_broadcast(condition) WakeAllConditionVariable(condition)
+#else
+#include <pthread.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+#define mutex_init(mutex) pthread_mutex_init((mutex), NULL)
+#define mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+#define condition_init(condition) pthread_cond_init((condition), NULL)
+#define condition_destroy(condition) pthread_cond_destroy(condition)
+#define condition_wait(condition, mutex) pthread_cond_wait((condition), (mutex))
+#define condition_signal(condition) pthread_cond_signal(condition)
+#define condition_broadcast(condition) pthread_cond_broadcast(condition)
+#endif
+
+#endif
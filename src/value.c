@@ -12,25 +12,25 @@ void value_array_init(ValueArray* array) {
     array->values = NULL;
 }
 
-void value_array_free(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+void value_array_free(VM* vm, ValueArray* array) {
+    FREE_ARRAY(vm, Value, array->values, array->capacity);
     value_array_init(array);
 }
 
-void value_array_write(ValueArray* array, Value value) {
+void value_array_write(VM* vm, ValueArray* array, Value value) {
     // why not array->count == array->capacity?
     if (array->capacity < array->count + 1) {
         int old_capacity = array->capacity;
         array->capacity = GROW_CAPACITY(old_capacity);
         array->values =
-            GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
+            GROW_ARRAY(vm, Value, array->values, old_capacity, array->capacity);
     }
 
     array->values[array->count] = value;
     array->count++;
 }
 
-Value value_get(ValueArray* array, uint8_t i) {
+Value value_get(ValueArray* array, int i) {
     ASSERT(i < array->count, "index is in bounds");
     return array->values[i];
 }
@@ -64,7 +64,18 @@ bool values_equal(Value a, Value b) {
         case VAL_NUMBER:
             return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_OBJ:
-            return AS_OBJ(a) == AS_OBJ(b);
+            if (AS_OBJ(a) == AS_OBJ(b)) {
+                return true;
+            }
+            // reading a method twice may or may not reuse a cached bound
+            // method, so they're equal when they bind the same things
+            if (IS_BOUND_METHOD(a) && IS_BOUND_METHOD(b)) {
+                ObjBoundMethod* x = AS_BOUND_METHOD(a);
+                ObjBoundMethod* y = AS_BOUND_METHOD(b);
+                return x->method == y->method &&
+                       values_equal(x->receiver, y->receiver);
+            }
+            return false;
 
         default:
             UNREACHABLE("could not handle value equality");
@@ -5,25 +5,8 @@
 
 #include "common.h"
 
-typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
-typedef enum ValueType {
-    VAL_BOOL,
-    VAL_NIL,
-    VAL_NUMBER,
-    VAL_OBJ,
-} ValueType;
-
-typedef struct Value {
-    ValueType type;
-    union as {
-        bool boolean;
-        double number;
-        Obj* obj;
-    } as;
-} Value;
-
 #define IS_BOOL(value_struct) ((value_struct).type == VAL_BOOL)
 #define IS_NIL(value_struct) ((value_struct).type == VAL_NIL)
 #define IS_NUMBER(value_struct) ((value_struct).type == VAL_NUMBER)
@@ -45,9 +28,9 @@ typedef struct ValueArray {
 } ValueArray;
 
 void value_array_init(ValueArray* value_array);
-void value_array_free(ValueArray* value_array);
-void value_array_write(ValueArray* value_array, Value value);
-Value value_get(ValueArray* array, uint8_t i);
+void value_array_free(VM* vm, ValueArray* value_array);
+void value_array_write(VM* vm, ValueArray* value_array, Value value);
+Value value_get(ValueArray* array, int i);
 void fvalue_print(FILE* file, Value value);
 void value_print(Value value);
 bool values_equal(Value a, Value b);
@@ -1,33 +1,64 @@
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "assert.h"
+#include "buffer.h"
 #include "common.h"
 #include "compiling/compiler.h"
 #include "config.h"
 #include "debug.h"
+#include "jit.h"
+#include "list.h"
+#include "map.h"
 #include "memory.h"
 #include "object.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "script.h"
 #include "value.h"
 #include "vm.h"
 
-VM vm;
+// frames of a runtime error's stack trace printed at most
+#define TRACE_FRAMES_MAX 32
 
-static Value clock_native(int arg_count, Value* args) {
+static bool clock_native(VM* vm, int arg_count, Value* args, Value* result) {
+    UNUSED(vm);
     UNUSED(arg_count);
     UNUSED(args);
-    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+// range(end) counts from 0, range(start, end) from start
+static bool range_native(VM* vm, int arg_count, Value* args, Value* result) {
+    if (arg_count != 1 && arg_count != 2) {
+        return native_error(vm, "expected 1 or 2 arguments, got %d",
+                            arg_count);
+    }
+    double start = 0;
+    double end;
+    if (!native_number(vm, args, arg_count - 1, &end) ||
+        (arg_count == 2 && !native_number(vm, args, 0, &start))) {
+        return false;
+    }
+    *result = OBJ_VAL(range_new(vm, start, end));
+    return true;
 }
 
-static void reset_stack(void) {
-    vm.stack_top = vm.stack;
-    vm.frame_count = 0;
-    vm.open_upvalues = NULL;
+static void reset_stack(VM* vm) {
+    vm->stack_top = vm->stack;
+    vm->frame_count = 0;
+    for (int i = 0; i < vm->open_top; i++) {
+        vm->open_upvalues[i] = NULL;
+    }
+    vm->open_top = 0;
 }
 
-static void runtime_error(const char* format, ...) {
+void runtime_error(VM* vm, const char* format, ...) {
     printf("ERROR: ");
     va_list args;
     va_start(args, format);
@@ -35,11 +66,17 @@ static void runtime_error(const char* format, ...) {
     va_end(args);
     fputs("\n", stderr);
 
-    for (int i = vm.frame_count - 1; i >= 0; i--) {
-        CallFrame* frame = &vm.frames[i];
+    // deep recursion would print thousands of identical lines
+    int shown = 0;
+    for (int i = vm->frame_count - 1; i >= 0; i--, shown++) {
+        if (shown == TRACE_FRAMES_MAX) {
+            fprintf(stderr, "[%d more frames]\n", i + 1);
+            break;
+        }
+        CallFrame* frame = &vm->frames[i];
         ObjFunction* function = frame->closure->function;
         size_t instruction_index = frame->ip - 1 - function->chunk.code;
-        int line = function->chunk.lines[instruction_index];
+        int line = chunk_line(&function->chunk, (int)instruction_index);
 
         fprintf(stderr, "[line %d] in ", line);
 
@@ -50,197 +87,830 @@ static void runtime_error(const char* format, ...) {
         }
     }
 
-    reset_stack();
+    reset_stack(vm);
 }
 
-static void define_native(const char* name, NativeFn function, int arity) {
-    push(OBJ_VAL(copy_string(name, (int)strlen(name))));
-    push(OBJ_VAL(native_new(function, arity)));
-    table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-    pop();
-    pop();
+static Value peek(VM* vm, int distance) {
+    return vm->stack_top[-1 - distance];
 }
 
-static Value peek(int distance) {
-    return vm.stack_top[-1 - distance];
+// counts a call or loop iteration towards compiling the function. frozen
+// functions are never compiled, other threads may be running them
+static inline void warm_up(ObjFunction* function) {
+#ifdef ENABLE_JIT
+    if (!function->jit && !function->obj.is_frozen &&
+        ++function->hotness == JIT_THRESHOLD) {
+        jit_compile(function);
+    }
+#else
+    UNUSED(function);
+#endif
 }
 
-static bool call(ObjClosure* closure, int arg_count) {
-    if (arg_count != closure->function->arity) {
-        runtime_error("expected %d arguments, got %d", closure->function->arity,
-                      arg_count);
+static void update_limits(VM* vm) {
+    vm->frame_limit = vm->frame_capacity < vm->max_frames ? vm->frame_capacity
+                                                          : vm->max_frames;
+    vm->stack_limit = vm->stack_capacity < vm->max_stack ? vm->stack_capacity
+                                                         : vm->max_stack;
+}
+
+// both return false when there isn't enough memory
+static bool grow_frames(VM* vm) {
+    int capacity = GROW_CAPACITY(vm->frame_capacity);
+    if (capacity > vm->max_frames) {
+        capacity = vm->max_frames;
+    }
+    CallFrame* frames = realloc(vm->frames, sizeof(CallFrame) * capacity);
+    if (frames == NULL) {
         return false;
     }
+    vm->frames = frames;
+    vm->frame_capacity = capacity;
+    update_limits(vm);
+    return true;
+}
 
-    if (vm.frame_count == FRAMES_MAX) {
-        runtime_error("stack overflow");
+// makes the stack hold at least `needed` values. the frames and the open
+// upvalues point into it, so they're moved along with it. the table of open
+// upvalues grows with it
+static bool grow_stack(VM* vm, int needed) {
+    int capacity = vm->stack_capacity;
+    while (capacity < needed) {
+        capacity = capacity < vm->max_stack / 2 ? capacity * 2 : vm->max_stack;
+    }
+    ObjUpvalue** open_upvalues =
+        realloc(vm->open_upvalues, sizeof(ObjUpvalue*) * capacity);
+    if (open_upvalues == NULL) {
         return false;
     }
+    for (int i = vm->stack_capacity; i < capacity; i++) {
+        open_upvalues[i] = NULL;
+    }
+    vm->open_upvalues = open_upvalues;
 
-    CallFrame* frame = &vm.frames[vm.frame_count++];
+    Value* stack = malloc(sizeof(Value) * capacity);
+    if (stack == NULL) {
+        return false;
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * (vm->stack_top - vm->stack));
+    for (int i = 0; i < vm->frame_count; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (int i = 0; i < vm->open_top; i++) {
+        if (vm->open_upvalues[i] != NULL) {
+            vm->open_upvalues[i]->location = stack + i;
+        }
+    }
+    vm->stack_top = stack + (vm->stack_top - vm->stack);
+
+    free(vm->stack);
+    vm->stack = stack;
+    vm->stack_capacity = capacity;
+    update_limits(vm);
+    return true;
+}
+
+// whether the stack can hold `needed` values, growing it if it has to
+static inline bool reserve_stack(VM* vm, int needed) {
+    return needed <= vm->stack_limit ||
+           (needed <= vm->max_stack && grow_stack(vm, needed));
+}
+
+// whether there's room for another frame, growing the frames if there has to
+static inline bool reserve_frame(VM* vm) {
+    return vm->frame_count < vm->frame_limit ||
+           (vm->frame_count < vm->max_frames && grow_frames(vm));
+}
+
+// pushes the frame of a call whose arguments have been checked
+static inline bool push_frame(VM* vm, ObjClosure* closure, int arg_count) {
+    ObjFunction* function = closure->function;
+    Value* slots = vm->stack_top - 1 - arg_count;
+    int needed =
+        (int)(slots - vm->stack) + function->max_slots + STACK_HEADROOM;
+    if (!reserve_frame(vm) || !reserve_stack(vm, needed)) {
+        runtime_error(vm, "stack overflow");
+        return false;
+    }
+
+    warm_up(function);
+
+    CallFrame* frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
-    frame->slots = vm.stack_top - 1 - arg_count;
+    frame->ip = function->chunk.code;
+    // the stack may have moved
+    frame->slots = vm->stack_top - 1 - arg_count;
+    profiler_poll(vm);
     return true;
 }
 
-static bool call_value(Value callee, int arg_count) {
+static bool call(VM* vm, ObjClosure* closure, int arg_count) {
+    if (arg_count != closure->function->arity) {
+        runtime_error(vm, "expected %d arguments, got %d",
+                      closure->function->arity, arg_count);
+        return false;
+    }
+
+    return push_frame(vm, closure, arg_count);
+}
+
+static inline bool native_arity_matches(ObjNative* native_fn, int arg_count) {
+    return native_fn->arity == -1 || arg_count == native_fn->arity;
+}
+
+// calls a native whose arguments have been checked
+static inline bool run_native(VM* vm, ObjNative* native_fn, int arg_count) {
+    Value* args = vm->stack_top - arg_count;
+    Value result = NIL_VAL;
+    if (!native_fn->function(vm, arg_count, args, &result)) {
+        return false;
+    }
+    vm->stack_top = args - 1;
+    push(vm, result);
+    return true;
+}
+
+// the arguments are passed in place on the stack, and the result replaces
+// them and the callee or receiver below them
+static bool call_native(VM* vm, ObjNative* native_fn, int arg_count) {
+    if (!native_arity_matches(native_fn, arg_count)) {
+        runtime_error(vm, "expected %d arguments, got %d", native_fn->arity,
+                      arg_count);
+        return false;
+    }
+
+    return run_native(vm, native_fn, arg_count);
+}
+
+// calls a method found in a class, which is either a closure or a native
+static bool call_method(VM* vm, Value method, int arg_count) {
+    if (IS_NATIVE(method)) {
+        return call_native(vm, AS_NATIVE(method), arg_count);
+    }
+    return call(vm, AS_CLOSURE(method), arg_count);
+}
+
+static bool call_value(VM* vm, Value callee, int arg_count) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
             case OBJ_BOUND_METHOD: {
                 ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
-                vm.stack_top[-arg_count - 1] = bound->receiver;
-                return call(bound->method, arg_count);
+                vm->stack_top[-arg_count - 1] = bound->receiver;
+                return call_method(vm, OBJ_VAL(bound->method), arg_count);
             }
             case OBJ_CLASS: {
                 ObjClass* klass = AS_CLASS(callee);
-                vm.stack_top[-arg_count - 1] = OBJ_VAL(instance_new(klass));
+                Value instance = OBJ_VAL(instance_new(vm, klass));
+                vm->stack_top[-arg_count - 1] = instance;
 
-                Value initializer;
-                if (table_get(&klass->methods, vm.init_string, &initializer)) {
-                    return call(AS_CLOSURE(initializer), arg_count);
+                Value initializer = klass->initializer;
+                if (!IS_NIL(initializer)) {
+                    if (!call_method(vm, initializer, arg_count)) {
+                        return false;
+                    }
+                    // a native init returns nil instead of the instance
+                    if (IS_NATIVE(initializer)) {
+                        vm->stack_top[-1] = instance;
+                    }
+                    return true;
                 } else if (arg_count != 0) {
-                    runtime_error("expected 0 arguments but got %d", arg_count);
-                    return INTERPRET_RUNTIME_ERROR;
+                    runtime_error(vm, "expected 0 arguments but got %d",
+                                  arg_count);
+                    return false;
                 }
 
                 return true;
             }
             case OBJ_CLOSURE:
-                return call(AS_CLOSURE(callee), arg_count);
-            case OBJ_NATIVE: {
-                ObjNative* native_fn = AS_NATIVE(callee);
-                if (arg_count != native_fn->arity) {
-                    runtime_error("expected %d arguments, got %d",
-                                  native_fn->arity, arg_count);
-                }
-                Value result =
-                    native_fn->function(arg_count, vm.stack_top - arg_count);
-                // +1 to also free the native function object
-                vm.stack_top -= arg_count + 1;
-                push(result);
-                return true;
-            }
+                return call(vm, AS_CLOSURE(callee), arg_count);
+            case OBJ_NATIVE:
+                return call_native(vm, AS_NATIVE(callee), arg_count);
             default:
                 break;
         }
     }
 
-    runtime_error("can only call functions and classes");
+    runtime_error(vm, "can only call functions and classes");
     return false;
 }
 
-static bool invoke_from_class(ObjClass* klass, ObjString* name, int arg_count) {
+static bool invoke_from_class(VM* vm,
+                              ObjClass* klass,
+                              ObjString* name,
+                              int arg_count) {
     Value method;
-    if (!table_get(&klass->methods, name, &method)) {
-        runtime_error("undefined property '%s'.", name->chars);
+    if (!class_get_method(klass, name, &method)) {
+        runtime_error(vm, "undefined property '%s'.", name->chars);
         return false;
     }
 
-    return call(AS_CLOSURE(method), arg_count);
+    return call_method(vm, method, arg_count);
 }
 
-static bool invoke(ObjString* name, int arg_count) {
-    Value receiver = peek(arg_count);
+// the class holding the methods of a built-in type, NULL for other values
+static inline ObjClass* builtin_class(VM* vm, Value value) {
+    if (!IS_OBJ(value)) {
+        return NULL;
+    }
+    switch (OBJ_TYPE(value)) {
+        case OBJ_LIST:
+            return vm->list_class;
+        case OBJ_MAP:
+            return vm->map_class;
+        case OBJ_BUFFER:
+            return AS_BUFFER(value)->type == BUFFER_FLOAT64
+                       ? vm->float64_array_class
+                       : vm->byte_buffer_class;
+        default:
+            return NULL;
+    }
+}
 
-    if (!IS_INSTANCE(receiver)) {
-        runtime_error("only instances have methods");
-        return false;
+// the invoke cache of an OP_INVOKE, NULL in a shared script's functions,
+// which are never written to
+static inline InvokeCache* invoke_cache(VM* vm, CallFrame* frame, int index) {
+    ObjFunction* function = frame->closure->function;
+    if (function->obj.is_frozen) {
+        return NULL;
     }
+    return chunk_invoke_cache(vm, &function->chunk, index);
+}
+
+// calls the method through the vtable slot cache holds when the receiver's
+// class is the one it was filled in for, and fills it in otherwise
+static bool invoke(VM* vm, ObjString* name, int arg_count, InvokeCache* cache) {
+    Value receiver = peek(vm, arg_count);
 
-    ObjInstance* instance = AS_INSTANCE(receiver);
+    ObjClass* klass = builtin_class(vm, receiver);
+    if (klass == NULL) {
+        if (!IS_INSTANCE(receiver)) {
+            runtime_error(vm, "only instances have methods");
+            return false;
+        }
 
-    Value field;
-    if (table_get(&instance->fields, name, &field)) {
-        vm.stack_top[-arg_count - 1] = field;
-        return call_value(field, arg_count);
+        ObjInstance* instance = AS_INSTANCE(receiver);
+
+        Value field;
+        if (table_get(&instance->fields, name, &field)) {
+            vm->stack_top[-arg_count - 1] = field;
+            return call_value(vm, field, arg_count);
+        }
+        klass = instance->klass;
     }
 
-    return invoke_from_class(instance->klass, name, arg_count);
+    if (cache != NULL && cache->klass == klass) {
+        return call_method(vm, klass->vtable.values[cache->slot], arg_count);
+    }
+
+    int slot = class_method_slot(klass, name);
+    if (slot == -1) {
+        runtime_error(vm, "undefined property '%s'.", name->chars);
+        return false;
+    }
+    if (cache != NULL) {
+        cache->klass = klass;
+        cache->slot = slot;
+    }
+    return call_method(vm, klass->vtable.values[slot], arg_count);
 }
 
-static bool bind_method(ObjClass* klass, ObjString* name) {
+static bool bind_method(VM* vm, ObjClass* klass, ObjString* name) {
     Value method;
-    if (!table_get(&klass->methods, name, &method)) {
-        runtime_error("undefined property '%s'.", name->chars);
+    if (!class_get_method(klass, name, &method)) {
+        runtime_error(vm, "undefined property '%s'.", name->chars);
         return false;
     }
 
-    ObjBoundMethod* bound = bound_method_new(peek(0), AS_CLOSURE(method));
+    // every receiver with methods is an object
+    Obj* receiver = AS_OBJ(peek(vm, 0));
+    uintptr_t hash = ((uintptr_t)receiver ^ (uintptr_t)AS_OBJ(method)) >> 4;
+    ObjBoundMethod** entry =
+        &vm->bound_methods[hash & (BOUND_METHOD_CACHE - 1)];
+    if (*entry == NULL || AS_OBJ((*entry)->receiver) != receiver ||
+        (*entry)->method != AS_OBJ(method)) {
+        *entry = bound_method_new(vm, peek(vm, 0), AS_OBJ(method));
+    }
+    ObjBoundMethod* bound = *entry;
 
-    pop();
-    push(OBJ_VAL(bound));
+    pop(vm);
+    push(vm, OBJ_VAL(bound));
     return true;
 }
 
-static ObjUpvalue* capture_upvalue(Value* local) {
-    ObjUpvalue* prev_upvalue = NULL;
-    ObjUpvalue* upvalue = vm.open_upvalues;
-    while (upvalue && upvalue->location > local) {
-        prev_upvalue = upvalue;
-        upvalue = upvalue->next;
+static ObjUpvalue* capture_upvalue(VM* vm, Value* local) {
+    int slot = (int)(local - vm->stack);
+    if (vm->open_upvalues[slot] != NULL) {
+        return vm->open_upvalues[slot];
     }
 
-    if (upvalue && upvalue->location == local) {
-        return upvalue;
+    ObjUpvalue* upvalue = upvalue_new(vm, local);
+    vm->open_upvalues[slot] = upvalue;
+    if (slot >= vm->open_top) {
+        vm->open_top = slot + 1;
     }
+    return upvalue;
+}
 
-    ObjUpvalue* new_upvalue = upvalue_new(local);
-    new_upvalue->next = upvalue;
-
-    if (!prev_upvalue) {
-        vm.open_upvalues = new_upvalue;
-    } else {
-        prev_upvalue->next = new_upvalue;
+// closes the upvalues of last and every slot above it
+static void close_upvalues(VM* vm, Value* last) {
+    int first = (int)(last - vm->stack);
+    for (int i = vm->open_top - 1; i >= first; i--) {
+        ObjUpvalue* upvalue = vm->open_upvalues[i];
+        if (upvalue != NULL) {
+            upvalue->closed = *upvalue->location;
+            upvalue->location = &upvalue->closed;
+            vm->open_upvalues[i] = NULL;
+        }
+    }
+    if (vm->open_top > first) {
+        vm->open_top = first;
     }
-
-    return new_upvalue;
 }
 
-static void close_upvalues(Value* last) {
-    while (vm.open_upvalues && vm.open_upvalues->location >= last) {
-        ObjUpvalue* upvalue = vm.open_upvalues;
-        upvalue->closed = *upvalue->location;
-        upvalue->location = &upvalue->closed;
-        vm.open_upvalues = upvalue->next;
+// replaces the running frame with a call to closure, whose arguments are on
+// top of the stack. the frame's upvalues are closed first, like a return
+// would
+static bool tail_call(VM* vm, ObjClosure* closure, int arg_count) {
+    if (arg_count != closure->function->arity) {
+        runtime_error(vm, "expected %d arguments, got %d",
+                      closure->function->arity, arg_count);
+        return false;
+    }
+
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
+    int needed = (int)(frame->slots - vm->stack) +
+                 closure->function->max_slots + STACK_HEADROOM;
+    if (!reserve_stack(vm, needed)) {
+        runtime_error(vm, "stack overflow");
+        return false;
     }
+
+    warm_up(closure->function);
+
+    close_upvalues(vm, frame->slots);
+    memmove(frame->slots, vm->stack_top - 1 - arg_count,
+            sizeof(Value) * (arg_count + 1));
+    vm->stack_top = frame->slots + arg_count + 1;
+    frame->closure = closure;
+    frame->ip = closure->function->chunk.code;
+    profiler_poll(vm);
+    return true;
 }
 
-static void define_method(ObjString* name) {
+static void define_method(VM* vm, ObjString* name) {
     ASSERT(
-        IS_CLOSURE(peek(0)),
+        IS_CLOSURE(peek(vm, 0)),
         "the top of the stack is the closure to be associated with the class");
-    ASSERT(IS_CLASS(peek(1)),
+    ASSERT(IS_CLASS(peek(vm, 1)),
            "there is a class behind the method to associate it with");
 
-    Value method = peek(0);
-    ObjClass* klass = AS_CLASS(peek(1));
-    table_set(&klass->methods, name, method);
-    pop();
+    Value method = peek(vm, 0);
+    ObjClass* klass = AS_CLASS(peek(vm, 1));
+    class_set_method(vm, klass, name, method);
+    pop(vm);
 }
 
-static bool is_falsy(Value value) {
+bool is_falsy(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate(void) {
-    ObjString* b = AS_STRING(peek(0));
-    ObjString* a = AS_STRING(peek(1));
-
+// both strings must be reachable by the GC while this runs
+static ObjString* concatenate_strings(VM* vm, ObjString* a, ObjString* b) {
     int len = a->len + b->len;
-    char* chars = ALLOCATE(char, len + 1);
+    char* chars = ALLOCATE(vm, char, len + 1);
     memcpy(chars, a->chars, a->len);
     memcpy(chars + a->len, b->chars, b->len);
     chars[len] = '\0';
 
-    ObjString* result = take_string(chars, len);
-    pop();
-    pop();
-    push(OBJ_VAL(result));
+    return take_string(vm, chars, len);
+}
+
+static void concatenate(VM* vm) {
+    ObjString* result =
+        concatenate_strings(vm, AS_STRING(peek(vm, 1)), AS_STRING(peek(vm, 0)));
+    pop(vm);
+    pop(vm);
+    push(vm, OBJ_VAL(result));
+}
+
+// `+` on operands that are not on the stack, used by the register
+// instructions
+bool add_values(VM* vm, Value a, Value b, Value* result) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        *result = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+    } else if (IS_STRING(a) && IS_STRING(b)) {
+        *result = OBJ_VAL(concatenate_strings(vm, AS_STRING(a), AS_STRING(b)));
+    } else {
+        runtime_error(vm, "Operands must be two numbers or two strings.");
+        return false;
+    }
+
+    return true;
+}
+
+// the position index refers to in a list or buffer of count elements, which
+// must be a whole number below count
+static bool element_index(VM* vm, Value index, int count, int* position) {
+    if (!IS_NUMBER(index)) {
+        runtime_error(vm, "index must be a number");
+        return false;
+    }
+
+    double number = AS_NUMBER(index);
+    // checked before the cast, which NaN would make undefined
+    if (!isfinite(number) || number < 0 || number >= count) {
+        runtime_error(vm, "index %g out of range for length %d", number,
+                      count);
+        return false;
+    }
+    if (number != (int)number) {
+        runtime_error(vm, "index %g is not a whole number", number);
+        return false;
+    }
+    *position = (int)number;
+    return true;
+}
+
+// `target[index]`, shared with the JIT. a key missing from a map is nil and
+// buffer elements are read as plain numbers
+bool get_index(VM* vm, Value target, Value index, Value* result) {
+    if (!IS_OBJ(target)) {
+        runtime_error(vm, "only lists, maps and buffers can be indexed");
+        return false;
+    }
+
+    int position;
+    switch (OBJ_TYPE(target)) {
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(target);
+            if (!element_index(vm, index, list->items.count, &position)) {
+                return false;
+            }
+            *result = list->items.values[position];
+            return true;
+        }
+        case OBJ_MAP:
+            if (!map_get(AS_MAP(target), index, result)) {
+                *result = NIL_VAL;
+            }
+            return true;
+        case OBJ_BUFFER: {
+            ObjBuffer* buffer = AS_BUFFER(target);
+            if (!element_index(vm, index, buffer->count, &position)) {
+                return false;
+            }
+            *result = buffer->type == BUFFER_FLOAT64
+                          ? NUMBER_VAL(((double*)buffer->data)[position])
+                          : NUMBER_VAL(((uint8_t*)buffer->data)[position]);
+            return true;
+        }
+        default:
+            runtime_error(vm, "only lists, maps and buffers can be indexed");
+            return false;
+    }
+}
+
+static bool set_buffer_element(VM* vm,
+                               ObjBuffer* buffer,
+                               int position,
+                               Value value) {
+    if (!IS_NUMBER(value)) {
+        runtime_error(vm, "buffer elements must be numbers");
+        return false;
+    }
+
+    double number = AS_NUMBER(value);
+    if (buffer->type == BUFFER_FLOAT64) {
+        ((double*)buffer->data)[position] = number;
+        return true;
+    }
+    if (!isfinite(number) || number < 0 || number > UINT8_MAX ||
+        number != (int)number) {
+        runtime_error(vm, "bytes must be whole numbers from 0 to 255");
+        return false;
+    }
+    ((uint8_t*)buffer->data)[position] = (uint8_t)number;
+    return true;
+}
+
+// `target[index] = value`, shared with the JIT
+bool set_index(VM* vm, Value target, Value index, Value value) {
+    if (!IS_OBJ(target)) {
+        runtime_error(vm, "only lists, maps and buffers can be indexed");
+        return false;
+    }
+
+    int position;
+    switch (OBJ_TYPE(target)) {
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(target);
+            if (!element_index(vm, index, list->items.count, &position)) {
+                return false;
+            }
+            list->items.values[position] = value;
+            return true;
+        }
+        case OBJ_MAP:
+            if (!map_check_key(vm, index)) {
+                return false;
+            }
+            map_set(vm, AS_MAP(target), index, value);
+            return true;
+        case OBJ_BUFFER: {
+            ObjBuffer* buffer = AS_BUFFER(target);
+            return element_index(vm, index, buffer->count, &position) &&
+                   set_buffer_element(vm, buffer, position, value);
+        }
+        default:
+            runtime_error(vm, "only lists, maps and buffers can be indexed");
+            return false;
+    }
+}
+
+// replaces the top count values on the stack with a list of them, shared
+// with the JIT
+void build_list(VM* vm, int count) {
+    ObjList* list = list_new(vm, count);
+    if (count > 0) {
+        memcpy(list->items.values, vm->stack_top - count,
+               sizeof(Value) * count);
+    }
+    list->items.count = count;
+    vm->stack_top -= count;
+    push(vm, OBJ_VAL(list));
+}
+
+// replaces the top count key and value pairs on the stack with a map of
+// them, shared with the JIT
+bool build_map(VM* vm, int count) {
+    ObjMap* map = map_new(vm);
+    push(vm, OBJ_VAL(map));
+    Value* pairs = vm->stack_top - 1 - 2 * count;
+    for (int i = 0; i < count; i++) {
+        Value key = pairs[2 * i];
+        if (!map_check_key(vm, key)) {
+            return false;
+        }
+        map_set(vm, map, key, pairs[2 * i + 1]);
+    }
+
+    vm->stack_top = pairs;
+    push(vm, OBJ_VAL(map));
+    return true;
+}
+
+// pushes the initial state of a for-in loop over the value on top of the
+// stack, shared with the JIT. the built-in types keep an index there and
+// instances whatever their iterate() method returns, starting from nil
+bool iter_init(VM* vm) {
+    Value sequence = peek(vm, 0);
+    if (IS_OBJ(sequence)) {
+        switch (OBJ_TYPE(sequence)) {
+            case OBJ_BUFFER:
+            case OBJ_LIST:
+            case OBJ_MAP:
+            case OBJ_RANGE:
+            case OBJ_STRING:
+                push(vm, NUMBER_VAL(0));
+                return true;
+            case OBJ_INSTANCE:
+                push(vm, NIL_VAL);
+                return true;
+            default:
+                break;
+        }
+    }
+
+    runtime_error(vm, "can only iterate over lists, maps, strings, ranges, "
+                      "buffers and instances");
+    return false;
+}
+
+// advances a for-in loop whose sequence and state are the top two values on
+// the stack, shared with the JIT. nothing is allocated but the one character
+// strings of a string
+IterStep iter_next(VM* vm) {
+    Value sequence = peek(vm, 1);
+    if (IS_INSTANCE(sequence)) {
+        return ITER_PROTOCOL;
+    }
+
+    int index = (int)AS_NUMBER(peek(vm, 0));
+    Value value;
+    switch (OBJ_TYPE(sequence)) {
+        case OBJ_BUFFER: {
+            ObjBuffer* buffer = AS_BUFFER(sequence);
+            if (index >= buffer->count) {
+                return ITER_DONE;
+            }
+            value = buffer->type == BUFFER_FLOAT64
+                        ? NUMBER_VAL(((double*)buffer->data)[index])
+                        : NUMBER_VAL(((uint8_t*)buffer->data)[index]);
+            break;
+        }
+        case OBJ_LIST: {
+            ObjList* list = AS_LIST(sequence);
+            if (index >= list->items.count) {
+                return ITER_DONE;
+            }
+            value = list->items.values[index];
+            break;
+        }
+        case OBJ_MAP: {
+            // the keys, skipping unused entries
+            ObjMap* map = AS_MAP(sequence);
+            while (index < map->capacity &&
+                   !map_entry_used(&map->entries[index])) {
+                index++;
+            }
+            if (index >= map->capacity) {
+                return ITER_DONE;
+            }
+            value = map->entries[index].key;
+            break;
+        }
+        case OBJ_RANGE: {
+            ObjRange* range = AS_RANGE(sequence);
+            double number = range->start + index;
+            if (number >= range->end) {
+                return ITER_DONE;
+            }
+            value = NUMBER_VAL(number);
+            break;
+        }
+        case OBJ_STRING: {
+            // the string is still on the stack while the character is
+            // interned
+            ObjString* string = AS_STRING(sequence);
+            if (index >= string->len) {
+                return ITER_DONE;
+            }
+            value = OBJ_VAL(copy_string(vm, string->chars + index, 1));
+            break;
+        }
+        default:
+            UNREACHABLE("iter_init() only accepts iterable values");
+    }
+
+    vm->stack_top[-1] = NUMBER_VAL(index + 1);
+    push(vm, value);
+    return ITER_VALUE;
+}
+
+// records the operand types seen by the arithmetic instruction being
+// executed, and rewrites it to `quickened` while they have all been numbers.
+// frozen code is left alone, other threads may be running it
+static inline void record_feedback(VM* vm,
+                                   CallFrame* frame,
+                                   Value a,
+                                   Value b,
+                                   OpCode quickened) {
+    if (frame->closure->function->obj.is_frozen) {
+        return;
+    }
+
+    Chunk* chunk = &frame->closure->function->chunk;
+    uint8_t* ip = frame->ip - 1;
+    uint8_t* feedback = chunk_feedback(vm, chunk, (int)(ip - chunk->code));
+    *feedback |= FEEDBACK_TYPE(a.type) | FEEDBACK_TYPE(b.type);
+    if (*feedback == FEEDBACK_TYPE(VAL_NUMBER)) {
+        *ip = quickened;
+    }
 }
 
-static InterpretResult run(void) {
-    CallFrame* frame = &vm.frames[vm.frame_count - 1];
+// records the kind of callee an OP_CALL calls, and rewrites it to
+// OP_CALL_CLOSURE or OP_CALL_NATIVE once it has only called one kind. a
+// closure must also take arg_count arguments, so the quickened instruction
+// only checks it's calling a closure with the right arity
+static inline void record_call_feedback(VM* vm,
+                                        CallFrame* frame,
+                                        Value callee,
+                                        int arg_count) {
+    if (frame->closure->function->obj.is_frozen) {
+        return;
+    }
+
+    uint8_t kind = FEEDBACK_OTHER_CALLEE;
+    if (IS_CLOSURE(callee) &&
+        AS_CLOSURE(callee)->function->arity == arg_count) {
+        kind = FEEDBACK_CLOSURE;
+    } else if (IS_NATIVE(callee) &&
+               native_arity_matches(AS_NATIVE(callee), arg_count)) {
+        kind = FEEDBACK_NATIVE;
+    }
+
+    Chunk* chunk = &frame->closure->function->chunk;
+    uint8_t* ip = frame->ip - 2;
+    uint8_t* feedback = chunk_feedback(vm, chunk, (int)(ip - chunk->code));
+    *feedback |= kind;
+    if (*feedback == FEEDBACK_CLOSURE) {
+        *ip = OP_CALL_CLOSURE;
+    } else if (*feedback == FEEDBACK_NATIVE) {
+        *ip = OP_CALL_NATIVE;
+    }
+}
+
+// rewrites the quickened instruction being executed back to its generic form
+// and rewinds to it, so it runs again and records the new operand types
+static void deoptimize(CallFrame* frame) {
+    frame->ip--;
+    *frame->ip = unquickened_op(*frame->ip);
+}
+
+// the bodies of the instructions that also have a wide form
+
+static inline bool get_global(VM* vm, ObjString* name) {
+    Value value;
+    if (!table_get(&vm->globals, name, &value)) {
+        runtime_error(vm, "undefined variable: '%s'", name->chars);
+        return false;
+    }
+
+    push(vm, value);
+    return true;
+}
+
+static inline bool set_global(VM* vm, ObjString* name) {
+    if (table_set(vm, &vm->globals, name, peek(vm, 0))) {
+        table_delete(&vm->globals, name);
+        runtime_error(vm, "undefined variable: '%s'", name->chars);
+        return false;
+    }
+    return true;
+}
+
+static inline bool get_property(VM* vm, ObjString* name) {
+    ObjClass* builtin = builtin_class(vm, peek(vm, 0));
+    if (builtin != NULL) {
+        return bind_method(vm, builtin, name);
+    }
+
+    if (!IS_INSTANCE(peek(vm, 0))) {
+        runtime_error(vm, "only instances have properties");
+        return false;
+    }
+
+    ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+    Value value;
+    if (table_get(&instance->fields, name, &value)) {
+        pop(vm);  // instance
+        push(vm, value);
+        return true;
+    }
+
+    return bind_method(vm, instance->klass, name);
+}
+
+static inline bool set_property(VM* vm, ObjString* name) {
+    if (!IS_INSTANCE(peek(vm, 1))) {
+        runtime_error(vm, "only instances have fields");
+        return false;
+    }
+
+    ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+    table_set(vm, &instance->fields, name, peek(vm, 0));
+    Value value = pop(vm);
+    pop(vm);
+    push(vm, value);
+    return true;
+}
+
+// pushes a closure of function, reading the upvalue operands that follow
+// the instruction
+static inline void make_closure(VM* vm,
+                                CallFrame* frame,
+                                ObjFunction* function,
+                                bool wide) {
+    ObjClosure* closure = closure_new(vm, function);
+    push(vm, OBJ_VAL(closure));
+
+    for (int i = 0; i < closure->upvalue_count; i++) {
+        uint8_t is_local = *frame->ip++;
+        int index = *frame->ip++;
+        if (wide) {
+            index = (index << 8) | *frame->ip++;
+        }
+
+        if (is_local) {
+            closure->upvalues[i] = capture_upvalue(vm, frame->slots + index);
+        } else {
+            closure->upvalues[i] = frame->closure->upvalues[index];
+        }
+    }
+}
+
+// pushes the closure of a local function that reads its variables from its
+// caller's frame, skipping the upvalue operands
+static inline void push_local_function(VM* vm,
+                                       CallFrame* frame,
+                                       ObjFunction* function,
+                                       bool wide) {
+    frame->ip += function->upvalue_count * (wide ? 3 : 2);
+    push(vm, OBJ_VAL(local_function_closure(vm, function)));
+}
+
+static InterpretResult run(VM* vm) {
+    CallFrame* frame = &vm->frames[vm->frame_count - 1];
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_CONSTANT() \
@@ -248,27 +918,84 @@ static InterpretResult run(void) {
 #define READ_SHORT() \
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_STRING() (AS_STRING(READ_CONSTANT()))
-#define BINARY_OP(value_type, op)                                            \
-    do {                                                                     \
-        if (!IS_NUMBER(peek(1))) {                                           \
-            runtime_error("left operand of '%s' operator must be a number",  \
-                          (#op));                                            \
-            return INTERPRET_RUNTIME_ERROR;                                  \
-        }                                                                    \
-        if (!IS_NUMBER(peek(0))) {                                           \
-            runtime_error("right operand of '%s' operator must be a number", \
-                          (#op));                                            \
-            return INTERPRET_RUNTIME_ERROR;                                  \
-        }                                                                    \
-        double b = AS_NUMBER(pop());                                         \
-        double a = AS_NUMBER(pop());                                         \
-        push(value_type(a op b));                                            \
+// the constant at the operand of a wide instruction
+#define WIDE_CONSTANT() \
+    (value_get(&frame->closure->function->chunk.constants, operand))
+#define WIDE_STRING() (AS_STRING(WIDE_CONSTANT()))
+#define CHECK_NUMBER_OPERANDS(op, a, b)                                 \
+    do {                                                                \
+        if (!IS_NUMBER(a)) {                                            \
+            runtime_error(vm,                                           \
+                          "left operand of '%s' operator must be a "    \
+                          "number",                                     \
+                          (#op));                                       \
+            return INTERPRET_RUNTIME_ERROR;                             \
+        }                                                               \
+        if (!IS_NUMBER(b)) {                                            \
+            runtime_error(vm,                                           \
+                          "right operand of '%s' operator must be a "   \
+                          "number",                                     \
+                          (#op));                                       \
+            return INTERPRET_RUNTIME_ERROR;                             \
+        }                                                               \
+    } while (false)
+#define BINARY_OP(value_type, op, quickened)                             \
+    do {                                                                 \
+        record_feedback(vm, frame, peek(vm, 1), peek(vm, 0), quickened); \
+        CHECK_NUMBER_OPERANDS(op, peek(vm, 1), peek(vm, 0));             \
+        double b = AS_NUMBER(pop(vm));                                   \
+        double a = AS_NUMBER(pop(vm));                                   \
+        push(vm, value_type(a op b));                                    \
+    } while (false)
+// quickened form of BINARY_OP, which deoptimizes instead of checking types
+#define NUMBER_OP(value_type, op)                                 \
+    do {                                                          \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            deoptimize(frame);                                    \
+            break;                                                \
+        }                                                         \
+        double b = AS_NUMBER(vm->stack_top[-1]);                  \
+        double a = AS_NUMBER(vm->stack_top[-2]);                  \
+        vm->stack_top--;                                          \
+        vm->stack_top[-1] = value_type(a op b);                   \
+    } while (false)
+#define READ_REGISTER() (frame->slots[READ_BYTE()])
+#ifdef ENABLE_JIT
+// continue in machine code if the running function has been compiled
+#define JIT_ENTER()                            \
+    do {                                       \
+        if (frame->closure->function->jit &&   \
+            jit_run(vm, frame) == JIT_ERROR) { \
+            return INTERPRET_RUNTIME_ERROR;    \
+        }                                      \
+    } while (false)
+#else
+#define JIT_ENTER() \
+    do {            \
+    } while (false)
+#endif
+// push(vm, R[a] op <b>), where b is read by `read_b`
+#define REGISTER_OP(value_type, op, read_b)                 \
+    do {                                                    \
+        Value a = READ_REGISTER();                          \
+        Value b = read_b;                                   \
+        CHECK_NUMBER_OPERANDS(op, a, b);                    \
+        push(vm, value_type(AS_NUMBER(a) op AS_NUMBER(b))); \
+    } while (false)
+// R[a] = R[b] op <c>, where c is read by `read_c`
+#define REGISTER_STORE_OP(op, read_c)                                 \
+    do {                                                              \
+        uint8_t dst = READ_BYTE();                                    \
+        Value b = READ_REGISTER();                                    \
+        Value c = read_c;                                             \
+        CHECK_NUMBER_OPERANDS(op, b, c);                              \
+        frame->slots[dst] = NUMBER_VAL(AS_NUMBER(b) op AS_NUMBER(c)); \
     } while (false)
 
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("          ");
-        for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+        for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
             printf("[ ");
             value_print(*slot);
             printf(" ]");
@@ -280,65 +1007,106 @@ static InterpretResult run(void) {
             (int)(frame->ip - frame->closure->function->chunk.code));
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
+        uint8_t instruction = READ_BYTE();
+#ifdef DEBUG_OPCODE_STATS
+        opstats_record(instruction);
+#endif
+        switch (instruction) {
             case OP_RETURN: {
-                Value result = pop();
-                close_upvalues(frame->slots);
-                vm.frame_count--;
-                if (vm.frame_count == 0) {
+                Value result = pop(vm);
+                close_upvalues(vm, frame->slots);
+                vm->frame_count--;
+                if (vm->frame_count == 0) {
                     // finished executing top-level code
-                    pop();  // pop the <script> function
+                    pop(vm);  // pop the <script> function
                     return INTERPRET_OK;
                 }
 
-                vm.stack_top = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frame_count - 1];
+                vm->stack_top = frame->slots;
+                push(vm, result);
+                frame = &vm->frames[vm->frame_count - 1];
+                profiler_poll(vm);
+                JIT_ENTER();
                 break;
             }
             case OP_CLASS:
-                push(OBJ_VAL(class_new(READ_STRING())));
+                push(vm, OBJ_VAL(class_new(vm, READ_STRING())));
+                break;
+            case OP_BUILD_LIST:
+                build_list(vm, READ_BYTE());
+                break;
+            case OP_BUILD_MAP:
+                if (!build_map(vm, READ_BYTE())) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 break;
+            case OP_ITER_INIT:
+                if (!iter_init(vm)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            case OP_ITER_NEXT: {
+                uint16_t exit = READ_SHORT();
+                uint16_t body = READ_SHORT();
+                switch (iter_next(vm)) {
+                    case ITER_DONE:
+                        frame->ip += exit;
+                        break;
+                    case ITER_VALUE:
+                        frame->ip += body;
+                        break;
+                    case ITER_PROTOCOL:
+                        // the compiled calls to iterate() and
+                        // iteratorValue() follow
+                        break;
+                }
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value result;
+                if (!get_index(vm, peek(vm, 1), peek(vm, 0), &result)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm->stack_top -= 2;
+                push(vm, result);
+                break;
+            }
+            case OP_SET_INDEX: {
+                Value value = peek(vm, 0);
+                if (!set_index(vm, peek(vm, 2), peek(vm, 1), value)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm->stack_top -= 3;
+                push(vm, value);
+                break;
+            }
             case OP_INHERIT: {
-                Value superclass = peek(1);
+                Value superclass = peek(vm, 1);
                 if (!IS_CLASS(superclass)) {
-                    runtime_error("superclass must be a class");
+                    runtime_error(vm, "superclass must be a class");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                ASSERT(IS_CLASS(peek(0)),
+                ASSERT(IS_CLASS(peek(vm, 0)),
                        "the top of the stack is a class when executing "
                        "OP_INHERIT");
-                ObjClass* subclass = AS_CLASS(peek(0));
+                ObjClass* subclass = AS_CLASS(peek(vm, 0));
 
-                table_add_all(&AS_CLASS(superclass)->methods,
-                              &subclass->methods);
-                pop();  // subclass
+                class_inherit(vm, subclass, AS_CLASS(superclass));
+                subclass->foreign = AS_CLASS(superclass)->foreign;
+                pop(vm);  // subclass
                 break;
             }
             case OP_METHOD:
-                define_method(READ_STRING());
-                break;
-            case OP_CLOSURE: {
-                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure* closure = closure_new(function);
-                push(OBJ_VAL(closure));
-
-                for (int i = 0; i < closure->upvalue_count; i++) {
-                    uint8_t is_local = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-
-                    if (is_local) {
-                        closure->upvalues[i] =
-                            capture_upvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
-                }
-
+                define_method(vm, READ_STRING());
+                break;
+            case OP_CLOSURE:
+                make_closure(vm, frame, AS_FUNCTION(READ_CONSTANT()), false);
+                break;
+            case OP_LOCAL_FUNCTION:
+                push_local_function(vm, frame, AS_FUNCTION(READ_CONSTANT()),
+                                    false);
                 break;
-            }
             case OP_JUMP: {
                 uint16_t jump = READ_SHORT();
                 frame->ip += jump;
@@ -346,216 +1114,453 @@ static InterpretResult run(void) {
             }
             case OP_JUMP_IF_FALSE: {
                 uint16_t jump = READ_SHORT();
-                if (is_falsy(peek(0))) {
+                if (is_falsy(peek(vm, 0))) {
                     frame->ip += jump;
                 }
                 break;
             }
             case OP_LOOP: {
                 uint16_t jump = READ_SHORT();
+                profiler_poll(vm);
                 frame->ip -= jump;
+                warm_up(frame->closure->function);
+                JIT_ENTER();
                 break;
             }
             case OP_CALL: {
                 int arg_count = READ_BYTE();
-                if (!call_value(peek(arg_count), arg_count)) {
+                Value callee = peek(vm, arg_count);
+                record_call_feedback(vm, frame, callee, arg_count);
+                if (!call_value(vm, callee, arg_count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                JIT_ENTER();
+                break;
+            }
+            // the quickened calls deoptimize before reading their operand
+            case OP_CALL_CLOSURE: {
+                int arg_count = *frame->ip;
+                Value callee = peek(vm, arg_count);
+                if (!IS_CLOSURE(callee) ||
+                    AS_CLOSURE(callee)->function->arity != arg_count) {
+                    deoptimize(frame);
+                    break;
+                }
+                frame->ip++;
+                if (!push_frame(vm, AS_CLOSURE(callee), arg_count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                JIT_ENTER();
+                break;
+            }
+            case OP_CALL_NATIVE: {
+                int arg_count = *frame->ip;
+                Value callee = peek(vm, arg_count);
+                if (!IS_NATIVE(callee) ||
+                    !native_arity_matches(AS_NATIVE(callee), arg_count)) {
+                    deoptimize(frame);
+                    break;
+                }
+                frame->ip++;
+                if (!run_native(vm, AS_NATIVE(callee), arg_count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm->frames[vm->frame_count - 1];
+                break;
+            }
+            case OP_TAIL_CALL: {
+                int arg_count = READ_BYTE();
+                Value callee = peek(vm, arg_count);
+                if (IS_BOUND_METHOD(callee) &&
+                    AS_BOUND_METHOD(callee)->method->type == OBJ_CLOSURE) {
+                    ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+                    vm->stack_top[-arg_count - 1] = bound->receiver;
+                    callee = OBJ_VAL(bound->method);
+                }
+
+                // anything else is called normally, and the OP_RETURN after
+                // this returns its result
+                bool called = IS_CLOSURE(callee)
+                                  ? tail_call(vm, AS_CLOSURE(callee), arg_count)
+                                  : call_value(vm, callee, arg_count);
+                if (!called) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->frames[vm->frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_INVOKE: {
                 ObjString* method_name = READ_STRING();
                 uint8_t arg_count = READ_BYTE();
+                InvokeCache* cache = invoke_cache(vm, frame, READ_SHORT());
 
-                if (!invoke(method_name, arg_count)) {
+                if (!invoke(vm, method_name, arg_count, cache)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->frames[vm->frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_SUPER_INVOKE: {
                 ObjString* method_name = READ_STRING();
                 uint8_t arg_count = READ_BYTE();
-                ASSERT(IS_CLASS(peek(0)),
+                ASSERT(IS_CLASS(peek(vm, 0)),
                        "the top of the stack is a class when executing "
                        "OP_SUPER_INVOKE");
-                ObjClass* superclass = AS_CLASS(pop());
-                if (!invoke_from_class(superclass, method_name, arg_count)) {
+                ObjClass* superclass = AS_CLASS(pop(vm));
+                if (!invoke_from_class(vm, superclass, method_name,
+                                       arg_count)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                frame = &vm.frames[vm.frame_count - 1];
+                frame = &vm->frames[vm->frame_count - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_PRINT: {
-                value_print(pop());
+                value_print(pop(vm));
                 printf("\n");
                 break;
             }
             case OP_POP:
-                pop();
+                pop(vm);
                 break;
             case OP_CLOSE_UPVALUE:
-                close_upvalues(vm.stack_top - 1);
-                pop();
+                close_upvalues(vm, vm->stack_top - 1);
+                pop(vm);
                 break;
             case OP_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                ASSERT(slot < (uint8_t)(vm.stack_top - vm.stack),
+                ASSERT(frame->slots + slot < vm->stack_top,
                        "variable slot is inside of the stack");
-                push(frame->slots[slot]);
+                push(vm, frame->slots[slot]);
                 break;
             }
             case OP_SET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                ASSERT(slot < (uint8_t)(vm.stack_top - vm.stack),
+                ASSERT(frame->slots + slot < vm->stack_top,
                        "variable slot is inside of the stack");
-                frame->slots[slot] = peek(0);
+                frame->slots[slot] = peek(vm, 0);
                 break;
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!table_get(&vm.globals, name, &value)) {
-                    runtime_error("undefined variable: '%s'", name->chars);
+            case OP_GET_GLOBAL:
+                if (!get_global(vm, READ_STRING())) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                push(value);
                 break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (table_set(&vm.globals, name, peek(0))) {
-                    table_delete(&vm.globals, name);
-                    runtime_error("undefined variable: '%s'", name->chars);
+            case OP_SET_GLOBAL:
+                if (!set_global(vm, READ_STRING())) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
                 break;
-            }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
-                table_set(&vm.globals, name, peek(0));
-                pop();
+                table_set(vm, &vm->globals, name, peek(vm, 0));
+                pop(vm);
                 break;
             }
             case OP_GET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
+                push(vm, *frame->closure->upvalues[slot]->location);
                 break;
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+                *frame->closure->upvalues[slot]->location = peek(vm, 0);
                 break;
             }
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(0))) {
-                    runtime_error("only instances have properties");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                ObjInstance* instance = AS_INSTANCE(peek(0));
-                ObjString* name = READ_STRING();
-
-                Value value;
-                if (table_get(&instance->fields, name, &value)) {
-                    pop();  // instance
-                    push(value);
-                    break;
-                }
-
-                if (!bind_method(instance->klass, name)) {
+            case OP_GET_CALLER_LOCAL:
+                push(vm, (frame - 1)->slots[READ_BYTE()]);
+                break;
+            case OP_SET_CALLER_LOCAL:
+                (frame - 1)->slots[READ_BYTE()] = peek(vm, 0);
+                break;
+            case OP_GET_PROPERTY:
+                if (!get_property(vm, READ_STRING())) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
-            }
-            case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(1))) {
-                    runtime_error("only instances have fields");
+            case OP_SET_PROPERTY:
+                if (!set_property(vm, READ_STRING())) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                table_set(&instance->fields, READ_STRING(), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
                 break;
-            }
             case OP_GET_SUPER: {
                 ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop());
+                ObjClass* superclass = AS_CLASS(pop(vm));
 
-                if (!bind_method(superclass, name)) {
+                if (!bind_method(vm, superclass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
                 break;
             }
+            case OP_WIDE: {
+                // kept apart from the narrow forms so they don't get slower
+                uint8_t op = READ_BYTE();
+                uint16_t operand = READ_SHORT();
+                switch (op) {
+                    case OP_CONSTANT:
+                        push(vm, WIDE_CONSTANT());
+                        break;
+                    case OP_GET_LOCAL:
+                        push(vm, frame->slots[operand]);
+                        break;
+                    case OP_SET_LOCAL:
+                        frame->slots[operand] = peek(vm, 0);
+                        break;
+                    case OP_GET_GLOBAL:
+                        if (!get_global(vm, WIDE_STRING())) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    case OP_SET_GLOBAL:
+                        if (!set_global(vm, WIDE_STRING())) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    case OP_DEFINE_GLOBAL:
+                        table_set(vm, &vm->globals, WIDE_STRING(),
+                                  peek(vm, 0));
+                        pop(vm);
+                        break;
+                    case OP_GET_UPVALUE:
+                        push(vm,
+                             *frame->closure->upvalues[operand]->location);
+                        break;
+                    case OP_SET_UPVALUE:
+                        *frame->closure->upvalues[operand]->location =
+                            peek(vm, 0);
+                        break;
+                    case OP_GET_CALLER_LOCAL:
+                        push(vm, (frame - 1)->slots[operand]);
+                        break;
+                    case OP_SET_CALLER_LOCAL:
+                        (frame - 1)->slots[operand] = peek(vm, 0);
+                        break;
+                    case OP_GET_PROPERTY:
+                        if (!get_property(vm, WIDE_STRING())) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    case OP_SET_PROPERTY:
+                        if (!set_property(vm, WIDE_STRING())) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    case OP_GET_SUPER:
+                        if (!bind_method(vm, AS_CLASS(pop(vm)),
+                                         WIDE_STRING())) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    case OP_CLASS:
+                        push(vm,
+                             OBJ_VAL(class_new(vm, WIDE_STRING())));
+                        break;
+                    case OP_METHOD:
+                        define_method(vm, WIDE_STRING());
+                        break;
+                    case OP_CLOSURE:
+                        make_closure(vm, frame, AS_FUNCTION(WIDE_CONSTANT()),
+                                     true);
+                        break;
+                    case OP_LOCAL_FUNCTION:
+                        push_local_function(vm, frame,
+                                            AS_FUNCTION(WIDE_CONSTANT()), true);
+                        break;
+                    case OP_INVOKE:
+                    case OP_SUPER_INVOKE: {
+                        uint8_t arg_count = READ_BYTE();
+                        bool invoked;
+                        if (op == OP_INVOKE) {
+                            InvokeCache* cache =
+                                invoke_cache(vm, frame, READ_SHORT());
+                            invoked = invoke(vm, WIDE_STRING(), arg_count,
+                                             cache);
+                        } else {
+                            invoked = invoke_from_class(vm, AS_CLASS(pop(vm)),
+                                                        WIDE_STRING(),
+                                                        arg_count);
+                        }
+                        if (!invoked) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        frame = &vm->frames[vm->frame_count - 1];
+                        JIT_ENTER();
+                        break;
+                    }
+                    default:
+                        UNREACHABLE("only instructions with an index operand "
+                                    "have a wide form");
+                }
+                break;
+            }
             case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(values_equal(a, b)));
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(values_equal(a, b)));
                 break;
             }
             case OP_GREATER:
-                BINARY_OP(BOOL_VAL, >);
+                BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM);
                 break;
             case OP_LESS:
-                BINARY_OP(BOOL_VAL, <);
+                BINARY_OP(BOOL_VAL, <, OP_LESS_NUM);
                 break;
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                push(vm, constant);
                 break;
             }
             case OP_NIL:
-                push(NIL_VAL);
+                push(vm, NIL_VAL);
                 break;
             case OP_TRUE:
-                push(BOOL_VAL(true));
+                push(vm, BOOL_VAL(true));
                 break;
             case OP_FALSE:
-                push(BOOL_VAL(false));
+                push(vm, BOOL_VAL(false));
                 break;
             case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("negation operand must be a number");
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtime_error(vm, "negation operand must be a number");
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
                 break;
             }
             case OP_NOT:
-                push(BOOL_VAL(is_falsy(pop())));
+                push(vm, BOOL_VAL(is_falsy(pop(vm))));
                 break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                record_feedback(vm, frame, peek(vm, 1), peek(vm, 0),
+                                OP_ADD_NUM);
+                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+                    concatenate(vm);
+                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
+                    double b = AS_NUMBER(pop(vm));
+                    double a = AS_NUMBER(pop(vm));
+                    push(vm, NUMBER_VAL(a + b));
                 } else {
-                    runtime_error(
+                    runtime_error(vm, 
                         "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
             case OP_SUBTRACT:
-                BINARY_OP(NUMBER_VAL, -);
+                BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM);
                 break;
             case OP_MULTIPLY:
-                BINARY_OP(NUMBER_VAL, *);
+                BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM);
                 break;
             case OP_DIVIDE:
-                BINARY_OP(NUMBER_VAL, /);
+                BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM);
+                break;
+            case OP_ADD_NUM:
+                NUMBER_OP(NUMBER_VAL, +);
+                break;
+            case OP_SUBTRACT_NUM:
+                NUMBER_OP(NUMBER_VAL, -);
+                break;
+            case OP_MULTIPLY_NUM:
+                NUMBER_OP(NUMBER_VAL, *);
+                break;
+            case OP_DIVIDE_NUM:
+                NUMBER_OP(NUMBER_VAL, /);
+                break;
+            case OP_GREATER_NUM:
+                NUMBER_OP(BOOL_VAL, >);
+                break;
+            case OP_LESS_NUM:
+                NUMBER_OP(BOOL_VAL, <);
+                break;
+            case OP_MOVE: {
+                uint8_t dst = READ_BYTE();
+                frame->slots[dst] = READ_REGISTER();
+                break;
+            }
+            case OP_LOADK: {
+                uint8_t dst = READ_BYTE();
+                frame->slots[dst] = READ_CONSTANT();
+                break;
+            }
+            case OP_ADD_RR:
+            case OP_ADD_RK: {
+                Value a = READ_REGISTER();
+                Value b = instruction == OP_ADD_RR ? READ_REGISTER()
+                                                   : READ_CONSTANT();
+                Value result;
+                if (!add_values(vm, a, b, &result)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(vm, result);
+                break;
+            }
+            case OP_SUBTRACT_RR:
+                REGISTER_OP(NUMBER_VAL, -, READ_REGISTER());
+                break;
+            case OP_MULTIPLY_RR:
+                REGISTER_OP(NUMBER_VAL, *, READ_REGISTER());
+                break;
+            case OP_DIVIDE_RR:
+                REGISTER_OP(NUMBER_VAL, /, READ_REGISTER());
+                break;
+            case OP_LESS_RR:
+                REGISTER_OP(BOOL_VAL, <, READ_REGISTER());
+                break;
+            case OP_GREATER_RR:
+                REGISTER_OP(BOOL_VAL, >, READ_REGISTER());
+                break;
+            case OP_SUBTRACT_RK:
+                REGISTER_OP(NUMBER_VAL, -, READ_CONSTANT());
+                break;
+            case OP_MULTIPLY_RK:
+                REGISTER_OP(NUMBER_VAL, *, READ_CONSTANT());
+                break;
+            case OP_DIVIDE_RK:
+                REGISTER_OP(NUMBER_VAL, /, READ_CONSTANT());
+                break;
+            case OP_LESS_RK:
+                REGISTER_OP(BOOL_VAL, <, READ_CONSTANT());
+                break;
+            case OP_GREATER_RK:
+                REGISTER_OP(BOOL_VAL, >, READ_CONSTANT());
+                break;
+            case OP_ADD_RRR:
+            case OP_ADD_RRK: {
+                uint8_t dst = READ_BYTE();
+                Value b = READ_REGISTER();
+                Value c = instruction == OP_ADD_RRR ? READ_REGISTER()
+                                                    : READ_CONSTANT();
+                if (!add_values(vm, b, c, &frame->slots[dst])) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case OP_SUBTRACT_RRR:
+                REGISTER_STORE_OP(-, READ_REGISTER());
+                break;
+            case OP_MULTIPLY_RRR:
+                REGISTER_STORE_OP(*, READ_REGISTER());
+                break;
+            case OP_DIVIDE_RRR:
+                REGISTER_STORE_OP(/, READ_REGISTER());
+                break;
+            case OP_SUBTRACT_RRK:
+                REGISTER_STORE_OP(-, READ_CONSTANT());
+                break;
+            case OP_MULTIPLY_RRK:
+                REGISTER_STORE_OP(*, READ_CONSTANT());
+                break;
+            case OP_DIVIDE_RRK:
+                REGISTER_STORE_OP(/, READ_CONSTANT());
                 break;
         }
     }
@@ -564,58 +1569,139 @@ static InterpretResult run(void) {
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
+#undef WIDE_CONSTANT
+#undef WIDE_STRING
+#undef CHECK_NUMBER_OPERANDS
 #undef BINARY_OP
+#undef NUMBER_OP
+#undef READ_REGISTER
+#undef REGISTER_OP
+#undef REGISTER_STORE_OP
+#undef JIT_ENTER
 }
 
-void init_vm(void) {
-    reset_stack();
-
-    vm.objects = NULL;
-    vm.bytes_allocated = 0;
-    vm.next_gc = 1024 * 1024;
-    vm.gray_count = 0;
-    vm.gray_capacity = 0;
-    vm.gray_stack = NULL;
-
-    table_init(&vm.globals);
-    table_init(&vm.strings);
+VM* vm_new(void) {
+    VM* vm = malloc(sizeof(VM));
+    if (vm == NULL) {
+        return NULL;
+    }
+    // enough for the natives defined below and the first call
+    vm->stack = malloc(sizeof(Value) * STACK_HEADROOM);
+    vm->open_upvalues = calloc(STACK_HEADROOM, sizeof(ObjUpvalue*));
+    if (vm->stack == NULL || vm->open_upvalues == NULL) {
+        free(vm->stack);
+        free(vm->open_upvalues);
+        free(vm);
+        return NULL;
+    }
+    vm->open_top = 0;
+    vm->stack_capacity = STACK_HEADROOM;
+    vm->max_stack = STACK_MAX;
+    vm->frames = NULL;
+    vm->frame_capacity = 0;
+    vm->max_frames = FRAMES_MAX;
+    update_limits(vm);
+    reset_stack(vm);
+
+    vm->objects = NULL;
+    vm->bytes_allocated = 0;
+    vm->next_gc = 1024 * 1024;
+    vm->gray_count = 0;
+    vm->gray_capacity = 0;
+    vm->gray_stack = NULL;
+
+    table_init(&vm->globals);
+    table_init(&vm->strings);
+
+    vm->init_string = NULL;
+    vm->list_class = NULL;
+    vm->map_class = NULL;
+    vm->float64_array_class = NULL;
+    vm->byte_buffer_class = NULL;
+    for (int i = 0; i < BOUND_METHOD_CACHE; i++) {
+        vm->bound_methods[i] = NULL;
+    }
+    vm->init_string = shared_string(vm, "init", 4);
+    vm->list_class = list_class_new(vm);
+    vm->map_class = map_class_new(vm);
+    buffer_init(vm);
+
+    vm_define_native(vm, "clock", clock_native, 0);
+    vm_define_native(vm, "range", range_native, -1);
+
+#ifdef DEBUG_OPCODE_STATS
+    // the counts are shared by every vm, and runtime errors exit without
+    // going through vm_free()
+    static bool reporting = false;
+    if (!reporting) {
+        atexit(opstats_report);
+        reporting = true;
+    }
+#endif
+    return vm;
+}
 
-    vm.init_string = NULL;
-    vm.init_string = copy_string("init", 4);
+void vm_free(VM* vm) {
+    if (vm == NULL) {
+        return;
+    }
+    table_free(vm, &vm->globals);
+    script_release_strings(&vm->strings);
+    table_free(vm, &vm->strings);
+    vm->init_string = NULL;
+    vm->list_class = NULL;
+    vm->map_class = NULL;
+    vm->float64_array_class = NULL;
+    vm->byte_buffer_class = NULL;
+    free_objects(vm);
+    free(vm->frames);
+    free(vm->stack);
+    free(vm->open_upvalues);
+    free(vm);
+}
 
-    define_native("clock", clock_native, 0);
+void vm_set_stack_limits(VM* vm, int max_frames, int max_stack) {
+    vm->max_frames = max_frames;
+    vm->max_stack = max_stack;
+    update_limits(vm);
 }
 
-void free_vm(void) {
-    table_free(&vm.globals);
-    table_free(&vm.strings);
-    vm.init_string = NULL;
-    free_objects();
+static InterpretResult run_script(VM* vm, ObjFunction* function) {
+    push(vm, OBJ_VAL(function));
+    ObjClosure* closure = closure_new(vm, function);
+    pop(vm);
+    push(vm, OBJ_VAL(closure));
+    if (!call(vm, closure, 0)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return run(vm);
 }
 
-InterpretResult interpret(const char* source) {
-    ObjFunction* function = compile(source);
+InterpretResult vm_interpret(VM* vm, const char* source) {
+    ObjFunction* function = compile(vm, source);
     if (!function) {
         return INTERPRET_COMPILE_ERROR;
     }
+    return run_script(vm, function);
+}
 
-    push(OBJ_VAL(function));
-    ObjClosure* closure = closure_new(function);
-    pop();
-    push(OBJ_VAL(closure));
-    call(closure, 0);
-
-    return run();
+InterpretResult vm_interpret_script(VM* vm, const Script* script) {
+    if (!script_link(vm, script)) {
+        return vm_interpret(vm, script->source);
+    }
+    return run_script(vm, script->function);
 }
 
-void push(Value value) {
-    ASSERT((int)(vm.stack_top - vm.stack) < STACK_MAX, "the stack is not full");
-    *vm.stack_top = value;
-    vm.stack_top++;
+void push(VM* vm, Value value) {
+    ASSERT((int)(vm->stack_top - vm->stack) < vm->stack_capacity,
+           "the stack is not full");
+    *vm->stack_top = value;
+    vm->stack_top++;
 }
-Value pop(void) {
-    ASSERT(vm.stack_top != vm.stack, "the stack is not empty");
-    vm.stack_top--;
-    Value value = *vm.stack_top;
+Value pop(VM* vm) {
+    ASSERT(vm->stack_top != vm->stack, "the stack is not empty");
+    vm->stack_top--;
+    Value value = *vm->stack_top;
     return value;
 }
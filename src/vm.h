@@ -6,8 +6,15 @@
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// how deep calls can nest and how many values the stack can hold, unless
+// vm_set_stack_limits() changes them
+#define FRAMES_MAX (1 << 16)
+#define STACK_MAX (1 << 22)
+// entries in the cache of bound methods, a power of two
+#define BOUND_METHOD_CACHE 64
+// room kept free above the values of the running function, for the values
+// natives push and for calls out of natives
+#define STACK_HEADROOM (4 * UINT8_COUNT)
 
 typedef struct CallFrame {
     ObjClosure* closure;
@@ -15,15 +22,39 @@ typedef struct CallFrame {
     Value* slots;
 } CallFrame;
 
-typedef struct VM {
-    CallFrame frames[FRAMES_MAX];
+struct VM {
+    // both start out small and grow as calls nest deeper, up to max_frames
+    // and max_stack
+    CallFrame* frames;
     int frame_count;
-    Value stack[STACK_MAX];
+    int frame_capacity;
+    int max_frames;
+    Value* stack;
     Value* stack_top;
+    int stack_capacity;
+    int max_stack;
+    // the smaller of each capacity and its maximum, so a call that neither
+    // grows nor overflows them compares against one number for each
+    int frame_limit;
+    int stack_limit;
     Table globals;
     Table strings;
     ObjString* init_string;
-    ObjUpvalue* open_upvalues;
+    // hold the methods of the built-in types
+    ObjClass* list_class;
+    ObjClass* map_class;
+    ObjClass* float64_array_class;
+    ObjClass* byte_buffer_class;
+    // recently bound methods, indexed by a hash of the receiver and the
+    // method, so reading the same method of the same object again doesn't
+    // allocate. only an allocation saving: bound methods are equal when they
+    // bind the same method to the same receiver, cached or not. the
+    // collector drops the entries it frees
+    ObjBoundMethod* bound_methods[BOUND_METHOD_CACHE];
+    // the open upvalue of each stack slot, or NULL, as long as the stack.
+    // none of the slots from open_top up have one
+    ObjUpvalue** open_upvalues;
+    int open_top;
 
     size_t bytes_allocated;
     size_t next_gc;
@@ -32,20 +63,29 @@ typedef struct VM {
     int gray_count;
     int gray_capacity;
     Obj** gray_stack;
-} VM;
+};
 
-typedef enum InterpretResult {
-    INTERPRET_OK,
-    INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR,
-} InterpretResult;
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
-extern VM vm;
+// used by code that runs instructions outside of run(), like the JIT
+void runtime_error(VM* vm, const char* format, ...);
+bool is_falsy(Value value);
+bool add_values(VM* vm, Value a, Value b, Value* result);
+bool get_index(VM* vm, Value target, Value index, Value* result);
+bool set_index(VM* vm, Value target, Value index, Value value);
+void build_list(VM* vm, int count);
+bool build_map(VM* vm, int count);
 
-void init_vm(void);
-void free_vm(void);
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop(void);
+typedef enum IterStep {
+    ITER_DONE,
+    // the next value has been pushed
+    ITER_VALUE,
+    // the sequence is an instance, the loop calls its methods instead
+    ITER_PROTOCOL,
+} IterStep;
+
+bool iter_init(VM* vm);
+IterStep iter_next(VM* vm);
 
 #endif